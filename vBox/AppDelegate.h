@@ -8,7 +8,6 @@
 
 #import <UIKit/UIKit.h>
 #import <CoreData/CoreData.h>
-#import "DrivingHistory.h"
 
 @interface AppDelegate : UIResponder <UIApplicationDelegate>
 
@@ -17,11 +16,18 @@
 @property (readonly,strong,nonatomic) NSManagedObjectContext *managedObjectContext;
 @property (readonly,strong,nonatomic) NSManagedObjectModel *managedObjectModel;
 @property (readonly,strong,nonatomic) NSPersistentStoreCoordinator *persistentStoreCoordinator;
-@property (readonly,strong,nonatomic) DrivingHistory *drivingHistory;
 
+//! Runs block once the store is open: right away if it is, otherwise on the main queue when the migration behind the launch HUD completes. Call on the main queue. The Core Data accessors below must not be used before then
+-(void)performWhenStoreIsOpen:(void (^)(void))block;
+//! Saves managedObjectContext into the writer context, which writes to the store asynchronously
 -(void)saveContext;
+//! Private queue context on the store coordinator, parent of every other context. Use it directly only for requests that go straight to the store (e.g. batch deletes)
+-(NSManagedObjectContext *)writerContext;
+//! Private queue child of the writer context; its saves are merged into managedObjectContext
+-(NSManagedObjectContext *)newBackgroundContext;
+//! Saves a context from newBackgroundContext through the writer to the store. Call on the context's queue
+-(BOOL)saveBackgroundContext:(NSManagedObjectContext *)context error:(NSError **)error;
 -(NSURL *)applicationDocumentsDirectory;
-- (void)forgetDrivingHistory;
 
 
 @end
@@ -11,8 +11,22 @@
 #import <Parse/Parse.h>
 #import <ParseCrashReporting/ParseCrashReporting.h>
 #import "UtilityMethods.h"
+#import "TripJournal.h"
+#import "TripFinalizer.h"
+#import "TripMigrator.h"
+#import "StoreMigrator.h"
+#import "TripRetention.h"
+#import "TripDeleter.h"
+#import "SVProgressHUD.h"
+#import <QuartzCore/QuartzCore.h>
 
 @interface AppDelegate ()
+{
+	StoreMigrator *storeMigrator;
+	BOOL storeOpen;
+	NSMutableArray *storeOpenBlocks;
+	NSManagedObjectContext *_writerContext;
+}
 
 @end
 
@@ -21,7 +35,6 @@
 @synthesize managedObjectContext = _managedObjectContext;
 @synthesize managedObjectModel = _managedObjectModel;
 @synthesize persistentStoreCoordinator = _persistentStoreCoordinator;
-@synthesize drivingHistory = _drivingHistory;
 
 - (BOOL)application:(UIApplication *)application didFinishLaunchingWithOptions:(NSDictionary *)launchOptions {
 	// Override point for customization after application launch.
@@ -39,6 +52,28 @@
     
     [self registerUserForNotifications:application];
     
+    //Listed before anything can start recording, since the store may open long after a migration and the recorder's journal must not be recovered
+    NSArray *unfinishedJournalURLs = [TripJournal unfinishedJournalURLs];
+    [self openStoreWithCompletion:^{
+        [self recoverTripsFromJournalURLsInBackground:unfinishedJournalURLs];
+        [[TripMigrator sharedMigrator] backfillDayKeysInBackground];
+        [[TripMigrator sharedMigrator] packLegacyTripsInBackground];
+        [[TripMigrator sharedMigrator] indexTripsInBackground];
+        [[TripMigrator sharedMigrator] buildRollupsInBackground];
+        [[TripRetention sharedRetention] applyRetentionInBackground];
+        [[TripDeleter sharedDeleter] deleteOrphanedRowsInBackground];
+    }];
+    
+#if DEBUG
+    if([[NSUserDefaults standardUserDefaults] boolForKey:@"StoreMigrationBenchmark"])
+    {
+        NSManagedObjectModel *model = [self managedObjectModel];
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+            [StoreMigrator runBenchmarkWithPointCount:1000000 model:model];
+        });
+    }
+#endif
+    
     if (application.applicationState != UIApplicationStateBackground) {
         // Track an app open here if we launch with a push, unless
         // "content_available" was used to trigger a background push (introduced
@@ -63,6 +98,7 @@
 - (void)applicationDidEnterBackground:(UIApplication *)application {
 	// Use this method to release shared resources, save user data, invalidate timers, and store enough application state information to restore your application to its current state in case it is terminated later.
 	// If your application supports background execution, this method is called instead of applicationWillTerminate: when the user quits.
+    [self saveContext];
 }
 
 - (void)applicationWillEnterForeground:(UIApplication *)application {
@@ -82,7 +118,8 @@
 
 - (void)applicationWillTerminate:(UIApplication *)application {
 	// Called when the application is about to terminate. Save data if appropriate. See also applicationDidEnterBackground:.
-    
+    [self saveContext];
+    [_writerContext performBlockAndWait:^{}]; //the writer queue is serial, so this waits for the save above
 }
 
 #pragma mark - Remote Notifications
@@ -106,18 +143,87 @@
 
 #pragma mark - Core Data
 
+//Saves the main context into the writer, then the writer to the store off the main thread
 -(void)saveContext
 {
 	NSError *error = nil;
 	NSManagedObjectContext *managedObjectContext = self.managedObjectContext;
 	if(managedObjectContext != nil)
 	{
-		if([managedObjectContext hasChanges] && ![managedObjectContext save:&error])
+		if([managedObjectContext hasChanges])
+		{
+			CFTimeInterval start = CACurrentMediaTime();
+			if(![managedObjectContext save:&error])
+			{
+				NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+//				abort(); //dont use abort in real app, only for debugging
+				return;
+			}
+			[UtilityMethods trackPerformanceEvent:@"ContextSave" duration:CACurrentMediaTime() - start dimensions:@{@"tier":@"main"}];
+		}
+		[self saveWriterContext];
+	}
+}
+
+//Held in a background task, since saveContext is what runs as the app enters the background
+-(void)saveWriterContext
+{
+	__block UIBackgroundTaskIdentifier backgroundTask = [[UIApplication sharedApplication] beginBackgroundTaskWithExpirationHandler:^{
+		[[UIApplication sharedApplication] endBackgroundTask:backgroundTask];
+		backgroundTask = UIBackgroundTaskInvalid;
+	}];
+
+	NSManagedObjectContext *writerContext = _writerContext;
+	[writerContext performBlock:^{
+		if([writerContext hasChanges])
+		{
+			CFTimeInterval start = CACurrentMediaTime();
+			NSError *error = nil;
+			if([writerContext save:&error])
+				[UtilityMethods trackPerformanceEvent:@"ContextSave" duration:CACurrentMediaTime() - start dimensions:@{@"tier":@"writer"}];
+			else
+				NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+		}
+
+		[[UIApplication sharedApplication] endBackgroundTask:backgroundTask];
+		backgroundTask = UIBackgroundTaskInvalid;
+	}];
+}
+
+-(BOOL)saveBackgroundContext:(NSManagedObjectContext *)context error:(NSError **)error
+{
+	CFTimeInterval start = CACurrentMediaTime();
+	if(![context save:error])
+		return NO;
+	CFTimeInterval pushed = CACurrentMediaTime();
+	
+	__block BOOL saved = YES;
+	__block NSError *writerError = nil;
+	NSManagedObjectContext *writerContext = self.writerContext;
+	[writerContext performBlockAndWait:^{
+		if([writerContext hasChanges] && ![writerContext save:&writerError])
 		{
-			NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
-//			abort(); //dont use abort in real app, only for debugging
+			saved = NO;
+			[writerContext rollback];
 		}
+	}];
+	if(!saved)
+	{
+		if(error)
+			*error = writerError;
+		return NO;
 	}
+	
+	[UtilityMethods trackPerformanceEvent:@"ContextSave" duration:pushed - start dimensions:@{@"tier":@"background"}];
+	[UtilityMethods trackPerformanceEvent:@"ContextSave" duration:CACurrentMediaTime() - pushed dimensions:@{@"tier":@"writer"}];
+	return YES;
+}
+
+-(NSManagedObjectContext *)writerContext
+{
+	//Created with the main context so the two always share a parent chain
+	[self managedObjectContext];
+	return _writerContext;
 }
 
 -(NSManagedObjectContext *)managedObjectContext
@@ -129,12 +235,36 @@
 	NSPersistentStoreCoordinator *coordinator = [self persistentStoreCoordinator];
 	if(coordinator != nil)
 	{
+		_writerContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+		[_writerContext setPersistentStoreCoordinator:coordinator];
+		[_writerContext setUndoManager:nil];
+		
         _managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
-		[_managedObjectContext setPersistentStoreCoordinator:coordinator];
+		[_managedObjectContext setParentContext:_writerContext];
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(managedObjectContextDidSave:) name:NSManagedObjectContextDidSaveNotification object:nil];
 	}
 	return _managedObjectContext;
 }
 
+-(NSManagedObjectContext *)newBackgroundContext
+{
+	NSManagedObjectContext *backgroundContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+	[backgroundContext setParentContext:[self writerContext]];
+	[backgroundContext setUndoManager:nil];
+	return backgroundContext;
+}
+
+//Background contexts are siblings of the main context, so their saves reach it only through a merge
+-(void)managedObjectContextDidSave:(NSNotification *)notification
+{
+	NSManagedObjectContext *savedContext = notification.object;
+	if(savedContext == _managedObjectContext || savedContext.parentContext != _writerContext)
+		return;
+	[_managedObjectContext performBlock:^{
+		[_managedObjectContext mergeChangesFromContextDidSaveNotification:notification];
+	}];
+}
+
 -(NSManagedObjectModel *)managedObjectModel
 {
 	if(_managedObjectModel != nil)
@@ -151,48 +281,83 @@
 	if(_persistentStoreCoordinator != nil){
 		return _persistentStoreCoordinator;
 	}
-	NSURL *storeURL = [[self applicationDocumentsDirectory] URLByAppendingPathComponent:@"GPSInformation.sqlite"];
+	//Opening the store while StoreMigrator is still rewriting it would migrate it a second time
+	NSAssert(storeOpen, @"Use performWhenStoreIsOpen: for Core Data work that can run before the store is migrated");
+	if(!storeOpen)
+		return nil;
 	
+	CFTimeInterval start = CACurrentMediaTime();
 	NSError *error = nil;
 	_persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:[self managedObjectModel]];
-	if(![_persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:storeURL options:@{NSMigratePersistentStoresAutomaticallyOption:@YES, NSInferMappingModelAutomaticallyOption:@YES} error:&error])
+	if(![_persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:[self storeURL] options:[StoreMigrator storeOptions] error:&error])
 	{
 		NSLog(@"Unresolved Error %@, %@",error,[error userInfo]);
 //		abort();
 	}
+	[UtilityMethods trackPerformanceEvent:@"StoreOpen" duration:CACurrentMediaTime() - start dimensions:@{@"migrated":storeMigrator ? @"yes" : @"no"}];
 	
 	return _persistentStoreCoordinator;
 }
 
--(DrivingHistory *)drivingHistory
+-(NSURL *)storeURL
+{
+	return [[self applicationDocumentsDirectory] URLByAppendingPathComponent:@"GPSInformation.sqlite"];
+}
+
+//Migrates an old store on a background queue behind a HUD so launch isn't blocked, then runs completion on the main queue
+-(void)openStoreWithCompletion:(void (^)(void))completion
 {
-	NSManagedObjectContext *context = [self managedObjectContext];
-	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"DrivingHistory"];
-	NSError *error;
-	NSArray *objects = [context executeFetchRequest:request error:&error];
-	if(error)
+	storeMigrator = [[StoreMigrator alloc] initWithStoreURL:[self storeURL] model:[self managedObjectModel]];
+	if(!storeMigrator.needsMigration)
 	{
-		NSLog(@"Error: %@, %@",error,[error userInfo]);
+		storeMigrator = nil;
+		[self storeDidOpenWithCompletion:completion];
+		return;
 	}
 	
-	if([objects count] == 0)
-	{
-		_drivingHistory = (DrivingHistory *)[NSEntityDescription insertNewObjectForEntityForName:@"DrivingHistory" inManagedObjectContext:context];
-		[self saveContext];
-	}
-	else if([objects count] == 1)
+	//Deferred so the HUD shows over the storyboard's window once it is key
+	dispatch_async(dispatch_get_main_queue(), ^{
+		[SVProgressHUD showWithStatus:@"Upgrading trips.." maskType:SVProgressHUDMaskTypeBlack];
+	});
+	[storeMigrator migrateInBackgroundWithCompletion:^(BOOL success) {
+		if(success)
+			[SVProgressHUD dismiss];
+		else
+			[SVProgressHUD showErrorWithStatus:@"Upgrade failed"];
+		[self storeDidOpenWithCompletion:completion];
+	}];
+}
+
+-(void)storeDidOpenWithCompletion:(void (^)(void))completion
+{
+	storeOpen = YES;
+	completion();
+	for(void (^block)(void) in storeOpenBlocks)
+		block();
+	storeOpenBlocks = nil;
+}
+
+-(void)performWhenStoreIsOpen:(void (^)(void))block
+{
+	if(storeOpen)
 	{
-		for(DrivingHistory *history in objects)
-		{
-			_drivingHistory = history;
-		}
+		block();
+		return;
 	}
-	return _drivingHistory;
+	if(!storeOpenBlocks)
+		storeOpenBlocks = [NSMutableArray array];
+	[storeOpenBlocks addObject:[block copy]];
 }
 
-- (void)forgetDrivingHistory
+#pragma mark - Trip Recovery
+
+//Rebuilds trips whose recording was interrupted (app killed, crash) from journals left by a previous launch
+-(void)recoverTripsFromJournalURLsInBackground:(NSArray *)journalURLs
 {
-	_drivingHistory = nil;
+	for(NSURL *url in journalURLs)
+	{
+		[[TripFinalizer sharedFinalizer] finalizeJournalAtURL:url endTime:nil];
+	}
 }
 
 #pragma mark - Application's Documents Directory
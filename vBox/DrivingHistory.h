@@ -9,23 +9,10 @@
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
 
-@class Trip;
-
+/**
+ Former root object of the store. Trips are fetched by startTime and nothing reads it any more;
+ the entity stays in the model so existing stores keep migrating lightweight.
+ */
 @interface DrivingHistory : NSManagedObject
 
-@property (nonatomic, retain) NSOrderedSet *trips;
-@end
-
-@interface DrivingHistory (CoreDataGeneratedAccessors)
-
-- (void)insertObject:(Trip *)value inTripsAtIndex:(NSUInteger)idx;
-- (void)removeObjectFromTripsAtIndex:(NSUInteger)idx;
-- (void)insertTrips:(NSArray *)value atIndexes:(NSIndexSet *)indexes;
-- (void)removeTripsAtIndexes:(NSIndexSet *)indexes;
-- (void)replaceObjectInTripsAtIndex:(NSUInteger)idx withObject:(Trip *)value;
-- (void)replaceTripsAtIndexes:(NSIndexSet *)indexes withTrips:(NSArray *)values;
-- (void)addTripsObject:(Trip *)value;
-- (void)removeTripsObject:(Trip *)value;
-- (void)addTrips:(NSOrderedSet *)values;
-- (void)removeTrips:(NSOrderedSet *)values;
 @end
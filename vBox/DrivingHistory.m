@@ -7,18 +7,8 @@
 //
 
 #import "DrivingHistory.h"
-#import "Trip.h"
 
 
 @implementation DrivingHistory
 
-@dynamic trips;
-
-- (void)addTripsObject:(Trip *)value
-{
-	NSMutableOrderedSet* tempSet = [NSMutableOrderedSet orderedSetWithOrderedSet:self.trips];
-	[tempSet addObject:value];
-	self.trips = tempSet;
-}
-
 @end
@@ -11,9 +11,9 @@
 #import "Trip.h"
 #import "TripDetailViewController.h"
 
-@interface DrivingHistoryViewController : UIViewController <UITableViewDataSource,UITableViewDelegate>
+@interface DrivingHistoryViewController : UIViewController <UITableViewDataSource,UITableViewDelegate,NSFetchedResultsControllerDelegate>
 
-@property (strong, nonatomic) NSOrderedSet *trips;
+@property (strong, nonatomic) NSFetchedResultsController *fetchedResultsController;
 @property (strong, nonatomic) IBOutlet UITableView *tableView;
 
 @end
@@ -8,11 +8,19 @@
 
 #import "DrivingHistoryViewController.h"
 #import "MyStyleKit.h"
+#import "UtilityMethods.h"
+#import "TripDeleter.h"
+#import "TripRollup.h"
+#import "SVProgressHUD.h"
+#import <QuartzCore/QuartzCore.h>
+
+#define HISTORY_BATCH_SIZE 30
+#define HISTORY_CACHE_NAME @"DrivingHistory"
 
 @interface DrivingHistoryViewController ()
 
-@property (strong, nonatomic) NSMutableDictionary *tripsByDate;
-@property (strong, nonatomic) NSArray *sortedDays;
+//! Section name (dayKey) -> TripRollup of the day, or NSNull for days not rolled up yet. Filled as headers are shown
+@property (strong, nonatomic) NSMutableDictionary *rollupsBySection;
 
 @end
 
@@ -20,7 +28,9 @@
 {
 	NSDateFormatter *dateFormatterWith12HRTime;
 	NSDateFormatter *dateFormatterDateAndNoTime;
+	NSCalendar *dayKeyCalendar; //UTC, so a dayKey maps to the midnight dateFormatterDateAndNoTime formats
 	AppDelegate *appDelegate;
+	UIBarButtonItem *deleteButton;
 }
 
 - (void)viewWillAppear:(BOOL)animated
@@ -38,6 +48,10 @@
 	dateFormatterDateAndNoTime = [[NSDateFormatter alloc] init];
 	[dateFormatterDateAndNoTime setDateStyle:NSDateFormatterMediumStyle];
 	[dateFormatterDateAndNoTime setTimeStyle:NSDateFormatterNoStyle];
+	dayKeyCalendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSCalendarIdentifierGregorian];
+	[dayKeyCalendar setTimeZone:[NSTimeZone timeZoneForSecondsFromGMT:0]];
+	[dateFormatterDateAndNoTime setCalendar:dayKeyCalendar];
+	[dateFormatterDateAndNoTime setTimeZone:dayKeyCalendar.timeZone];
 	
 	dateFormatterWith12HRTime = [[NSDateFormatter alloc] init];
 	[dateFormatterWith12HRTime setDateStyle:NSDateFormatterShortStyle];
@@ -45,9 +59,24 @@
 	[dateFormatterWith12HRTime setTimeZone:[NSTimeZone systemTimeZone]];
 	[dateFormatterWith12HRTime setDateStyle:NSDateFormatterNoStyle];
 	
-	self.trips = [[[appDelegate drivingHistory] trips] reversedOrderedSet];
+	self.rollupsBySection = [NSMutableDictionary dictionary];
+	[appDelegate performWhenStoreIsOpen:^{
+		[self setupFetchedResultsController];
+		[self updateLifetimeFooter];
+		[self.tableView reloadData];
+	}];
 	
-	[self setupTripsByDate];
+	self.tableView.allowsMultipleSelectionDuringEditing = YES;
+	deleteButton = [[UIBarButtonItem alloc] initWithTitle:@"Delete" style:UIBarButtonItemStylePlain target:self action:@selector(deleteSelectedTrips)];
+	self.navigationItem.rightBarButtonItem = self.editButtonItem;
+}
+
+-(void)setEditing:(BOOL)editing animated:(BOOL)animated
+{
+	[super setEditing:editing animated:animated];
+	[self.tableView setEditing:editing animated:animated];
+	[self.navigationItem setRightBarButtonItems:editing ? @[self.editButtonItem,deleteButton] : @[self.editButtonItem] animated:animated];
+	[self updateDeleteButton];
 }
 
 - (void)didReceiveMemoryWarning {
@@ -55,25 +84,26 @@
     // Dispose of any resources that can be recreated.
 }
 
--(void)setupTripsByDate
+//Only the summary columns the list shows are fetched, in batches, newest first
+-(void)setupFetchedResultsController
 {
-	if(self.tripsByDate)
-		self.tripsByDate = nil;
-	self.tripsByDate = [NSMutableDictionary dictionary];
-	for(Trip * trip in self.trips)
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+	[request setSortDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"dayKey" ascending:NO],[NSSortDescriptor sortDescriptorWithKey:@"startTime" ascending:NO]]];
+	[request setFetchBatchSize:HISTORY_BATCH_SIZE];
+	[request setPropertiesToFetch:@[@"dayKey",@"startTime",@"endTime",@"avgSpeed",@"maxSpeed",@"totalMiles"]];
+	
+	//Sections come from the indexed dayKey column, so no trip has to be faulted in to build them
+	self.fetchedResultsController = [[NSFetchedResultsController alloc] initWithFetchRequest:request managedObjectContext:[appDelegate managedObjectContext] sectionNameKeyPath:@"dayKey" cacheName:HISTORY_CACHE_NAME];
+	[self.fetchedResultsController setDelegate:self];
+	
+	CFTimeInterval start = CACurrentMediaTime();
+	NSError *error = nil;
+	if(![self.fetchedResultsController performFetch:&error])
 	{
-		NSDate *beginningOfDate = [self dateAtBeginningOfDayForDate:trip.startTime];
-		
-		NSMutableArray *tempArray = self.tripsByDate[beginningOfDate];
-		if(!tempArray)
-		{
-			tempArray = [NSMutableArray array];
-			self.tripsByDate[beginningOfDate] = tempArray;
-		}
-		[tempArray addObject:trip];
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
 	}
-	
-	self.sortedDays = [[[[self.tripsByDate allKeys] sortedArrayUsingSelector:@selector(compare:)] reverseObjectEnumerator] allObjects];
+	NSDictionary *dimensions = @{@"trips":[NSString stringWithFormat:@"%lu",(unsigned long)self.fetchedResultsController.fetchedObjects.count]};
+	[UtilityMethods trackPerformanceEvent:@"HistoryFetch" duration:CACurrentMediaTime() - start dimensions:dimensions];
 }
 
 -(UIStatusBarStyle)preferredStatusBarStyle
@@ -98,7 +128,7 @@
 
 - (NSInteger)numberOfSectionsInTableView:(UITableView *)tableView
 {
-	return [self.sortedDays count];
+	return [[self.fetchedResultsController sections] count];
 }
 
 - (NSString *)tableView:(UITableView *)tableView titleForHeaderInSection:(NSInteger)section
@@ -108,9 +138,8 @@
 
 - (NSInteger)tableView:(UITableView *)tableView numberOfRowsInSection:(NSInteger)section
 {
-	NSDate *dateTitle = self.sortedDays[section];
-	NSArray *tripsInDate = self.tripsByDate[dateTitle];
-	return [tripsInDate count];
+	id<NSFetchedResultsSectionInfo> sectionInfo = [self.fetchedResultsController sections][section];
+	return [sectionInfo numberOfObjects];
 }
 
 - (UITableViewCell *)tableView:(UITableView *)tableView cellForRowAtIndexPath:(NSIndexPath *)indexPath
@@ -132,9 +161,20 @@
 
 -(void)tableView:(UITableView *)tableView didSelectRowAtIndexPath:(NSIndexPath *)indexPath
 {
+	if(tableView.editing)
+	{
+		[self updateDeleteButton];
+		return;
+	}
 	[self performSegueWithIdentifier:@"tripDetailSegue" sender:indexPath];
 }
 
+-(void)tableView:(UITableView *)tableView didDeselectRowAtIndexPath:(NSIndexPath *)indexPath
+{
+	if(tableView.editing)
+		[self updateDeleteButton];
+}
+
 -(CGFloat)tableView:(UITableView *)tableView heightForHeaderInSection:(NSInteger)section
 {
 	return 30;
@@ -154,42 +194,145 @@
 {
 	if(editingStyle == UITableViewCellEditingStyleDelete)
 	{
-		NSManagedObjectContext *context = [appDelegate managedObjectContext];
+		//The fetched results controller removes the row once the delete is merged
 		Trip *tripToDelete = [self tripFromIndexPath:indexPath];
-		[context deleteObject:tripToDelete];
-		[appDelegate saveContext];
-		NSDate *dateTitle = self.sortedDays[(NSUInteger) indexPath.section];
-		NSArray *tripsInDate = self.tripsByDate[dateTitle];
-		self.trips = appDelegate.drivingHistory.trips.reversedOrderedSet; //update
-		[self setupTripsByDate]; //update dictionary
-		if(tripsInDate.count == 1) //last object to be deleted
-		{
-			[tableView deleteSections:[NSIndexSet indexSetWithIndex:(NSUInteger) indexPath.section] withRowAnimation:UITableViewRowAnimationAutomatic];
-		}
+		[[TripDeleter sharedDeleter] deleteTripsWithIDs:@[tripToDelete.objectID] completion:nil];
+	}
+}
+
+#pragma mark - Multiple Selection
+
+-(void)updateDeleteButton
+{
+	NSUInteger selectedCount = [[self.tableView indexPathsForSelectedRows] count];
+	deleteButton.enabled = selectedCount > 0;
+	deleteButton.title = selectedCount > 0 ? [NSString stringWithFormat:@"Delete (%lu)",(unsigned long)selectedCount] : @"Delete";
+}
+
+-(void)deleteSelectedTrips
+{
+	NSMutableArray *tripIDs = [NSMutableArray array];
+	for(NSIndexPath *indexPath in [self.tableView indexPathsForSelectedRows])
+	{
+		[tripIDs addObject:[self tripFromIndexPath:indexPath].objectID];
+	}
+	if(tripIDs.count == 0)
+		return;
+	
+	[self setEditing:NO animated:YES];
+	[SVProgressHUD showWithStatus:@"Deleting.."];
+	[[TripDeleter sharedDeleter] deleteTripsWithIDs:tripIDs completion:^(NSUInteger deletedCount) {
+		if(deletedCount == tripIDs.count)
+			[SVProgressHUD showSuccessWithStatus:@"Deleted!"];
 		else
-		{
-			[tableView deleteRowsAtIndexPaths:@[indexPath] withRowAnimation:UITableViewRowAnimationAutomatic];
-			[tableView headerViewForSection:indexPath.section].textLabel.text = [self stringForTitleInSection:indexPath.section];
-		}
+			[SVProgressHUD showErrorWithStatus:@"Some trips could not be deleted"];
+	}];
+}
+
+#pragma mark - Fetched Results Controller Delegate
+
+-(void)controllerWillChangeContent:(NSFetchedResultsController *)controller
+{
+	[self.rollupsBySection removeAllObjects]; //days come and go with the rows
+	[self.tableView beginUpdates];
+}
+
+-(void)controller:(NSFetchedResultsController *)controller didChangeSection:(id<NSFetchedResultsSectionInfo>)sectionInfo atIndex:(NSUInteger)sectionIndex forChangeType:(NSFetchedResultsChangeType)type
+{
+	switch(type)
+	{
+		case NSFetchedResultsChangeInsert:
+			[self.tableView insertSections:[NSIndexSet indexSetWithIndex:sectionIndex] withRowAnimation:UITableViewRowAnimationAutomatic];
+			break;
+		case NSFetchedResultsChangeDelete:
+			[self.tableView deleteSections:[NSIndexSet indexSetWithIndex:sectionIndex] withRowAnimation:UITableViewRowAnimationAutomatic];
+			break;
+		default:
+			break;
+	}
+}
+
+-(void)controller:(NSFetchedResultsController *)controller didChangeObject:(id)anObject atIndexPath:(NSIndexPath *)indexPath forChangeType:(NSFetchedResultsChangeType)type newIndexPath:(NSIndexPath *)newIndexPath
+{
+	switch(type)
+	{
+		case NSFetchedResultsChangeInsert:
+			[self.tableView insertRowsAtIndexPaths:@[newIndexPath] withRowAnimation:UITableViewRowAnimationAutomatic];
+			break;
+		case NSFetchedResultsChangeDelete:
+			[self.tableView deleteRowsAtIndexPaths:@[indexPath] withRowAnimation:UITableViewRowAnimationAutomatic];
+			break;
+		case NSFetchedResultsChangeUpdate:
+			[self.tableView reloadRowsAtIndexPaths:@[indexPath] withRowAnimation:UITableViewRowAnimationNone];
+			break;
+		case NSFetchedResultsChangeMove:
+			[self.tableView deleteRowsAtIndexPaths:@[indexPath] withRowAnimation:UITableViewRowAnimationAutomatic];
+			[self.tableView insertRowsAtIndexPaths:@[newIndexPath] withRowAnimation:UITableViewRowAnimationAutomatic];
+			break;
 	}
 }
 
+-(void)controllerDidChangeContent:(NSFetchedResultsController *)controller
+{
+	[self.tableView endUpdates];
+	
+	//Headers of sections that only lost or gained rows are not reloaded by the table
+	for(NSInteger section = 0; section < [self.tableView numberOfSections]; section++)
+	{
+		[self.tableView headerViewForSection:section].textLabel.text = [self stringForTitleInSection:section];
+	}
+	[self updateLifetimeFooter];
+}
+
 #pragma mark - Helper Methods
 
+//The section's dayKey is the day in the trips' own zone, so it is formatted as that calendar day at UTC midnight
 - (NSString *)stringOfDateForSection:(NSInteger)section
 {
-	return [dateFormatterDateAndNoTime stringFromDate:self.sortedDays[section]];
+	id<NSFetchedResultsSectionInfo> sectionInfo = [self.fetchedResultsController sections][section];
+	int32_t dayKey = (int32_t)sectionInfo.name.intValue;
+	NSDateComponents *components = [[NSDateComponents alloc] init];
+	components.year = dayKey / 10000;
+	components.month = dayKey / 100 % 100;
+	components.day = dayKey % 100;
+	return [dateFormatterDateAndNoTime stringFromDate:[dayKeyCalendar dateFromComponents:components]];
 }
 
 - (double)totalMilesInSection:(NSInteger)section
 {
-	double mileSum = 0;
-	NSArray *tripsInDate = self.tripsByDate[self.sortedDays[section]];
-	for(Trip *trip in tripsInDate)
+	id<NSFetchedResultsSectionInfo> sectionInfo = [self.fetchedResultsController sections][section];
+	id rollup = self.rollupsBySection[sectionInfo.name];
+	if(!rollup)
 	{
-		mileSum += trip.totalMiles.doubleValue;
+		rollup = [TripRollup rollupForPeriod:TripRollupPeriodDay key:(int32_t)sectionInfo.name.intValue inContext:[appDelegate managedObjectContext]];
+		self.rollupsBySection[sectionInfo.name] = rollup ? rollup : [NSNull null];
 	}
-	return mileSum;
+	if(rollup != [NSNull null])
+		return [rollup totalMiles].doubleValue;
+	
+	//Rollups of trips from before model version 12 are built in the background after launch
+	return [[sectionInfo.objects valueForKeyPath:@"@sum.totalMiles"] doubleValue];
+}
+
+-(void)updateLifetimeFooter
+{
+	TripRollup *lifetime = [TripRollup rollupForPeriod:TripRollupPeriodLifetime key:0 inContext:[appDelegate managedObjectContext]];
+	if(!lifetime)
+	{
+		self.tableView.tableFooterView = nil;
+		return;
+	}
+	
+	UILabel *footer = (UILabel *)self.tableView.tableFooterView;
+	if(![footer isKindOfClass:[UILabel class]])
+	{
+		footer = [[UILabel alloc] initWithFrame:CGRectMake(0, 0, self.tableView.bounds.size.width, 44)];
+		footer.textAlignment = NSTextAlignmentCenter;
+		footer.textColor = [UIColor grayColor];
+		footer.font = [UIFont systemFontOfSize:[UIFont smallSystemFontSize]];
+		self.tableView.tableFooterView = footer;
+	}
+	footer.text = [NSString stringWithFormat:@"%d trips - %.2f mi - %.1f hrs - avg: %.2f mph",lifetime.tripCount.intValue,lifetime.totalMiles.doubleValue,lifetime.driveTime.doubleValue / 3600,[lifetime averageSpeed]];
 }
 
 -(NSString *)stringForTitleInSection:(NSInteger)section
@@ -202,30 +345,7 @@
 
 - (Trip *)tripFromIndexPath:(NSIndexPath *)indexPath
 {
-	NSDate *dateTitle = self.sortedDays[(NSUInteger) indexPath.section];
-	NSArray *tripsInDate = self.tripsByDate[dateTitle];
-	Trip* trip = tripsInDate[(NSUInteger) indexPath.row];
-	return trip;
-}
-
-- (NSDate *)dateAtBeginningOfDayForDate:(NSDate *)inputDate
-{
-	// Use the user's current calendar and time zone
-	NSCalendar *calendar = [NSCalendar currentCalendar];
-	NSTimeZone *timeZone = [NSTimeZone systemTimeZone];
-	[calendar setTimeZone:timeZone];
-	
-	// Selectively convert the date components (year, month, day) of the input date
-	NSDateComponents *dateComps = [calendar components:NSCalendarUnitYear | NSCalendarUnitMonth	| NSCalendarUnitDay fromDate:inputDate];
-	
-	// Set the time components manually
-	[dateComps setHour:0];
-	[dateComps setMinute:0];
-	[dateComps setSecond:0];
-	
-	// Convert back
-	NSDate *beginningOfDay = [calendar dateFromComponents:dateComps];
-	return beginningOfDay;
+	return [self.fetchedResultsController objectAtIndexPath:indexPath];
 }
 
 - (NSDate *)dateByAddingYears:(NSInteger)numberOfYears toDate:(NSDate *)inputDate
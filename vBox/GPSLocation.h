@@ -18,6 +18,8 @@
 @property (nonatomic, retain) NSNumber * speed;
 @property (nonatomic, retain) NSNumber * altitude;
 @property (nonatomic, retain) NSNumber * metersFromStart;
+//! Position of the fix in its trip, indexed together with tripInfo. 0 on rows migrated from before model version 14 until TripMigrator numbers them
+@property (nonatomic, retain) NSNumber * seq;
 @property (nonatomic, retain) NSDate * timestamp;
 @property (nonatomic, retain) Trip *tripInfo;
 @property (nonatomic, retain) BluetoothData *bluetoothInfo;
@@ -18,6 +18,7 @@
 @dynamic speed;
 @dynamic altitude;
 @dynamic metersFromStart;
+@dynamic seq;
 @dynamic timestamp;
 @dynamic tripInfo;
 @dynamic bluetoothInfo;
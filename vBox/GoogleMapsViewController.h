@@ -10,11 +10,7 @@
 #import <CoreLocation/CoreLocation.h>
 #import <GoogleMaps/GoogleMaps.h>
 #import "AppDelegate.h"
-#import "GPSLocation.h"
-#import "DrivingHistory.h"
-#import "Trip.h"
-#include "BluetoothData.h"
-#import "BLEManager.h"
+#import "TripRecorder.h"
 #import "WMGaugeView.h"
 
 @protocol GoogleMapsViewControllerDelegate <NSObject>
@@ -23,16 +19,13 @@
 
 @end
 
-@interface GoogleMapsViewController : UIViewController <CLLocationManagerDelegate, GMSMapViewDelegate, UICollectionViewDataSource, UICollectionViewDelegate, BLEManagerDelegate>
+@interface GoogleMapsViewController : UIViewController <GMSMapViewDelegate, UICollectionViewDataSource, UICollectionViewDelegate, TripRecorderDelegate>
 
-@property (strong,nonatomic) CLLocationManager *locationManager;
 @property (weak, nonatomic) IBOutlet GMSMapView *MapView;
 @property (weak, nonatomic) IBOutlet UIButton *stopRecordingButton;
 @property (weak, nonatomic) IBOutlet UILabel *speedOrDistanceLabel;
 @property (weak, nonatomic) id delegate;
-@property (strong, nonatomic) BLEManager *bluetoothManager;
 @property (weak, nonatomic) IBOutlet UICollectionView *collectionView;
-@property (strong, nonatomic) NSMutableDictionary *bluetoothDiagnostics;
 @property (weak, nonatomic) IBOutlet UIButton *bleButton;
 
 @end
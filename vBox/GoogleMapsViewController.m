@@ -10,6 +10,7 @@
 #import "SVProgressHUD.h"
 #import "MyStyleKit.h"
 #import "UtilityMethods.h"
+#import "MapCameraFollower.h"
 #import <Parse/Parse.h>
 
 @interface GoogleMapsViewController ()
@@ -22,16 +23,10 @@
 
 @implementation GoogleMapsViewController{
 	GMSCameraPosition *camera;
-	GMSMutablePath *completePath;
 	GMSPolyline* polyline;
-	CLLocation *prevLocation;
-	BOOL followMe;
-	AppDelegate *appDelegate;
-	NSManagedObjectContext *context;
-	Trip *currentTrip;
-	double sumSpeed;
-	double maxSpeed;
-	double minSpeed;
+	MapCameraFollower *cameraFollower;
+	BOOL hasCenteredOnFirstFix;
+	TripRecorder *recorder;
 	NSArray *styles;
 	CGRect infoViewFrame;
 	CGRect mapViewFrame;
@@ -45,35 +40,32 @@
 - (void)viewDidLoad {
 	[super viewDidLoad];
 	
-	appDelegate = [[UIApplication sharedApplication] delegate];
-	context = [appDelegate managedObjectContext];
-	
-	currentTrip = [NSEntityDescription insertNewObjectForEntityForName:@"Trip" inManagedObjectContext:context];
-	[currentTrip setStartTime:[NSDate date]];
-	
-	completePath = [GMSMutablePath path];
+	recorder = [TripRecorder sharedRecorder];
 	
 	styles = @[[GMSStrokeStyle solidColor:[UIColor colorWithRed:(CGFloat) 0.2666666667 green:(CGFloat) 0.4666666667 blue:0.6 alpha:1]],[GMSStrokeStyle solidColor:[UIColor colorWithRed:(CGFloat) 0.6666666667 green:0.8 blue:0.8 alpha:1]]];
 	
-	sumSpeed = 0;
-	maxSpeed = 0;
-	minSpeed = DBL_MAX;
-	followMe = YES;
+	hasCenteredOnFirstFix = NO;
 	showSpeed = YES;
-	bleOn = NO;
+	bleOn = recorder.bluetoothManager != nil;
 	
 	self.speedOrDistanceLabel.userInteractionEnabled = YES;
 	UITapGestureRecognizer *tapGesture = [[UITapGestureRecognizer alloc] initWithTarget:self action:@selector(speedLabelTapped)];
 	[self.speedOrDistanceLabel addGestureRecognizer:tapGesture];
 	
-	self.bluetoothDiagnostics = [NSMutableDictionary dictionary];
-	
-	[self setUpLocationManager];
-	
 	[self setUpGoogleMaps];
 	
 	[self setUpUIButtons];
-    
+	
+	[self subscribeToRecorder];
+	[recorder startRecording];
+	
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationDidEnterBackground:) name:UIApplicationDidEnterBackgroundNotification object:nil];
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationWillEnterForeground:) name:UIApplicationWillEnterForegroundNotification object:nil];
+}
+
+-(void)dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
 }
 
 -(void)viewDidLayoutSubviews
@@ -95,31 +87,14 @@
 
 -(void)viewWillDisappear:(BOOL)animated
 {
+	[self unsubscribeFromRecorder];
+	[cameraFollower stop];
+	cameraFollower = nil;
 	[_MapView clear];
 	_MapView = nil;
-	[_locationManager stopUpdatingLocation];
 	
-	[self cleanUpBluetoothManager];
+	[SVProgressHUD dismiss];
 	
-	//Delete If no locations were recorded
-	if(currentTrip.gpsLocations.count == 0)
-	{
-		[[appDelegate managedObjectContext] deleteObject:currentTrip];
-		[appDelegate saveContext];
-		return;
-	}
-	[currentTrip setEndTime:[NSDate date]];
-	unsigned long count = currentTrip.gpsLocations.count;
-	double avgSpeed = count > 0 ? sumSpeed / count : 0;
-    [currentTrip setAvgSpeed:@(avgSpeed)];
-    [currentTrip setMaxSpeed:@(maxSpeed)];
-    [currentTrip setMinSpeed:@(minSpeed)];
-    [currentTrip setTotalMiles:@(GMSGeometryLength(completePath) * 0.000621371)];
-	[[appDelegate drivingHistory] addTripsObject:currentTrip];
-	[appDelegate saveContext];
-    
-    [self reverseGeocodeAndTrackInBackground:prevLocation andAvgSpeed:avgSpeed];
-    
 //	[[UIApplication sharedApplication] setStatusBarStyle:UIStatusBarStyleLightContent];
 	[super viewWillDisappear:animated];
 }
@@ -129,29 +104,36 @@
     return UIStatusBarStyleDefault;
 }
 
-#pragma mark - SetUp Methods
+#pragma mark - Application State
 
--(void)setUpBluetoothManager
+//The recorder keeps running in the background; stop feeding the map so it costs nothing while hidden
+-(void)applicationDidEnterBackground:(NSNotification *)notification
 {
-	self.bluetoothManager = [[BLEManager alloc] init];
-	self.bluetoothManager.delegate = self;
+	[self unsubscribeFromRecorder];
 }
 
--(void)setUpLocationManager
+-(void)applicationWillEnterForeground:(NSNotification *)notification
 {
-	_locationManager = [[CLLocationManager alloc] init];
-	
-	[_locationManager setDelegate:self];
-	_locationManager.distanceFilter = kCLDistanceFilterNone; //Best Accuracy
-	_locationManager.desiredAccuracy = kCLLocationAccuracyBestForNavigation;
-	_locationManager.activityType = CLActivityTypeAutomotiveNavigation;
-	_locationManager.pausesLocationUpdatesAutomatically = YES;//help save battery life when user is stopped
-	
-	[_locationManager requestWhenInUseAuthorization];
-	[_locationManager requestAlwaysAuthorization];
-	[_locationManager startUpdatingLocation];
+	if(recorder.recording)
+		[self subscribeToRecorder];
 }
 
+-(void)subscribeToRecorder
+{
+	recorder.delegate = self;
+	[polyline setPath:recorder.path];
+	[self updateSpeedLabelWithLocation:recorder.lastLocation];
+	[self.collectionView reloadData];
+}
+
+-(void)unsubscribeFromRecorder
+{
+	if(recorder.delegate == self)
+		recorder.delegate = nil;
+}
+
+#pragma mark - SetUp Methods
+
 -(void)setUpGoogleMaps
 {
 	camera = [GMSCameraPosition cameraWithLatitude:39.490179
@@ -165,17 +147,20 @@
 	_MapView.settings.compassButton = YES;
 	[_MapView setDelegate:self];
 	
-	polyline = [GMSPolyline polylineWithPath:completePath];
+	polyline = [GMSPolyline polylineWithPath:recorder.path];
 	polyline.strokeColor = [UIColor grayColor];
 	polyline.strokeWidth = 5.0;
 	polyline.geodesic = YES;
 	polyline.map = self.MapView;
+	
+	cameraFollower = [[MapCameraFollower alloc] initWithMapView:self.MapView];
 }
 
 -(void)setUpUIButtons
 {
 	self.bleButton.layer.masksToBounds = YES;
 	self.bleButton.layer.cornerRadius = 5.0;
+	[self.bleButton setImage:[UIImage imageNamed:bleOn ? @"bleOn" : @"bleOff"] forState:UIControlStateNormal];
 	
 	self.stopRecordingButton.layer.masksToBounds = YES;
 	self.stopRecordingButton.layer.cornerRadius = 5.0;
@@ -192,13 +177,20 @@
 {
 	if(gesture)
 	{
-		followMe = NO;
+		cameraFollower.following = NO;
 	}
 }
 
 -(BOOL)didTapMyLocationButtonForMapView:(GMSMapView *)mapView
 {
-	followMe = YES;
+	//Hand the camera back to the follower, starting from where the vehicle is now
+	cameraFollower.following = YES;
+	CLLocation *lastLocation = recorder.lastLocation;
+	if(lastLocation)
+	{
+		[mapView moveCamera:[GMSCameraUpdate setTarget:lastLocation.coordinate]];
+		[cameraFollower updateWithLocation:lastLocation];
+	}
 	return NO;
 }
 
@@ -207,6 +199,8 @@
 
 - (IBAction)stopRecordingButtonTapped:(id)sender {
 	
+	[self unsubscribeFromRecorder];
+	[recorder stopRecording];
 	[self.navigationController popViewControllerAnimated:YES];
 	[self.delegate didTapStopRecordingButton];
 }
@@ -216,11 +210,13 @@
 	if(bleOn)
 	{
 		[sender setImage:[UIImage imageNamed:@"bleOn"] forState:UIControlStateNormal];
-		[self setUpBluetoothManager];
+		[recorder startBluetooth];
 	}else
 	{
 		[sender setImage:[UIImage imageNamed:@"bleOff"] forState:UIControlStateNormal];
-		[self cleanUpBluetoothManager];
+		[recorder stopBluetooth];
+		[self.collectionView reloadData];
+		[SVProgressHUD dismiss];
 	}
 	[self updateViewsBasedOnBLEButtonState:bleOn animate:YES];
 }
@@ -230,7 +226,7 @@
 -(void)speedLabelTapped
 {
 	showSpeed = !showSpeed;
-	[self updateSpeedLabelWithLocation:prevLocation];
+	[self updateSpeedLabelWithLocation:recorder.lastLocation];
 }
 
 -(void)updateSpeedLabelWithLocation:(CLLocation *)lastLocation
@@ -240,69 +236,32 @@
 		self.speedOrDistanceLabel.text = [NSString stringWithFormat:@" %.2f mph",lastLocation.speed * 2.23694];
 	}else
 	{
-		self.speedOrDistanceLabel.text = [NSString stringWithFormat:@" %.2f mi",GMSGeometryLength(completePath) * 0.000621371];
+		self.speedOrDistanceLabel.text = [NSString stringWithFormat:@" %.2f mi",recorder.distance * 0.000621371];
 	}
 }
 
-#pragma mark - CLLocation Delegate
+#pragma mark - TripRecorder Delegate
 
--(void)locationManager:(CLLocationManager *)manager didUpdateLocations:(NSArray *)locations
+-(void)tripRecorder:(TripRecorder *)tripRecorder didUpdateLocation:(CLLocation *)newestLocation
 {
-	CLLocation *newestLocation = locations.lastObject;
-	
-	if(followMe && !prevLocation && newestLocation.horizontalAccuracy < 70)
+	if(cameraFollower.following && !hasCenteredOnFirstFix && newestLocation.horizontalAccuracy < 70)
 	{
+		hasCenteredOnFirstFix = YES;
 		[self.MapView animateToLocation:newestLocation.coordinate];
 		if(self.MapView.camera.zoom < 10)
 			[self.MapView animateToZoom:15];
 	}
-	
-	for(CLLocation *location in locations)
+	else if(hasCenteredOnFirstFix)
 	{
-		if(location.horizontalAccuracy > 30)
-			return;
-		
-		double speedMPH = ([newestLocation speed] * 2.236936284);
-		speedMPH = speedMPH >= 0 ? speedMPH : 0;
-		
-		if(speedMPH < minSpeed)
-		{
-			minSpeed = speedMPH;
-		}
-		if(speedMPH > maxSpeed)
-		{
-			maxSpeed = speedMPH;
-		}
-		sumSpeed += speedMPH;
-		
-		[self updateSpeedLabelWithLocation:newestLocation];
-		[self logLocation:newestLocation persistent:YES];
-		
-		[completePath addCoordinate:newestLocation.coordinate];
-		[polyline setPath:completePath];
+		[cameraFollower updateWithLocation:newestLocation];
 	}
 	
+	[self updateSpeedLabelWithLocation:newestLocation];
+	[polyline setPath:tripRecorder.path];
+	
 	double tolerance = powf(10.0, (float) ((-0.301*self.MapView.camera.zoom)+9.0731)) / 2500.0;
 	NSArray *lengths = @[@(tolerance),@(tolerance*1.5)];
 	polyline.spans = GMSStyleSpans(polyline.path, styles, lengths, kGMSLengthGeodesic);
-	
-	prevLocation = newestLocation;
-	
-	if(followMe)
-	{
-		[_MapView animateToLocation:newestLocation.coordinate];
-	}
-}
-
-
--(void)locationManager:(CLLocationManager *)manager didFailWithError:(NSError *)error
-{
-	if([error domain] == kCLErrorDomain )
-	{
-		return; //sometimes I get this error // fix later?
-	}
-	UIAlertView *errorAlert = [[UIAlertView alloc]initWithTitle:[error localizedDescription] message:@"There was an error retrieving your location" delegate:nil cancelButtonTitle:@"OK" otherButtonTitles: nil];
-	[errorAlert show];
 }
 
 #pragma mark - UICollection Data Source Delegate
@@ -314,12 +273,12 @@
 
 - (NSInteger)collectionView:(UICollectionView *)collectionView numberOfItemsInSection:(NSInteger)section
 {
-	return self.bluetoothDiagnostics.count;
+	return recorder.bluetoothDiagnostics.count;
 }
 
 - (UICollectionViewCell *)collectionView:(UICollectionView *)collectionView cellForItemAtIndexPath:(NSIndexPath *)indexPath
 {
-	NSArray *keys = [[self.bluetoothDiagnostics allKeys] sortedArrayUsingSelector:@selector(compare:)];
+	NSArray *keys = [[recorder.bluetoothDiagnostics allKeys] sortedArrayUsingSelector:@selector(compare:)];
 	NSString *key = keys[(NSUInteger) indexPath.row];
 	
 	UICollectionViewCell *cell;
@@ -328,7 +287,7 @@
 	UILabel *keyLabel = (UILabel *)[cell viewWithTag:1];
 	UILabel *valLabel = (UILabel *)[cell viewWithTag:2];
 	keyLabel.text = key;
-	valLabel.text = [NSString stringWithFormat:@"%@", (NSNumber *) self.bluetoothDiagnostics[key]];
+	valLabel.text = [NSString stringWithFormat:@"%@", (NSNumber *) recorder.bluetoothDiagnostics[key]];
 	return cell;
 }
 
@@ -340,14 +299,6 @@
 	{
 		case BLEStateOn:
 			self.bluetoothRequiredLabel.hidden = YES;
-			if([[NSUserDefaults standardUserDefaults] boolForKey:@"connectToOBD"])
-			{
-				[self.bluetoothManager scanForPeripheralType:PeripheralTypeOBDAdapter];
-			}
-			else
-			{
-				[self.bluetoothManager scanForPeripheralType:PeripheralTypeBeagleBone];
-			}
 			break;
 		case BLEStateOff:
 			[SVProgressHUD showErrorWithStatus:@"Bluetooth Off"];
@@ -395,7 +346,6 @@
 
 -(void)didUpdateDiagnosticForKey:(NSString *)key withValue:(NSNumber *)value
 {
-	self.bluetoothDiagnostics[key] = value;
 	[self.collectionView reloadData];
 }
 
@@ -460,102 +410,12 @@
 	self.bleButton.enabled = YES;
 }
 
-#pragma mark - Core Data
-
--(void)logLocation:(CLLocation *)location persistent:(Boolean)persist
-{
-	double lat = location.coordinate.latitude;
-	double lng = location.coordinate.longitude;
-	double speedMPH = location.speed >= 0 ? location.speed * 2.236936284 : 0; //speed is given meters/sec
-	double altitude = location.altitude * 3.28084;
-	
-	if(persist)
-	{
-		GPSLocation *newLocation = [NSEntityDescription insertNewObjectForEntityForName:@"GPSLocation" inManagedObjectContext:context];
-        [newLocation setLatitude:@(lat)];
-        [newLocation setLongitude:@(lng)];
-        [newLocation setSpeed:@(speedMPH)];
-        [newLocation setMetersFromStart:@(GMSGeometryLength(completePath))];
-		[newLocation setTimestamp:location.timestamp];
-		[newLocation setTripInfo:currentTrip];
-        [newLocation setAltitude:@(altitude)];
-		
-		if(self.bluetoothManager.connected)
-		{
-			
-			BluetoothData *bleData = [NSEntityDescription insertNewObjectForEntityForName:@"BluetoothData" inManagedObjectContext:context];
-			NSNumber *bleSpeedMPH = self.bluetoothDiagnostics[@"Speed"]; //km/h
-			bleSpeedMPH = bleSpeedMPH ? @(bleSpeedMPH.doubleValue * 0.621371) : bleSpeedMPH;
-			[bleData setSpeed:bleSpeedMPH];
-            [bleData setAmbientTemp:self.bluetoothDiagnostics[@"Ambient Temp"]];
-            [bleData setBarometric:self.bluetoothDiagnostics[@"Barometric"]];
-            [bleData setRpm:self.bluetoothDiagnostics[@"RPM"]];
-            [bleData setIntakeTemp:self.bluetoothDiagnostics[@"Intake Temp"]];
-            [bleData setFuel:self.bluetoothDiagnostics[@"Fuel"]];
-            [bleData setEngineLoad:self.bluetoothDiagnostics[@"Engine Load"]];
-            [bleData setDistance:self.bluetoothDiagnostics[@"Distance"]];
-            [bleData setCoolantTemp:self.bluetoothDiagnostics[@"Coolant Temp"]];
-            [bleData setThrottle:self.bluetoothDiagnostics[@"Throttle"]];
-			//Set AccelX,Y,Z
-			[newLocation setBluetoothInfo:bleData];
-		}
-		[appDelegate saveContext];
-		//Check if Bluetooth is on, and populate DB with recent values
-	}
-}
-
-
-#pragma mark - Clean UP
-
--(void)cleanUpBluetoothManager
-{
-	
-	if(self.bluetoothManager.connected)
-	{
-		[self.bluetoothManager disconnect];
-	}
-	
-	[self.bluetoothManager stopScanning];
-	[self.bluetoothManager stopAdvertisingPeripheral];
-	self.bluetoothManager = nil;
-	
-	[SVProgressHUD dismiss];
-}
+#pragma mark - Memory Management
 
 - (void)didReceiveMemoryWarning {
 	[super didReceiveMemoryWarning];
 	// Dispose of any resources that can be recreated.
     [PFAnalytics trackEventInBackground:@"MemoryWarning" dimensions:@{@"ViewController":@"GoogleMapsVC"} block:nil];
 }
-                  
-#pragma mark - Helper Methods
-
--(void)reverseGeocodeAndTrackInBackground:(CLLocation *)location andAvgSpeed:(double)avgSpeed
-{
-    CLGeocoder *geoCoder = [[CLGeocoder alloc] init];
-    [geoCoder reverseGeocodeLocation:location completionHandler:^(NSArray *placemarks, NSError *error) {
-        if(error)
-        {
-            [PFAnalytics trackEventInBackground:@"ReverseGeoCodeError" dimensions:@{@"error":error.description} block:nil];
-        }
-        else
-        {
-            CLPlacemark *placemark = placemarks.lastObject;
-            NSMutableDictionary *dimensions = [[NSMutableDictionary alloc] init];
-            
-            dimensions[@"City"] = (NSString *) placemark.addressDictionary[@"City"];
-            dimensions[@"State"] = (NSString *) placemark.addressDictionary[@"State"];
-            dimensions[@"Country"] = (NSString *) placemark.addressDictionary[@"CountryCode"];
-            dimensions[@"Street"] = (NSString *) placemark.addressDictionary[@"Street"];
-            dimensions[@"StartTime"] = [UtilityMethods formattedStringFromDate:currentTrip.startTime];
-            dimensions[@"MaxSpeed"] = [NSString stringWithFormat:@"%@ mph",@(maxSpeed)];
-            dimensions[@"AvgSpeed"] = [NSString stringWithFormat:@"%@ mph",@(avgSpeed)];
-            dimensions[@"Miles"] = [NSString stringWithFormat:@"%@ mi", currentTrip.totalMiles];
-            
-            [PFAnalytics trackEventInBackground:@"TripEndDetail" dimensions:dimensions block:nil];
-        }
-    }];
-    
-}
 
 @end
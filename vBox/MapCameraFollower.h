@@ -0,0 +1,46 @@
+//
+//  MapCameraFollower.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/29/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreLocation/CoreLocation.h>
+#import <GoogleMaps/GoogleMaps.h>
+
+/**
+ Keeps the map centered on the vehicle without stacking camera animations. Fixes only set a
+ target; a display link then eases the camera toward where the vehicle should be by now
+ (dead reckoning from course and speed), at a capped frame rate, and skips moves too small
+ to see. The link pauses itself once the camera has caught up.
+ */
+@interface MapCameraFollower : NSObject
+
+@property (nonatomic, weak, readonly) GMSMapView *mapView;
+//! Setting NO leaves the camera where it is, e.g. when the user pans the map
+@property (nonatomic) BOOL following;
+//! Cap on camera moves per second (15)
+@property (nonatomic) NSInteger maximumFramesPerSecond;
+//! How far ahead of the last fix to aim, in seconds (1.0)
+@property (nonatomic) NSTimeInterval predictionInterval;
+//! Time for the camera to close ~63% of the distance to its target (0.35s)
+@property (nonatomic) NSTimeInterval smoothingTimeConstant;
+//! Moves shorter than this many points are skipped (2.0)
+@property (nonatomic) CGFloat minimumMovement;
+
+//! Frame statistics since the follower was started
+@property (nonatomic, readonly) NSUInteger tickCount;
+@property (nonatomic, readonly) NSUInteger cameraMoveCount;
+@property (nonatomic, readonly) NSUInteger skippedMoveCount;
+@property (nonatomic, readonly) CFTimeInterval averageTickDuration;
+@property (nonatomic, readonly) CFTimeInterval maximumTickDuration;
+
+-(instancetype)initWithMapView:(GMSMapView *)mapView;
+
+-(void)updateWithLocation:(CLLocation *)location;
+//! Invalidates the display link and reports frame statistics. Must be called before releasing the follower
+-(void)stop;
+
+@end
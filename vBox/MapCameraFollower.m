@@ -0,0 +1,131 @@
+//
+//  MapCameraFollower.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/29/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "MapCameraFollower.h"
+#import <QuartzCore/QuartzCore.h>
+#import "UtilityMethods.h"
+
+#define MAX_PREDICTION_SECONDS 3.0 //don't keep extrapolating if fixes stop coming
+#define MIN_PREDICTION_SPEED 1.0 //m/s, below this course is too noisy to extrapolate
+
+@implementation MapCameraFollower{
+	CADisplayLink *displayLink;
+	CLLocation *lastLocation;
+	CFTimeInterval lastLocationTime;
+	CFTimeInterval totalTickDuration;
+}
+
+-(instancetype)initWithMapView:(GMSMapView *)mapView
+{
+	self = [super init];
+	if(self)
+	{
+		_mapView = mapView;
+		_following = YES;
+		_predictionInterval = 1.0;
+		_smoothingTimeConstant = 0.35;
+		_minimumMovement = 2.0;
+
+		displayLink = [CADisplayLink displayLinkWithTarget:self selector:@selector(displayLinkDidFire:)];
+		displayLink.paused = YES;
+		[displayLink addToRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
+		self.maximumFramesPerSecond = 15;
+	}
+	return self;
+}
+
+-(void)setMaximumFramesPerSecond:(NSInteger)maximumFramesPerSecond
+{
+	_maximumFramesPerSecond = MAX(1, MIN(60, maximumFramesPerSecond));
+	displayLink.frameInterval = 60 / _maximumFramesPerSecond;
+}
+
+-(void)setFollowing:(BOOL)following
+{
+	_following = following;
+	displayLink.paused = !(following && lastLocation);
+}
+
+-(void)updateWithLocation:(CLLocation *)location
+{
+	lastLocation = location;
+	lastLocationTime = CACurrentMediaTime();
+	if(self.following)
+		displayLink.paused = NO;
+}
+
+-(void)stop
+{
+	[displayLink invalidate];
+	displayLink = nil;
+
+	if(self.tickCount > 0)
+	{
+		NSDictionary *dimensions = @{@"ticks":[NSString stringWithFormat:@"%lu",(unsigned long)self.tickCount],
+									 @"moves":[NSString stringWithFormat:@"%lu",(unsigned long)self.cameraMoveCount],
+									 @"skipped":[NSString stringWithFormat:@"%lu",(unsigned long)self.skippedMoveCount],
+									 @"maxTickMs":[NSString stringWithFormat:@"%.2f",self.maximumTickDuration * 1000.0]};
+		[UtilityMethods trackPerformanceEvent:@"CameraFollowTick" duration:self.averageTickDuration dimensions:dimensions];
+	}
+}
+
+-(CFTimeInterval)averageTickDuration
+{
+	return self.tickCount > 0 ? totalTickDuration / self.tickCount : 0;
+}
+
+#pragma mark - Display Link
+
+-(void)displayLinkDidFire:(CADisplayLink *)link
+{
+	GMSMapView *mapView = self.mapView;
+	if(!self.following || !lastLocation || !mapView)
+	{
+		link.paused = YES;
+		return;
+	}
+
+	CFTimeInterval tickStart = CACurrentMediaTime();
+
+	CLLocationCoordinate2D predicted = lastLocation.coordinate;
+	BOOL moving = lastLocation.speed >= MIN_PREDICTION_SPEED && lastLocation.course >= 0;
+	if(moving)
+	{
+		NSTimeInterval ahead = MIN(tickStart - lastLocationTime + self.predictionInterval, MAX_PREDICTION_SECONDS);
+		predicted = GMSGeometryOffset(lastLocation.coordinate, lastLocation.speed * ahead, lastLocation.course);
+	}
+
+	CLLocationCoordinate2D current = mapView.camera.target;
+	CFTimeInterval frameDuration = link.duration * link.frameInterval;
+	double fraction = 1.0 - exp(-frameDuration / self.smoothingTimeConstant);
+	CLLocationCoordinate2D next = GMSGeometryInterpolate(current, predicted, fraction);
+
+	GMSProjection *projection = mapView.projection;
+	CGPoint currentPoint = [projection pointForCoordinate:current];
+	CGPoint nextPoint = [projection pointForCoordinate:next];
+	CGFloat movement = hypot(nextPoint.x - currentPoint.x, nextPoint.y - currentPoint.y);
+
+	if(movement < self.minimumMovement)
+	{
+		_skippedMoveCount++;
+		if(!moving)
+			link.paused = YES; //caught up with a stationary vehicle, nothing left to do until the next fix
+	}
+	else
+	{
+		[mapView moveCamera:[GMSCameraUpdate setTarget:next]];
+		_cameraMoveCount++;
+	}
+
+	CFTimeInterval tickDuration = CACurrentMediaTime() - tickStart;
+	totalTickDuration += tickDuration;
+	_maximumTickDuration = MAX(_maximumTickDuration, tickDuration);
+	_tickCount++;
+}
+
+@end
@@ -0,0 +1,131 @@
+//
+//  RouteColoring.c
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/17/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#include "RouteColoring.h"
+#include <math.h>
+#include <string.h>
+
+#define CLASSIFY_BLOCK 256 //values per block, small enough for the block and its buckets to stay in L1
+#define QUANTILE_BINS 4096
+
+static inline int ClampBucketCount(int bucketCount)
+{
+	return bucketCount < 1 ? 1 : bucketCount > ROUTE_COLORING_MAX_BUCKETS ? ROUTE_COLORING_MAX_BUCKETS : bucketCount;
+}
+
+//Infinities are mapped to NAN, which fminf/fmaxf drop by returning the other operand, so one bad sample can't stretch the range
+static int FiniteRange(const float *values, size_t count, float *minValue, float *maxValue)
+{
+	float low = INFINITY, high = -INFINITY;
+	for(size_t i = 0; i < count; i++)
+	{
+		float value = isfinite(values[i]) ? values[i] : NAN;
+		low = fminf(low, value);
+		high = fmaxf(high, value);
+	}
+	*minValue = low;
+	*maxValue = high;
+	return low <= high;
+}
+
+//MARK: - Bounds
+
+size_t RouteColoringLinearBounds(const float *values, size_t count, int bucketCount, float *bounds)
+{
+	float low, high;
+	if(!FiniteRange(values, count, &low, &high))
+		return 0;
+	bucketCount = ClampBucketCount(bucketCount);
+	//In double, where high - low can't overflow
+	double range = (double)high - (double)low;
+	for(int i = 0; i < bucketCount - 1; i++)
+		bounds[i] = (float)(low + range * (i + 1) / bucketCount);
+	return (size_t)(bucketCount - 1);
+}
+
+size_t RouteColoringQuantileBounds(const float *values, size_t count, int bucketCount, float *bounds)
+{
+	float low, high;
+	if(!FiniteRange(values, count, &low, &high))
+		return 0;
+	bucketCount = ClampBucketCount(bucketCount);
+	if(low == high)
+	{
+		for(int i = 0; i < bucketCount - 1; i++)
+			bounds[i] = low;
+		return (size_t)(bucketCount - 1);
+	}
+
+	//A range so narrow the scale overflows, or so wide its width does, is split evenly instead
+	float scale = QUANTILE_BINS / (high - low);
+	if(!isfinite(scale) || scale <= 0)
+		return RouteColoringLinearBounds(values, count, bucketCount, bounds);
+
+	uint32_t histogram[QUANTILE_BINS];
+	memset(histogram, 0, sizeof(histogram));
+	size_t total = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		float value = values[i];
+		if(!isfinite(value))
+			continue;
+		int bin = (int)((value - low) * scale);
+		histogram[bin < QUANTILE_BINS ? bin : QUANTILE_BINS - 1]++;
+		total++;
+	}
+
+	//Upper edge of the bin where the running count reaches each quantile
+	size_t cumulative = 0;
+	int bin = 0;
+	for(int i = 0; i < bucketCount - 1; i++)
+	{
+		size_t target = total * (size_t)(i + 1) / (size_t)bucketCount;
+		while(bin < QUANTILE_BINS - 1 && cumulative + histogram[bin] < target)
+			cumulative += histogram[bin++];
+		bounds[i] = low + (float)(bin + 1) / scale;
+	}
+	return (size_t)(bucketCount - 1);
+}
+
+//MARK: - Classifying
+
+void RouteColoringClassify(const float *values, size_t count, const float *bounds, size_t boundCount, uint8_t *buckets)
+{
+	for(size_t start = 0; start < count; start += CLASSIFY_BLOCK)
+	{
+		size_t n = count - start < CLASSIFY_BLOCK ? count - start : CLASSIFY_BLOCK;
+		const float *v = values + start;
+		uint8_t *b = buckets + start;
+		memset(b, 0, n);
+		for(size_t j = 0; j < boundCount; j++)
+		{
+			float bound = bounds[j];
+			for(size_t i = 0; i < n; i++)
+				b[i] = (uint8_t)(b[i] + (v[i] > bound));
+		}
+		for(size_t i = 0; i < n; i++)
+			b[i] = v[i] == v[i] ? b[i] : ROUTE_COLORING_NO_VALUE;
+	}
+}
+
+size_t RouteColoringRuns(const uint8_t *buckets, size_t count, uint8_t *runBuckets, uint32_t *runLengths)
+{
+	size_t runCount = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		if(runCount > 0 && runBuckets[runCount-1] == buckets[i] && runLengths[runCount-1] < UINT32_MAX)
+		{
+			runLengths[runCount-1]++;
+			continue;
+		}
+		runBuckets[runCount] = buckets[i];
+		runLengths[runCount] = 1;
+		runCount++;
+	}
+	return runCount;
+}
@@ -0,0 +1,49 @@
+//
+//  RouteColoring.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/17/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#ifndef vBox_RouteColoring_h
+#define vBox_RouteColoring_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ Portable C99 classification of a per-fix float channel into color buckets, no Foundation needed.
+
+ Boundaries are the upper bounds of every bucket but the last, in ascending order: bucket b
+ holds the values v with bounds[b-1] < v <= bounds[b]. Linear bounds split [min, max] evenly;
+ quantile bounds put about the same number of fixes in each bucket, taken from a fixed size
+ histogram so they cost two passes and no sort. NAN and infinite values are skipped when bounds
+ are found; NAN is classified as ROUTE_COLORING_NO_VALUE and infinities fall in the end buckets.
+
+ Classify runs over blocks that stay in L1, one compare-and-add sweep per bound, which
+ compilers turn into SIMD compares. Runs collapses the buckets into (bucket, length) pairs.
+ */
+
+#define ROUTE_COLORING_MAX_BUCKETS 16
+#define ROUTE_COLORING_NO_VALUE 0xFF
+
+//! @return the number of bounds written (bucketCount - 1), 0 if values has no finite value
+size_t RouteColoringLinearBounds(const float *values, size_t count, int bucketCount, float *bounds);
+size_t RouteColoringQuantileBounds(const float *values, size_t count, int bucketCount, float *bounds);
+
+//! boundCount of 0 puts every finite value in bucket 0
+void RouteColoringClassify(const float *values, size_t count, const float *bounds, size_t boundCount, uint8_t *buckets);
+
+//! runBuckets and runLengths need room for count runs. @return the number of runs
+size_t RouteColoringRuns(const uint8_t *buckets, size_t count, uint8_t *runBuckets, uint32_t *runLengths);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
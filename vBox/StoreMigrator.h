@@ -0,0 +1,43 @@
+//
+//  StoreMigrator.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/10/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+/**
+ Runs the migration of the SQLite store off the main thread, after which the app's own coordinator
+ opens it without any migration work. Every version migrates lightweight, in place, so no object is
+ loaded however many legacy rows the store holds.
+ */
+@interface StoreMigrator : NSObject
+
+@property (nonatomic, strong, readonly) NSURL *storeURL;
+@property (nonatomic, strong, readonly) NSManagedObjectModel *model;
+//! YES if the store exists and was saved with another model version
+@property (nonatomic, readonly) BOOL needsMigration;
+//! Name of the bundled model version the store was saved with (e.g. "GPSInformation 7"), nil if unknown
+@property (nonatomic, strong, readonly) NSString *sourceModelName;
+
+//! Options used for every addPersistentStore of the store
++(NSDictionary *)storeOptions;
+
+-(instancetype)initWithStoreURL:(NSURL *)storeURL model:(NSManagedObjectModel *)model;
+
+//! Migrates on a background queue. completion is called on the main queue
+-(void)migrateInBackgroundWithCompletion:(void (^)(BOOL success))completion;
+
+#if DEBUG
+/**
+ For every bundled model version except the current one: fills a temporary store with pointCount
+ synthetic GPSLocation rows, then times its migration to model. Results are logged and reported
+ as StoreMigrationBenchmark. Blocks the calling thread for a long time; run it off the main thread.
+ */
++(void)runBenchmarkWithPointCount:(NSUInteger)pointCount model:(NSManagedObjectModel *)model;
+#endif
+
+@end
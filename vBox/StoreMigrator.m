@@ -0,0 +1,226 @@
+//
+//  StoreMigrator.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/10/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "StoreMigrator.h"
+#import <QuartzCore/QuartzCore.h>
+#import "UtilityMethods.h"
+
+#define MODEL_DIRECTORY @"GPSInformation.momd"
+#define BENCHMARK_TRIP_LENGTH 3600 //an hour of 1Hz fixes, saved as one batch
+#define BENCHMARK_BLUETOOTH_INTERVAL 4 //one BluetoothData row every few fixes
+
+@implementation StoreMigrator
+
++(NSDictionary *)storeOptions
+{
+	return @{NSMigratePersistentStoresAutomaticallyOption:@YES, NSInferMappingModelAutomaticallyOption:@YES};
+}
+
++(NSArray *)bundledModelURLs
+{
+	return [[NSBundle mainBundle] URLsForResourcesWithExtension:@"mom" subdirectory:MODEL_DIRECTORY];
+}
+
+-(instancetype)initWithStoreURL:(NSURL *)storeURL model:(NSManagedObjectModel *)model
+{
+	self = [super init];
+	if(self)
+	{
+		_storeURL = storeURL;
+		_model = model;
+
+		NSDictionary *metadata = [NSPersistentStoreCoordinator metadataForPersistentStoreOfType:NSSQLiteStoreType URL:storeURL options:nil error:nil];
+		if(metadata && ![model isConfiguration:nil compatibleWithStoreMetadata:metadata])
+		{
+			_needsMigration = YES;
+			for(NSURL *modelURL in [StoreMigrator bundledModelURLs])
+			{
+				NSManagedObjectModel *bundledModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
+				if([bundledModel isConfiguration:nil compatibleWithStoreMetadata:metadata])
+				{
+					_sourceModelName = [[modelURL lastPathComponent] stringByDeletingPathExtension];
+					break;
+				}
+			}
+		}
+	}
+	return self;
+}
+
+-(void)migrateInBackgroundWithCompletion:(void (^)(BOOL success))completion
+{
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+		CFTimeInterval start = CACurrentMediaTime();
+		NSError *error = nil;
+		BOOL migrated = [StoreMigrator migrateStoreAtURL:self.storeURL toModel:self.model error:&error];
+		if(!migrated)
+			NSLog(@"Unresolved Error %@, %@",error,[error userInfo]);
+
+		NSDictionary *dimensions = @{@"from":self.sourceModelName ? self.sourceModelName : @"unknown",
+									 @"result":migrated ? @"migrated" : @"failed"};
+		[UtilityMethods trackPerformanceEvent:@"StoreMigration" duration:CACurrentMediaTime() - start dimensions:dimensions];
+
+		if(completion)
+		{
+			dispatch_async(dispatch_get_main_queue(), ^{
+				completion(migrated);
+			});
+		}
+	});
+}
+
+#pragma mark - Migrating
+
+//Lightweight: the store is migrated in place by SQL, without loading any object
++(BOOL)migrateStoreAtURL:(NSURL *)url toModel:(NSManagedObjectModel *)model error:(NSError **)error
+{
+	NSPersistentStoreCoordinator *coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+	NSPersistentStore *store = [coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:url options:[self storeOptions] error:error];
+	if(store)
+		[coordinator removePersistentStore:store error:nil];
+	return store != nil;
+}
+
+#pragma mark - Benchmark
+
+#if DEBUG
+
++(void)runBenchmarkWithPointCount:(NSUInteger)pointCount model:(NSManagedObjectModel *)model
+{
+	NSURL *directory = [NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES];
+	for(NSURL *modelURL in [self bundledModelURLs])
+	{
+		NSManagedObjectModel *sourceModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
+		if([sourceModel.entityVersionHashesByName isEqualToDictionary:model.entityVersionHashesByName])
+			continue;
+
+		NSString *name = [[modelURL lastPathComponent] stringByDeletingPathExtension];
+		NSURL *url = [directory URLByAppendingPathComponent:[NSString stringWithFormat:@"MigrationBenchmark-%@.sqlite",[name stringByReplacingOccurrencesOfString:@" " withString:@"-"]]];
+		[self removeStoreAtURL:url];
+
+		BOOL filled = NO;
+		@autoreleasepool {
+			filled = [self fillStoreAtURL:url model:sourceModel pointCount:pointCount];
+		}
+		if(!filled)
+		{
+			[self removeStoreAtURL:url];
+			continue;
+		}
+
+		CFTimeInterval start = CACurrentMediaTime();
+		NSError *error = nil;
+		BOOL migrated = [self migrateStoreAtURL:url toModel:model error:&error];
+		CFTimeInterval duration = CACurrentMediaTime() - start;
+		if(!migrated)
+			NSLog(@"Unresolved Error %@, %@",error,[error userInfo]);
+
+		NSDictionary *dimensions = @{@"from":name,
+									 @"points":[NSString stringWithFormat:@"%lu",(unsigned long)pointCount],
+									 @"result":migrated ? @"migrated" : @"failed"};
+		[UtilityMethods trackPerformanceEvent:@"StoreMigrationBenchmark" duration:duration dimensions:dimensions];
+		[self removeStoreAtURL:url];
+	}
+}
+
+//Inserts trips of BENCHMARK_TRIP_LENGTH fixes using whatever entities and attributes sourceModel has
++(BOOL)fillStoreAtURL:(NSURL *)url model:(NSManagedObjectModel *)sourceModel pointCount:(NSUInteger)pointCount
+{
+	NSPersistentStoreCoordinator *coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:sourceModel];
+	NSError *error = nil;
+	if(![coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:url options:nil error:&error])
+	{
+		NSLog(@"Unresolved Error %@, %@",error,[error userInfo]);
+		return NO;
+	}
+
+	NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+	[context setPersistentStoreCoordinator:coordinator];
+	[context setUndoManager:nil];
+	BOOL hasBluetoothData = sourceModel.entitiesByName[@"BluetoothData"] != nil;
+	//Trips were attached to the root object up to model 9
+	BOOL hasDrivingHistory = [sourceModel.entitiesByName[@"Trip"] relationshipsByName][@"drivingHistory"] != nil;
+
+	__block BOOL saved = YES;
+	[context performBlockAndWait:^{
+		NSError *saveError = nil;
+		NSManagedObject *history = [NSEntityDescription insertNewObjectForEntityForName:@"DrivingHistory" inManagedObjectContext:context];
+		saved = [context save:&saveError];
+		NSManagedObjectID *historyID = history.objectID;
+
+		NSTimeInterval startTime = [NSDate timeIntervalSinceReferenceDate] - pointCount;
+		for(NSUInteger tripStart = 0; saved && tripStart < pointCount; tripStart += BENCHMARK_TRIP_LENGTH)
+		{
+			NSManagedObject *trip = [NSEntityDescription insertNewObjectForEntityForName:@"Trip" inManagedObjectContext:context];
+			[self fillAttributesOfObject:trip date:[NSDate dateWithTimeIntervalSinceReferenceDate:startTime + tripStart] value:tripStart];
+			if(hasDrivingHistory)
+				[trip setValue:[context objectWithID:historyID] forKey:@"drivingHistory"];
+
+			for(NSUInteger i = tripStart; i < MIN(tripStart + BENCHMARK_TRIP_LENGTH, pointCount); i++)
+			{
+				NSManagedObject *location = [NSEntityDescription insertNewObjectForEntityForName:@"GPSLocation" inManagedObjectContext:context];
+				[self fillAttributesOfObject:location date:[NSDate dateWithTimeIntervalSinceReferenceDate:startTime + i] value:i];
+				[location setValue:trip forKey:@"tripInfo"];
+				if(hasBluetoothData && i % BENCHMARK_BLUETOOTH_INTERVAL == 0)
+				{
+					NSManagedObject *bleData = [NSEntityDescription insertNewObjectForEntityForName:@"BluetoothData" inManagedObjectContext:context];
+					[self fillAttributesOfObject:bleData date:nil value:i];
+					[bleData setValue:location forKey:@"location"];
+				}
+			}
+			saved = [context save:&saveError];
+			[context reset];
+		}
+		if(!saved)
+			NSLog(@"Unresolved Error %@, %@",saveError,[saveError userInfo]);
+	}];
+
+	for(NSPersistentStore *store in coordinator.persistentStores)
+	{
+		[coordinator removePersistentStore:store error:nil];
+	}
+	return saved;
+}
+
++(void)fillAttributesOfObject:(NSManagedObject *)object date:(NSDate *)date value:(NSUInteger)value
+{
+	for(NSAttributeDescription *attribute in [object.entity.attributesByName allValues])
+	{
+		switch(attribute.attributeType)
+		{
+			case NSDoubleAttributeType:
+				[object setValue:@(30.0 + value * 1e-5) forKey:attribute.name];
+				break;
+			case NSInteger16AttributeType:
+			case NSInteger32AttributeType:
+			case NSInteger64AttributeType:
+				[object setValue:@(value % 100) forKey:attribute.name];
+				break;
+			case NSDateAttributeType:
+				[object setValue:date forKey:attribute.name];
+				break;
+			default:
+				break;
+		}
+	}
+}
+
++(void)removeStoreAtURL:(NSURL *)url
+{
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+	NSString *path = [url path];
+	NSString *supportDirectory = [[path stringByDeletingLastPathComponent] stringByAppendingPathComponent:[NSString stringWithFormat:@".%@_SUPPORT",[[path lastPathComponent] stringByDeletingPathExtension]]];
+	for(NSString *file in @[path, [path stringByAppendingString:@"-wal"], [path stringByAppendingString:@"-shm"], supportDirectory])
+	{
+		[fileManager removeItemAtPath:file error:nil];
+	}
+}
+
+#endif
+
+@end
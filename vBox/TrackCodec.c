@@ -0,0 +1,272 @@
+//
+//  TrackCodec.c
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/5/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#include "TrackCodec.h"
+#include <string.h>
+
+#define MAX_VARINT_SIZE 10
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_MATCH 255
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static inline uint64_t ZigZag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+//MARK: - Varints
+
+size_t TrackCodecWriteVarint(uint64_t value, uint8_t *out)
+{
+	size_t size = 0;
+	while(value >= 0x80)
+	{
+		out[size++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[size++] = (uint8_t)value;
+	return size;
+}
+
+size_t TrackCodecReadVarint(const uint8_t *in, size_t length, uint64_t *value)
+{
+	uint64_t result = 0;
+	for(size_t i = 0; i < length && i < MAX_VARINT_SIZE; i++)
+	{
+		result |= (uint64_t)(in[i] & 0x7F) << (7 * i);
+		if(!(in[i] & 0x80))
+		{
+			*value = result;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+//MARK: - Deltas
+
+size_t TrackCodecDeltaBound(size_t count)
+{
+	return count * MAX_VARINT_SIZE;
+}
+
+size_t TrackCodecEncodeDeltas(const int32_t *values, size_t count, int order, uint8_t *out)
+{
+	size_t size = 0;
+	int64_t previous = 0, previousDelta = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		int64_t delta = (int64_t)values[i] - previous;
+		int64_t residual = order == 2 ? delta - previousDelta : delta;
+		size += TrackCodecWriteVarint(ZigZag(residual), out + size);
+		previous = values[i];
+		previousDelta = delta;
+	}
+	return size;
+}
+
+size_t TrackCodecDecodeDeltas(const uint8_t *in, size_t length, int order, int32_t *values, size_t count)
+{
+	size_t offset = 0;
+	int64_t previous = 0, previousDelta = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		uint64_t encoded;
+		size_t read = TrackCodecReadVarint(in + offset, length - offset, &encoded);
+		if(!read)
+			return 0;
+		offset += read;
+
+		//Unsigned math so malformed input wraps instead of overflowing
+		int64_t delta = order == 2 ? (int64_t)((uint64_t)previousDelta + (uint64_t)UnZigZag(encoded)) : UnZigZag(encoded);
+		previous = (int32_t)(uint32_t)((uint64_t)previous + (uint64_t)delta);
+		previousDelta = delta;
+		values[i] = (int32_t)previous;
+	}
+	return offset;
+}
+
+//MARK: - Runs
+
+size_t TrackCodecRunBound(size_t count)
+{
+	return count * 2 * MAX_VARINT_SIZE;
+}
+
+size_t TrackCodecEncodeRuns(const int32_t *values, size_t count, uint8_t *out)
+{
+	size_t size = 0;
+	int64_t previous = 0;
+	size_t i = 0;
+	while(i < count)
+	{
+		size_t run = 1;
+		while(i + run < count && values[i + run] == values[i])
+			run++;
+		size += TrackCodecWriteVarint(run, out + size);
+		size += TrackCodecWriteVarint(ZigZag((int64_t)values[i] - previous), out + size);
+		previous = values[i];
+		i += run;
+	}
+	return size;
+}
+
+size_t TrackCodecDecodeRuns(const uint8_t *in, size_t length, int32_t *values, size_t count)
+{
+	size_t offset = 0;
+	int64_t previous = 0;
+	size_t i = 0;
+	while(i < count)
+	{
+		uint64_t run, encoded;
+		size_t read = TrackCodecReadVarint(in + offset, length - offset, &run);
+		if(!read || run == 0 || run > count - i)
+			return 0;
+		offset += read;
+		read = TrackCodecReadVarint(in + offset, length - offset, &encoded);
+		if(!read)
+			return 0;
+		offset += read;
+
+		previous = (int32_t)(uint32_t)((uint64_t)previous + (uint64_t)UnZigZag(encoded));
+		for(uint64_t j = 0; j < run; j++)
+			values[i++] = (int32_t)previous;
+	}
+	return offset;
+}
+
+//MARK: - Blocks
+
+size_t TrackCodecCompressBound(size_t length)
+{
+	//Worst case is one literal run; every match sequence saves at least as much as it costs
+	return length + 2 * MAX_VARINT_SIZE;
+}
+
+static inline uint32_t LZHash(const uint8_t *bytes)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline size_t VarintSize(uint64_t value)
+{
+	size_t size = 1;
+	while(value >= 0x80)
+	{
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+size_t TrackCodecCompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity)
+{
+	uint32_t table[1 << LZ_HASH_BITS]; //last position + 1 seen for each hash, 0 = empty
+	memset(table, 0, sizeof(table));
+
+	size_t size = 0, literalStart = 0, i = 0;
+	while(i + LZ_MIN_MATCH <= length)
+	{
+		uint32_t hash = LZHash(in + i);
+		size_t candidate = table[hash];
+		table[hash] = (uint32_t)(i + 1);
+		if(candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET || memcmp(in + candidate - 1, in + i, LZ_MIN_MATCH) != 0)
+		{
+			i++;
+			continue;
+		}
+
+		size_t matchStart = candidate - 1;
+		size_t matchLength = LZ_MIN_MATCH;
+		while(matchLength < LZ_MAX_MATCH && i + matchLength < length && in[matchStart + matchLength] == in[i + matchLength])
+			matchLength++;
+
+		//A short match far back can cost more than the literals it replaces
+		size_t offset = i - matchStart;
+		size_t literals = i - literalStart;
+		if(VarintSize(matchLength) + VarintSize(offset) + VarintSize(literals) > matchLength + VarintSize(literals + matchLength))
+		{
+			i++;
+			continue;
+		}
+
+		if(size + VarintSize(literals) + literals + VarintSize(matchLength) + VarintSize(offset) > capacity)
+			return 0;
+		size += TrackCodecWriteVarint(literals, out + size);
+		memcpy(out + size, in + literalStart, literals);
+		size += literals;
+		size += TrackCodecWriteVarint(matchLength, out + size);
+		size += TrackCodecWriteVarint(offset, out + size);
+
+		//Index a few positions inside the match so the next repeat is found
+		size_t end = i + matchLength;
+		for(size_t j = i + 1; j + LZ_MIN_MATCH <= length && j < end; j += 2)
+			table[LZHash(in + j)] = (uint32_t)(j + 1);
+		i = end;
+		literalStart = i;
+	}
+
+	size_t literals = length - literalStart;
+	if(size + VarintSize(literals) + literals + 1 > capacity)
+		return 0;
+	size += TrackCodecWriteVarint(literals, out + size);
+	memcpy(out + size, in + literalStart, literals);
+	size += literals;
+	out[size++] = 0; //no match, end of block
+	return size;
+}
+
+size_t TrackCodecDecompressBound(size_t length)
+{
+	//A sequence costs at least its literals plus three bytes, four once the match length needs a second
+	//varint byte, so no sequence yields more than 255 / 4 bytes per byte read
+	return length > SIZE_MAX / 64 ? SIZE_MAX : length * 64;
+}
+
+size_t TrackCodecDecompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity)
+{
+	size_t offset = 0, size = 0;
+	while(offset < length)
+	{
+		uint64_t literals, matchLength, matchOffset;
+		size_t read = TrackCodecReadVarint(in + offset, length - offset, &literals);
+		if(!read || literals > length - offset - read || literals > capacity - size)
+			return 0;
+		offset += read;
+		memcpy(out + size, in + offset, (size_t)literals);
+		offset += literals;
+		size += literals;
+
+		read = TrackCodecReadVarint(in + offset, length - offset, &matchLength);
+		if(!read)
+			return 0;
+		offset += read;
+		if(matchLength == 0)
+			return offset == length ? size : 0;
+
+		read = TrackCodecReadVarint(in + offset, length - offset, &matchOffset);
+		if(!read || matchOffset == 0 || matchOffset > size || matchLength > LZ_MAX_MATCH || matchLength > capacity - size)
+			return 0;
+		offset += read;
+
+		//Byte by byte: the match may overlap the bytes it is producing
+		const uint8_t *source = out + size - matchOffset;
+		for(uint64_t j = 0; j < matchLength; j++)
+			out[size + j] = source[j];
+		size += matchLength;
+	}
+	return 0;
+}
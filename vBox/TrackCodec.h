@@ -0,0 +1,63 @@
+//
+//  TrackCodec.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/5/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#ifndef vBox_TrackCodec_h
+#define vBox_TrackCodec_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ Portable C99 codecs for the columns of a TripTrack, no Foundation needed.
+
+ Deltas: each value minus its prediction (the previous value for order 1, previous value plus
+ previous delta for order 2), zigzag mapped and written as LEB128 varints. Order 2 suits
+ timestamps and coordinates sampled at a steady rate, where the second difference is ~0.
+
+ Runs: (run length, zigzag delta from the previous run's value) varint pairs, for OBD channels
+ such as fuel or coolant temperature that hold the same value for hundreds of fixes.
+
+ Blocks: a byte-oriented LZ77 (64KB window, 4 to 255 byte matches) made of
+ [literal count][literals][match length][match offset] varint sequences, the last sequence
+ having no match. Capping the match length caps how far a block can expand, so the raw length
+ a stored block claims can be checked before anything is allocated for it.
+
+ Encoders write at most the matching Bound() bytes and return the number of bytes written.
+ Decoders return the number of bytes read (or written, for blocks) and 0 on truncated or
+ malformed input, so they are safe to run on data read back from disk.
+ */
+
+size_t TrackCodecDeltaBound(size_t count);
+size_t TrackCodecEncodeDeltas(const int32_t *values, size_t count, int order, uint8_t *out);
+size_t TrackCodecDecodeDeltas(const uint8_t *in, size_t length, int order, int32_t *values, size_t count);
+
+size_t TrackCodecRunBound(size_t count);
+size_t TrackCodecEncodeRuns(const int32_t *values, size_t count, uint8_t *out);
+size_t TrackCodecDecodeRuns(const uint8_t *in, size_t length, int32_t *values, size_t count);
+
+size_t TrackCodecCompressBound(size_t length);
+//! @return the compressed size, 0 if it would not fit in capacity
+size_t TrackCodecCompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+//! The most bytes a valid block of length bytes can decompress to
+size_t TrackCodecDecompressBound(size_t length);
+//! @return the decompressed size, 0 if in is malformed or does not fit in capacity
+size_t TrackCodecDecompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+
+//! Varint primitives, shared with the TripTrack container. Read returns 0 on truncated input
+size_t TrackCodecWriteVarint(uint64_t value, uint8_t *out);
+size_t TrackCodecReadVarint(const uint8_t *in, size_t length, uint64_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
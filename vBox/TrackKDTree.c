@@ -0,0 +1,232 @@
+//
+//  TrackKDTree.c
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/18/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#include "TrackKDTree.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define EARTH_RADIUS 6371009.0 //same sphere as GMSGeometryDistance
+#define KD_PI 3.14159265358979323846 //M_PI is not part of C99
+
+typedef struct {
+	double coordinates[2]; //x, y in meters
+	size_t index;
+} KDPoint;
+
+struct TrackKDTree {
+	size_t count;
+	KDPoint *points; //the median of every range [low, high) is the root of that range's subtree
+	double originLatitude;
+	double originLongitude;
+	double metersPerDegree;
+	double metersPerLongitude;
+};
+
+static inline void KDProject(const TrackKDTree *tree, double latitude, double longitude, double *coordinates)
+{
+	coordinates[0] = (longitude - tree->originLongitude) * tree->metersPerLongitude;
+	coordinates[1] = (latitude - tree->originLatitude) * tree->metersPerDegree;
+}
+
+static inline void KDSwap(KDPoint *points, size_t a, size_t b)
+{
+	KDPoint point = points[a];
+	points[a] = points[b];
+	points[b] = point;
+}
+
+//MARK: - Building
+
+//Quickselect: leaves the k-th smallest point on axis at k, no larger ones before it and no smaller ones after.
+//The three-way partition settles a run of equal keys in one pass; GPS tracks are full of them, from north-south
+//roads sharing a longitude to a parked car repeating one fix, and a two-way partition goes quadratic on those
+static void KDSelect(KDPoint *points, size_t low, size_t high, size_t k, int axis)
+{
+	while(high - low > 1)
+	{
+		//Median of three as pivot
+		double a = points[low].coordinates[axis], b = points[low + (high - low) / 2].coordinates[axis], c = points[high-1].coordinates[axis];
+		double pivot = a < b ? (b < c ? b : a < c ? c : a) : (a < c ? a : b < c ? c : b);
+
+		//[low, less) < pivot, [less, i) == pivot, [greater, high) > pivot
+		size_t less = low, i = low, greater = high;
+		while(i < greater)
+		{
+			double value = points[i].coordinates[axis];
+			if(value < pivot)
+				KDSwap(points, i++, less++);
+			else if(value > pivot)
+				KDSwap(points, i, --greater);
+			else
+				i++;
+		}
+
+		if(k < less)
+			high = less;
+		else if(k >= greater)
+			low = greater;
+		else
+			return;
+	}
+}
+
+static void KDBuild(KDPoint *points, size_t low, size_t high, int axis)
+{
+	while(high - low > 1)
+	{
+		size_t middle = low + (high - low) / 2;
+		KDSelect(points, low, high, middle, axis);
+		KDBuild(points, low, middle, !axis);
+		low = middle + 1;
+		axis = !axis;
+	}
+}
+
+TrackKDTree *TrackKDTreeCreate(const double *latitudes, const double *longitudes, size_t count)
+{
+	if(count == 0)
+		return NULL;
+	TrackKDTree *tree = malloc(sizeof(TrackKDTree));
+	KDPoint *points = malloc(count * sizeof(KDPoint));
+	if(!tree || !points)
+	{
+		free(tree);
+		free(points);
+		return NULL;
+	}
+
+	double minLatitude = latitudes[0], maxLatitude = latitudes[0];
+	for(size_t i = 1; i < count; i++)
+	{
+		minLatitude = fmin(minLatitude, latitudes[i]);
+		maxLatitude = fmax(maxLatitude, latitudes[i]);
+	}
+	tree->count = count;
+	tree->points = points;
+	tree->originLatitude = (minLatitude + maxLatitude) / 2;
+	tree->originLongitude = longitudes[0];
+	tree->metersPerDegree = EARTH_RADIUS * KD_PI / 180.0;
+	tree->metersPerLongitude = tree->metersPerDegree * cos(tree->originLatitude * KD_PI / 180.0);
+
+	for(size_t i = 0; i < count; i++)
+	{
+		KDProject(tree, latitudes[i], longitudes[i], points[i].coordinates);
+		points[i].index = i;
+	}
+	KDBuild(points, 0, count, 0);
+	return tree;
+}
+
+void TrackKDTreeFree(TrackKDTree *tree)
+{
+	if(!tree)
+		return;
+	free(tree->points);
+	free(tree);
+}
+
+//MARK: - Queries
+
+static inline double KDDistanceSquared(const double *a, const double *b)
+{
+	double dx = a[0] - b[0], dy = a[1] - b[1];
+	return dx * dx + dy * dy;
+}
+
+static void KDNearest(const KDPoint *points, size_t low, size_t high, int axis, const double *query, size_t *best, double *bestDistance)
+{
+	while(high > low)
+	{
+		size_t middle = low + (high - low) / 2;
+		const KDPoint *node = &points[middle];
+		double distance = KDDistanceSquared(node->coordinates, query);
+		if(distance < *bestDistance)
+		{
+			*bestDistance = distance;
+			*best = node->index;
+		}
+
+		//Descend into the near side first; the far side only if the splitting line is closer than the best so far
+		double offset = query[axis] - node->coordinates[axis];
+		if(offset < 0)
+		{
+			KDNearest(points, low, middle, !axis, query, best, bestDistance);
+			if(offset * offset >= *bestDistance)
+				return;
+			low = middle + 1;
+		}
+		else
+		{
+			KDNearest(points, middle + 1, high, !axis, query, best, bestDistance);
+			if(offset * offset >= *bestDistance)
+				return;
+			high = middle;
+		}
+		axis = !axis;
+	}
+}
+
+size_t TrackKDTreeNearest(const TrackKDTree *tree, double latitude, double longitude, double *distanceMeters)
+{
+	double query[2];
+	KDProject(tree, latitude, longitude, query);
+	size_t best = 0;
+	double bestDistance = INFINITY;
+	KDNearest(tree->points, 0, tree->count, 0, query, &best, &bestDistance);
+	if(distanceMeters)
+		*distanceMeters = sqrt(bestDistance);
+	return best;
+}
+
+static void KDWithinRadius(const KDPoint *points, size_t low, size_t high, int axis, const double *query, double radiusSquared, size_t *indexes, size_t capacity, size_t *found)
+{
+	while(high > low)
+	{
+		size_t middle = low + (high - low) / 2;
+		const KDPoint *node = &points[middle];
+		if(KDDistanceSquared(node->coordinates, query) <= radiusSquared)
+		{
+			if(*found < capacity)
+				indexes[*found] = node->index;
+			(*found)++;
+		}
+
+		double offset = query[axis] - node->coordinates[axis];
+		if(offset * offset <= radiusSquared)
+		{
+			//The circle crosses the splitting line, both sides can hold matches
+			KDWithinRadius(points, low, middle, !axis, query, radiusSquared, indexes, capacity, found);
+			low = middle + 1;
+		}
+		else if(offset < 0)
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle + 1;
+		}
+		axis = !axis;
+	}
+}
+
+static int KDCompareIndexes(const void *a, const void *b)
+{
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+size_t TrackKDTreeWithinRadius(const TrackKDTree *tree, double latitude, double longitude, double radiusMeters, size_t *indexes, size_t capacity)
+{
+	double query[2];
+	KDProject(tree, latitude, longitude, query);
+	size_t found = 0;
+	KDWithinRadius(tree->points, 0, tree->count, 0, query, radiusMeters * radiusMeters, indexes, capacity, &found);
+	qsort(indexes, found < capacity ? found : capacity, sizeof(size_t), KDCompareIndexes);
+	return found;
+}
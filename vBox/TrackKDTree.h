@@ -0,0 +1,48 @@
+//
+//  TrackKDTree.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/18/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#ifndef vBox_TrackKDTree_h
+#define vBox_TrackKDTree_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ Portable C99 2-d tree over the fixes of one trip, no Foundation needed.
+
+ Fixes are projected onto a local plane in meters (equirectangular around the middle latitude,
+ plenty for the extent of one trip) and stored as an implicit balanced tree: the median of every
+ range is its root, split alternately on x and y. Building takes O(n log n); nearest and radius
+ queries visit O(log n) nodes for well spread points. The tree keeps its own copy of the
+ projected points.
+ */
+
+typedef struct TrackKDTree TrackKDTree;
+
+//! @return NULL if count is 0 or memory runs out
+TrackKDTree *TrackKDTreeCreate(const double *latitudes, const double *longitudes, size_t count);
+void TrackKDTreeFree(TrackKDTree *tree);
+
+//! @return the index of the closest fix. distanceMeters may be NULL
+size_t TrackKDTreeNearest(const TrackKDTree *tree, double latitude, double longitude, double *distanceMeters);
+
+/**
+ Finds the fixes within radiusMeters and writes the indexes of the first capacity found, sorted.
+ @return the number of fixes in the radius, which may be more than capacity
+ */
+size_t TrackKDTreeWithinRadius(const TrackKDTree *tree, double latitude, double longitude, double radiusMeters, size_t *indexes, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,31 +9,72 @@
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
 
-@class DrivingHistory, GPSLocation;
+@class GPSLocation, TripCell, TripSpans, TripTrack;
 
 @interface Trip : NSManagedObject
 
 @property (nonatomic, retain) NSDate * endTime;
 @property (nonatomic, retain) NSDate * startTime;
+//! Day the trip started as yyyymmdd in timeZoneName, indexed for sectioning the history
+@property (nonatomic, retain) NSNumber * dayKey;
+//! Name of the time zone the trip was recorded in. nil for trips the backfill has not reached
+@property (nonatomic, retain) NSString * timeZoneName;
 @property (nonatomic, retain) NSNumber * avgSpeed;
 @property (nonatomic, retain) NSNumber * maxSpeed;
 @property (nonatomic, retain) NSNumber * minSpeed;
 @property (nonatomic, retain) NSNumber * totalMiles;
 @property (nonatomic, retain) NSString * tripName;
-@property (nonatomic, retain) DrivingHistory *drivingHistory;
-@property (nonatomic, retain) NSOrderedSet *gpsLocations;
+//! Packed TripTrack blob. nil for trips recorded before model version 8 that are not migrated yet
+@property (nonatomic, retain) NSData * trackData;
+@property (nonatomic, retain) NSNumber * pointCount;
+//! % of the tank, see -[TripTrack fuelUsed]
+@property (nonatomic, retain) NSNumber * fuelUsed;
+//! TripRetentionTier the track has been reduced to. Summary fields always describe the full recording
+@property (nonatomic, retain) NSNumber * retentionTier;
+//! Packed TripSpans of the speed colored route. nil until computed
+@property (nonatomic, retain) NSData * spanData;
+//! Legacy rows, unordered; GPSLocation.seq gives their order once TripMigrator has numbered them
+@property (nonatomic, retain) NSSet *gpsLocations;
+//! Spatial index entries for the track. Empty until the trip is packed and indexed
+@property (nonatomic, retain) NSSet *cells;
+
+/**
+ Decodes trackData, or builds the track from the legacy gpsLocations rows if the trip has not
+ been packed yet. Load time is reported by source. Must be called on the context's queue.
+ */
+-(TripTrack *)track;
+
+//! Decodes spanData. nil if it is missing or was written under another bucket scheme
+-(TripSpans *)spans;
+//! Recomputes spanData from track
+-(void)updateSpansWithTrack:(TripTrack *)track;
+
+/**
+ Legacy gpsLocations in recording order, with their BluetoothData prefetched. Sorted by timestamp
+ rather than seq, so it is right for trips whose rows TripMigrator has not numbered yet.
+ */
+-(NSArray *)orderedGPSLocations;
+//! Sort descriptors putting GPSLocation rows in the order they were recorded, by timestamp
++(NSArray *)gpsLocationRecordingOrder;
+//! The legacy rows with seq in range, sorted by seq. Only that window is fetched, through the (tripInfo, seq) index
+-(NSArray *)gpsLocationsInRange:(NSRange)range;
+
+//! The zone the trip was recorded in, or the system zone if it is unknown
+-(NSTimeZone *)timeZone;
+
+//! yyyymmdd of date in timeZone
++(int32_t)dayKeyForDate:(NSDate *)date timeZone:(NSTimeZone *)timeZone;
+
 @end
 
 @interface Trip (CoreDataGeneratedAccessors)
 
-- (void)insertObject:(GPSLocation *)value inGpsLocationsAtIndex:(NSUInteger)idx;
-- (void)removeObjectFromGpsLocationsAtIndex:(NSUInteger)idx;
-- (void)insertGpsLocations:(NSArray *)value atIndexes:(NSIndexSet *)indexes;
-- (void)removeGpsLocationsAtIndexes:(NSIndexSet *)indexes;
-- (void)replaceObjectInGpsLocationsAtIndex:(NSUInteger)idx withObject:(GPSLocation *)value;
-- (void)replaceGpsLocationsAtIndexes:(NSIndexSet *)indexes withGpsLocations:(NSArray *)values;
 - (void)addGpsLocationsObject:(GPSLocation *)value;
 - (void)removeGpsLocationsObject:(GPSLocation *)value;
-- (void)addGpsLocations:(NSOrderedSet *)values;
-- (void)removeGpsLocations:(NSOrderedSet *)values;
+- (void)addGpsLocations:(NSSet *)values;
+- (void)removeGpsLocations:(NSSet *)values;
+- (void)addCellsObject:(TripCell *)value;
+- (void)removeCellsObject:(TripCell *)value;
+- (void)addCells:(NSSet *)values;
+- (void)removeCells:(NSSet *)values;
 @end
@@ -7,20 +7,121 @@
 //
 
 #import "Trip.h"
-#import "DrivingHistory.h"
 #import "GPSLocation.h"
+#import "TripTrack.h"
+#import "TripSpans.h"
+#import "UtilityMethods.h"
+#import <QuartzCore/QuartzCore.h>
 
 
 @implementation Trip
 
 @dynamic endTime;
 @dynamic startTime;
+@dynamic dayKey;
+@dynamic timeZoneName;
 @dynamic avgSpeed;
 @dynamic maxSpeed;
 @dynamic minSpeed;
 @dynamic totalMiles;
 @dynamic tripName;
-@dynamic drivingHistory;
+@dynamic trackData;
+@dynamic pointCount;
+@dynamic fuelUsed;
+@dynamic retentionTier;
+@dynamic spanData;
 @dynamic gpsLocations;
+@dynamic cells;
+
+-(TripTrack *)track
+{
+	CFTimeInterval start = CACurrentMediaTime();
+	TripTrack *track = nil;
+	NSString *source = nil;
+	if(self.trackData)
+	{
+		track = [TripTrack trackWithData:self.trackData];
+		source = @"packed";
+		if(!track)
+			NSLog(@"Trip track for %@ could not be decoded",self.startTime);
+	}
+	else
+	{
+		NSArray *locations = [self orderedGPSLocations];
+		track = [TripTrack trackWithGPSLocations:locations count:locations.count startTime:self.startTime];
+		source = @"rows";
+	}
+
+	NSDictionary *dimensions = @{@"source":source,@"points":[NSString stringWithFormat:@"%lu",(unsigned long)track.count]};
+	[UtilityMethods trackPerformanceEvent:@"TripTrackLoad" duration:CACurrentMediaTime() - start dimensions:dimensions];
+	return track;
+}
+
+-(TripSpans *)spans
+{
+	return self.spanData ? [TripSpans spansWithData:self.spanData] : nil;
+}
+
+-(void)updateSpansWithTrack:(TripTrack *)track
+{
+	[self setSpanData:[[TripSpans spansWithTrack:track] dataRepresentation]];
+}
+
+-(NSArray *)orderedGPSLocations
+{
+	return [self gpsLocationsMatching:[NSPredicate predicateWithFormat:@"tripInfo == %@",self] sortDescriptors:[Trip gpsLocationRecordingOrder]];
+}
+
+-(NSArray *)gpsLocationsInRange:(NSRange)range
+{
+	NSPredicate *predicate = [NSPredicate predicateWithFormat:@"tripInfo == %@ AND seq >= %lu AND seq < %lu",self,(unsigned long)range.location,(unsigned long)NSMaxRange(range)];
+	return [self gpsLocationsMatching:predicate sortDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"seq" ascending:YES]]];
+}
+
+//Legacy rows were appended as fixes came in; distance breaks ties between fixes with the same timestamp
++(NSArray *)gpsLocationRecordingOrder
+{
+	return @[[NSSortDescriptor sortDescriptorWithKey:@"timestamp" ascending:YES],[NSSortDescriptor sortDescriptorWithKey:@"metersFromStart" ascending:YES]];
+}
+
+-(NSArray *)gpsLocationsMatching:(NSPredicate *)predicate sortDescriptors:(NSArray *)sortDescriptors
+{
+	//An unsaved trip's rows are not in the store yet
+	if(self.objectID.isTemporaryID)
+		return [[[self.gpsLocations filteredSetUsingPredicate:predicate] allObjects] sortedArrayUsingDescriptors:sortDescriptors];
+
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"GPSLocation"];
+	[request setPredicate:predicate];
+	[request setSortDescriptors:sortDescriptors];
+	[request setRelationshipKeyPathsForPrefetching:@[@"bluetoothInfo"]];
+
+	NSError *error = nil;
+	NSArray *locations = [self.managedObjectContext executeFetchRequest:request error:&error];
+	if(!locations)
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+	return locations;
+}
+
+-(NSTimeZone *)timeZone
+{
+	NSTimeZone *timeZone = self.timeZoneName ? [NSTimeZone timeZoneWithName:self.timeZoneName] : nil;
+	return timeZone ?: [NSTimeZone systemTimeZone];
+}
+
++(int32_t)dayKeyForDate:(NSDate *)date timeZone:(NSTimeZone *)timeZone
+{
+	//Calendars are expensive to create and this runs for every trip in the backfill
+	static NSCalendar *calendar = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		calendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSCalendarIdentifierGregorian];
+	});
+	@synchronized(calendar)
+	{
+		[calendar setTimeZone:timeZone];
+		NSDateComponents *components = [calendar components:NSCalendarUnitYear | NSCalendarUnitMonth | NSCalendarUnitDay fromDate:date];
+		return (int32_t)(components.year * 10000 + components.month * 100 + components.day);
+	}
+}
 
 @end
@@ -0,0 +1,24 @@
+//
+//  TripCell.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/11/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class Trip;
+
+//! A run of consecutive fixes of a trip inside one spatial index cell. See TripSpatialIndex
+@interface TripCell : NSManagedObject
+
+//! Interleaved (Morton) cell code, indexed
+@property (nonatomic, retain) NSNumber * cell;
+//! Indexes into the trip's track, inclusive
+@property (nonatomic, retain) NSNumber * firstIndex;
+@property (nonatomic, retain) NSNumber * lastIndex;
+@property (nonatomic, retain) Trip *trip;
+
+@end
@@ -0,0 +1,20 @@
+//
+//  TripCell.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/11/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripCell.h"
+#import "Trip.h"
+
+
+@implementation TripCell
+
+@dynamic cell;
+@dynamic firstIndex;
+@dynamic lastIndex;
+@dynamic trip;
+
+@end
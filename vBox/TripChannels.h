@@ -0,0 +1,51 @@
+//
+//  TripChannels.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/15/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Sparse OBD samples of one trip, one stream per diagnostic key as BLEManager reports it
+ ("RPM", "Engine Fuel Rate", ...). A sample is only kept when the value changes, stamped with
+ the time it was reported, and it holds until the next sample. NAN marks a value that was
+ lost, e.g. when the adapter disconnected.
+
+ dataRepresentation writes each stream as [name][sample count][times][values] with times in
+ milliseconds from the trip start and values at 0.01, both as first order TrackCodec deltas.
+ Keys are stored by name, so recording a new PID needs no model or format change.
+ */
+@interface TripChannels : NSObject
+
+//! Keys with at least one sample, sorted
+@property (nonatomic, readonly) NSArray *keys;
+//! Samples over all keys
+@property (nonatomic, readonly) NSUInteger sampleCount;
+
+//! Decodes a section written by dataRepresentationWithStartTime:. @return nil if data is malformed
++(instancetype)channelsWithData:(NSData *)data startTime:(NSTimeInterval)startTime;
+
+/**
+ Records value for key unless it is the value key already holds. Samples of a key must be
+ appended in time order; an earlier timestamp is moved up to the last sample's.
+ @param timestamp seconds since the reference date
+ */
+-(void)appendValue:(double)value forKey:(NSString *)key timestamp:(NSTimeInterval)timestamp;
+//! Every key loses its value at timestamp
+-(void)appendResetAtTimestamp:(NSTimeInterval)timestamp;
+
+//! The value key held at timestamp. NAN before its first sample or after a reset
+-(double)valueForKey:(NSString *)key atTimestamp:(NSTimeInterval)timestamp;
+//! YES if any key holds a value at timestamp
+-(BOOL)hasValuesAtTimestamp:(NSTimeInterval)timestamp;
+//! First and last values of key that are not NAN. NAN if it has none
+-(double)firstValueForKey:(NSString *)key;
+-(double)lastValueForKey:(NSString *)key;
+
+//! @param startTime seconds since the reference date that sample times are stored from
+-(NSData *)dataRepresentationWithStartTime:(NSTimeInterval)startTime;
+
+@end
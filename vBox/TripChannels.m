@@ -0,0 +1,279 @@
+//
+//  TripChannels.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/15/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripChannels.h"
+#import "TrackCodec.h"
+
+#define CHANNEL_MISSING_VALUE INT32_MIN
+#define CHANNEL_VALUE_SCALE 100.0
+#define CHANNEL_MAX_NAME_LENGTH 255
+
+static inline BOOL ChannelValuesEqual(double a, double b)
+{
+	return a == b || (isnan(a) && isnan(b));
+}
+
+//Samples of one key, times in seconds since the reference date
+@interface TripChannelStream : NSObject{
+@public
+	NSUInteger count;
+	NSUInteger capacity;
+	double *timestamps;
+	double *values;
+}
+
+@end
+
+@implementation TripChannelStream
+
+-(void)dealloc
+{
+	free(timestamps);
+	free(values);
+}
+
+-(void)appendValue:(double)value timestamp:(NSTimeInterval)timestamp
+{
+	if(count == capacity)
+	{
+		capacity = MAX(capacity * 2, (NSUInteger)16);
+		timestamps = realloc(timestamps, capacity * sizeof(double));
+		values = realloc(values, capacity * sizeof(double));
+	}
+	timestamps[count] = count > 0 ? MAX(timestamp, timestamps[count-1]) : timestamp;
+	values[count] = value;
+	count++;
+}
+
+//Index of the last sample at or before timestamp, NSNotFound if there is none
+-(NSUInteger)indexAtTimestamp:(NSTimeInterval)timestamp
+{
+	NSUInteger low = 0, high = count;
+	while(low < high)
+	{
+		NSUInteger middle = (low + high) / 2;
+		if(timestamps[middle] <= timestamp)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low > 0 ? low - 1 : NSNotFound;
+}
+
+@end
+
+@implementation TripChannels{
+	NSMutableDictionary *streams;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		streams = [NSMutableDictionary dictionary];
+	}
+	return self;
+}
+
+#pragma mark - Appending
+
+-(void)appendValue:(double)value forKey:(NSString *)key timestamp:(NSTimeInterval)timestamp
+{
+	TripChannelStream *stream = streams[key];
+	if(!stream)
+	{
+		if(isnan(value))
+			return;
+		stream = [[TripChannelStream alloc] init];
+		streams[key] = stream;
+	}
+	if(stream->count > 0 && ChannelValuesEqual(stream->values[stream->count-1], value))
+		return;
+	[stream appendValue:value timestamp:timestamp];
+}
+
+-(void)appendResetAtTimestamp:(NSTimeInterval)timestamp
+{
+	for(NSString *key in streams)
+	{
+		[self appendValue:NAN forKey:key timestamp:timestamp];
+	}
+}
+
+#pragma mark - Lookup
+
+-(NSArray *)keys
+{
+	return [[streams allKeys] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+-(NSUInteger)sampleCount
+{
+	NSUInteger sampleCount = 0;
+	for(TripChannelStream *stream in [streams objectEnumerator])
+	{
+		sampleCount += stream->count;
+	}
+	return sampleCount;
+}
+
+-(double)valueForKey:(NSString *)key atTimestamp:(NSTimeInterval)timestamp
+{
+	TripChannelStream *stream = streams[key];
+	NSUInteger index = [stream indexAtTimestamp:timestamp];
+	return stream && index != NSNotFound ? stream->values[index] : NAN;
+}
+
+-(BOOL)hasValuesAtTimestamp:(NSTimeInterval)timestamp
+{
+	for(TripChannelStream *stream in [streams objectEnumerator])
+	{
+		NSUInteger index = [stream indexAtTimestamp:timestamp];
+		if(index != NSNotFound && !isnan(stream->values[index]))
+			return YES;
+	}
+	return NO;
+}
+
+-(double)firstValueForKey:(NSString *)key
+{
+	TripChannelStream *stream = streams[key];
+	for(NSUInteger i = 0; stream && i < stream->count; i++)
+	{
+		if(!isnan(stream->values[i]))
+			return stream->values[i];
+	}
+	return NAN;
+}
+
+-(double)lastValueForKey:(NSString *)key
+{
+	TripChannelStream *stream = streams[key];
+	for(NSUInteger i = stream ? stream->count : 0; i > 0; i--)
+	{
+		if(!isnan(stream->values[i-1]))
+			return stream->values[i-1];
+	}
+	return NAN;
+}
+
+#pragma mark - Encoding
+
+-(NSData *)dataRepresentationWithStartTime:(NSTimeInterval)startTime
+{
+	NSArray *keys = [self keys];
+	NSUInteger maxCount = 0;
+	for(TripChannelStream *stream in [streams objectEnumerator])
+	{
+		maxCount = MAX(maxCount, stream->count);
+	}
+
+	int64_t startMilliseconds = llround(startTime * 1000.0);
+	int32_t *times = malloc(MAX(maxCount, 1) * sizeof(int32_t));
+	int32_t *values = malloc(MAX(maxCount, 1) * sizeof(int32_t));
+	uint8_t *scratch = malloc(20 + CHANNEL_MAX_NAME_LENGTH + 2 * (10 + TrackCodecDeltaBound(maxCount)));
+	NSMutableData *data = [NSMutableData data];
+	size_t size = TrackCodecWriteVarint(keys.count, scratch);
+	[data appendBytes:scratch length:size];
+
+	for(NSString *key in keys)
+	{
+		TripChannelStream *stream = streams[key];
+		for(NSUInteger i = 0; i < stream->count; i++)
+		{
+			int64_t milliseconds = llround(stream->timestamps[i] * 1000.0) - startMilliseconds;
+			times[i] = (int32_t)MAX(MIN(milliseconds, (int64_t)INT32_MAX), (int64_t)INT32_MIN);
+			double value = round(stream->values[i] * CHANNEL_VALUE_SCALE);
+			values[i] = isnan(value) ? CHANNEL_MISSING_VALUE : (int32_t)MAX(MIN(value, (double)INT32_MAX), (double)(INT32_MIN + 1));
+		}
+
+		NSData *name = [key dataUsingEncoding:NSUTF8StringEncoding];
+		size_t nameLength = MIN(name.length, (NSUInteger)CHANNEL_MAX_NAME_LENGTH);
+		size = TrackCodecWriteVarint(nameLength, scratch);
+		memcpy(scratch + size, name.bytes, nameLength);
+		size += nameLength;
+		size += TrackCodecWriteVarint(stream->count, scratch + size);
+		int32_t *columns[2] = {times, values};
+		for(int column = 0; column < 2; column++)
+		{
+			uint8_t *deltas = scratch + size + 10;
+			size_t length = TrackCodecEncodeDeltas(columns[column], stream->count, 1, deltas);
+			size_t prefix = TrackCodecWriteVarint(length, scratch + size);
+			memmove(scratch + size + prefix, deltas, length);
+			size += prefix + length;
+		}
+		[data appendBytes:scratch length:size];
+	}
+	free(scratch);
+	free(times);
+	free(values);
+	return data;
+}
+
++(instancetype)channelsWithData:(NSData *)data startTime:(NSTimeInterval)startTime
+{
+	const uint8_t *bytes = data.bytes;
+	size_t length = data.length, offset = 0;
+	uint64_t keyCount;
+	size_t read = TrackCodecReadVarint(bytes, length, &keyCount);
+	if(!read)
+		return nil;
+	offset += read;
+
+	int64_t startMilliseconds = llround(startTime * 1000.0);
+	TripChannels *channels = [[self alloc] init];
+	int32_t *columns[2] = {NULL, NULL};
+	BOOL valid = keyCount <= length;
+	for(uint64_t k = 0; valid && k < keyCount; k++)
+	{
+		uint64_t nameLength, count;
+		read = TrackCodecReadVarint(bytes + offset, length - offset, &nameLength);
+		valid = read && nameLength <= length - offset - read;
+		if(!valid)
+			break;
+		offset += read;
+		NSString *key = [[NSString alloc] initWithBytes:bytes + offset length:(NSUInteger)nameLength encoding:NSUTF8StringEncoding];
+		offset += nameLength;
+		read = TrackCodecReadVarint(bytes + offset, length - offset, &count);
+		//Every sample takes at least one byte per column
+		valid = key && read && count <= length - offset - read;
+		if(!valid)
+			break;
+		offset += read;
+
+		for(int column = 0; valid && column < 2; column++)
+		{
+			columns[column] = realloc(columns[column], MAX((size_t)count, (size_t)1) * sizeof(int32_t));
+			uint64_t columnLength;
+			read = TrackCodecReadVarint(bytes + offset, length - offset, &columnLength);
+			valid = read && columnLength <= length - offset - read;
+			if(!valid)
+				break;
+			offset += read;
+			valid = TrackCodecDecodeDeltas(bytes + offset, (size_t)columnLength, 1, columns[column], (size_t)count) == columnLength;
+			offset += columnLength;
+		}
+		if(!valid)
+			break;
+
+		TripChannelStream *stream = [[TripChannelStream alloc] init];
+		for(uint64_t i = 0; i < count; i++)
+		{
+			int32_t value = columns[1][i];
+			[stream appendValue:value == CHANNEL_MISSING_VALUE ? NAN : value / CHANNEL_VALUE_SCALE timestamp:(startMilliseconds + columns[0][i]) / 1000.0];
+		}
+		if(count > 0)
+			channels->streams[key] = stream;
+	}
+	free(columns[0]);
+	free(columns[1]);
+	return valid && offset == length ? channels : nil;
+}
+
+@end
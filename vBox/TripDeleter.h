@@ -0,0 +1,30 @@
+//
+//  TripDeleter.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/8/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+/**
+ Deletes trips on TripRollup's update context. Once the save deleting the trips has succeeded, their
+ TripCell, GPSLocation and BluetoothData rows are removed with batch delete requests straight in
+ the store, so their objects are never faulted in, and the deleted IDs are merged into the main
+ context so the UI drops them. Trip's to-many relationships have no delete rule for this reason.
+ */
+@interface TripDeleter : NSObject
+
++(instancetype)sharedDeleter;
+
+/**
+ @param tripIDs NSManagedObjectIDs of the trips to delete
+ @param completion called on the main queue with the number of trips deleted, may be nil
+ */
+-(void)deleteTripsWithIDs:(NSArray *)tripIDs completion:(void (^)(NSUInteger deletedCount))completion;
+//! Removes the rows of trips whose deletion was interrupted after their save. Call at launch
+-(void)deleteOrphanedRowsInBackground;
+
+@end
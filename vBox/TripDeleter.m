@@ -0,0 +1,177 @@
+//
+//  TripDeleter.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/8/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripDeleter.h"
+#import <QuartzCore/QuartzCore.h>
+#import "AppDelegate.h"
+#import "UtilityMethods.h"
+#import "TripRollup.h"
+
+#define PENDING_TRIPS_KEY @"tripDeleterPendingTrips" //URIs of deleted trips whose rows may still be in the store
+
+@implementation TripDeleter{
+	AppDelegate *appDelegate;
+	NSManagedObjectContext *context;
+	NSManagedObjectContext *mainContext;
+	NSManagedObjectContext *writerContext;
+}
+
++(instancetype)sharedDeleter
+{
+	static TripDeleter *sharedDeleter = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedDeleter = [[self alloc] init];
+	});
+	return sharedDeleter;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		appDelegate = [[UIApplication sharedApplication] delegate];
+		context = [TripRollup updateContext]; //the trips and their rollups are saved together
+		mainContext = [appDelegate managedObjectContext];
+		writerContext = [appDelegate writerContext];
+	}
+	return self;
+}
+
+-(void)deleteTripsWithIDs:(NSArray *)tripIDs completion:(void (^)(NSUInteger deletedCount))completion
+{
+	[context performBlock:^{
+		CFTimeInterval start = CACurrentMediaTime();
+
+		//Trips go through the context so their external trackData files are cleaned up, in the same save as their rollups.
+		//Their relationships have no delete rule, so their rows are not faulted in to be deleted with them
+		NSMutableArray *trips = [NSMutableArray arrayWithCapacity:tripIDs.count];
+		for(NSManagedObjectID *tripID in tripIDs)
+		{
+			NSManagedObject *trip = [context existingObjectWithID:tripID error:nil];
+			if(trip)
+				[trips addObject:trip];
+		}
+		[TripRollup removeTrips:trips];
+		for(NSManagedObject *trip in trips)
+		{
+			[context deleteObject:trip];
+		}
+		NSUInteger deletedCount = trips.count;
+
+		//Remembered before the save, so rows left by a kill right after it are swept at next launch
+		[self addPendingTripIDs:tripIDs];
+		NSError *error = nil;
+		BOOL saved = [appDelegate saveBackgroundContext:context error:&error];
+		if(!saved)
+		{
+			NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+			[context rollback];
+			deletedCount = 0;
+		}
+		[context reset];
+
+		//Only once the trips are gone for good
+		NSUInteger rowCount = saved ? [self deleteRowsOfPendingTrips] : 0;
+
+		CFTimeInterval duration = CACurrentMediaTime() - start;
+		NSDictionary *dimensions = @{@"trips":[NSString stringWithFormat:@"%lu",(unsigned long)deletedCount],
+									 @"rows":[NSString stringWithFormat:@"%lu",(unsigned long)rowCount]};
+		[UtilityMethods trackPerformanceEvent:@"TripsDeleted" duration:duration dimensions:dimensions];
+
+		if(completion)
+		{
+			dispatch_async(dispatch_get_main_queue(), ^{
+				completion(deletedCount);
+			});
+		}
+	}];
+}
+
+-(void)deleteOrphanedRowsInBackground
+{
+	[context performBlock:^{
+		[self deleteRowsOfPendingTrips];
+	}];
+}
+
+#pragma mark - Orphaned Rows
+
+//Runs on the context queue
+-(void)addPendingTripIDs:(NSArray *)tripIDs
+{
+	NSMutableArray *pending = [[[NSUserDefaults standardUserDefaults] arrayForKey:PENDING_TRIPS_KEY] mutableCopy] ?: [NSMutableArray array];
+	for(NSManagedObjectID *tripID in tripIDs)
+	{
+		[pending addObject:tripID.URIRepresentation.absoluteString];
+	}
+	[[NSUserDefaults standardUserDefaults] setObject:pending forKey:PENDING_TRIPS_KEY];
+}
+
+/**
+ Runs on the context queue. Batch deletes the TripCell, BluetoothData and GPSLocation rows of the
+ pending trips that are gone from the store, and merges the deletes into the other contexts. Pending
+ trips that still exist, because their save failed, are forgotten with their rows untouched.
+ @return the number of rows deleted
+ */
+-(NSUInteger)deleteRowsOfPendingTrips
+{
+	NSArray *pending = [[NSUserDefaults standardUserDefaults] arrayForKey:PENDING_TRIPS_KEY];
+	if(pending.count == 0)
+		return 0;
+
+	NSMutableArray *tripIDs = [NSMutableArray arrayWithCapacity:pending.count];
+	for(NSString *URIString in pending)
+	{
+		NSManagedObjectID *tripID = [context.persistentStoreCoordinator managedObjectIDForURIRepresentation:[NSURL URLWithString:URIString]];
+		if(tripID && ![context existingObjectWithID:tripID error:nil])
+			[tripIDs addObject:tripID];
+	}
+	[context reset];
+
+	//BluetoothData is found through its GPSLocation, so it goes first
+	NSMutableArray *deletedRowIDs = [NSMutableArray array];
+	BOOL deletedRows = tripIDs.count == 0 ||
+					   ([self batchDeleteEntity:@"BluetoothData" predicate:[NSPredicate predicateWithFormat:@"location.tripInfo IN %@",tripIDs] deletedIDs:deletedRowIDs] &&
+						[self batchDeleteEntity:@"GPSLocation" predicate:[NSPredicate predicateWithFormat:@"tripInfo IN %@",tripIDs] deletedIDs:deletedRowIDs] &&
+						[self batchDeleteEntity:@"TripCell" predicate:[NSPredicate predicateWithFormat:@"trip IN %@",tripIDs] deletedIDs:deletedRowIDs]);
+	if(deletedRows)
+		[[NSUserDefaults standardUserDefaults] removeObjectForKey:PENDING_TRIPS_KEY];
+
+	//Batch deletes bypass the contexts, so they are merged by hand
+	if(deletedRowIDs.count > 0)
+	{
+		[NSManagedObjectContext mergeChangesFromRemoteContextSave:@{NSDeletedObjectsKey:deletedRowIDs} intoContexts:@[writerContext, mainContext]];
+	}
+	return deletedRowIDs.count;
+}
+
+//Runs on the context queue. Batch requests go to the store, so they run on the writer context that owns it
+-(BOOL)batchDeleteEntity:(NSString *)entityName predicate:(NSPredicate *)predicate deletedIDs:(NSMutableArray *)deletedIDs
+{
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:entityName];
+	[request setPredicate:predicate];
+	NSBatchDeleteRequest *deleteRequest = [[NSBatchDeleteRequest alloc] initWithFetchRequest:request];
+	[deleteRequest setResultType:NSBatchDeleteResultTypeObjectIDs];
+
+	__block NSError *error = nil;
+	__block NSBatchDeleteResult *result = nil;
+	[writerContext performBlockAndWait:^{
+		result = [writerContext executeRequest:deleteRequest error:&error];
+	}];
+	if(!result)
+	{
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+		return NO;
+	}
+	[deletedIDs addObjectsFromArray:result.result];
+	return YES;
+}
+
+@end
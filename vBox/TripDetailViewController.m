@@ -11,13 +11,36 @@
 #import "SVProgressHUD.h"
 #import "MyStyleKit.h"
 #import "UtilityMethods.h"
-
-@interface TripDetailViewController () <MFMailComposeViewControllerDelegate>
+#import "TripTrack.h"
+#import "TripSpans.h"
+#import "TrackKDTree.h"
+#import "TripPathPyramid.h"
+#import "TripPlayback.h"
+#import <QuartzCore/QuartzCore.h>
+
+#define METERS_PER_POINT_AT_ZOOM_0 156543.03392 //the equator spans 256 points at zoom 0
+#define TAP_MAX_NEARBY_POINTS 256 //nearby fixes held on the stack when counting passes of a tapped spot; more are read into a heap buffer
+#define SCRUB_FRAME_BUDGET (1.0 / 60.0)
+#define SCRUB_TEXT_LENGTH 24
+
+//What the slider shows for one fix, precomputed so a tick only copies values out
+typedef struct {
+	float speed; //GPS mph, for the label
+	float gaugeSpeed; //OBD speed on fixes with OBD values, 0 if it is missing there
+	float rpm;
+	float fuel;
+	float miles;
+	int32_t elapsedSeconds;
+	int32_t clockSeconds; //local time of day
+	BOOL hasBluetoothData;
+} ScrubSample;
+
+@interface TripDetailViewController () <MFMailComposeViewControllerDelegate, TripPlaybackDelegate>
 
 //@property (strong, nonatomic) GMSCameraPosition *camera;
-@property (strong, nonatomic) NSArray *speedDivisions;
-@property (strong, nonatomic) NSOrderedSet *GPSLocationsForTrip;
-@property (strong, nonatomic) GMSMutablePath *pathForTrip;
+@property (strong, nonatomic) TripTrack *track;
+@property (strong, nonatomic) TripSpans *spans;
+@property (strong, nonatomic) GMSPolyline *polylineForTrip;
 @property (strong, nonatomic) GMSMarker *markerForSlider;
 @property (strong, nonatomic) GMSMarker *markerForTap;
 @property (weak, nonatomic) IBOutlet UIButton *fullScreenButton;
@@ -29,20 +52,40 @@
 	GMSCoordinateBounds *cameraBounds;
 	BOOL followingMe;
 	BOOL showRealTime;
-	NSDateFormatter *dateFormatter;
+	NSManagedObjectContext *loadContext;
+	CFTimeInterval loadStartTime;
+	TripSpanMetric routeMetric;
+	TrackKDTree *pointTree; //fixes by position, for map taps
+	TripPathPyramid *pathPyramid;
+	NSUInteger shownLevel;
+	NSMutableArray *levelPaths; //GMSPath per pyramid level, NSNull until first shown
+	NSMutableArray *levelSpanStyles; //GMSStyleSpans per level for the current metric, NSNull until first shown
+	CADisplayLink *frameCounter; //counts frames while the camera moves
+	NSUInteger movingFrames;
+	CFTimeInterval moveStartTime;
+	ScrubSample *scrubSamples;
+	NSUInteger shownScrubIndex; //NSNotFound to redraw on the next tick
+	char shownTimeText[SCRUB_TEXT_LENGTH];
+	char shownSpeedText[SCRUB_TEXT_LENGTH];
+	char shownDistanceText[SCRUB_TEXT_LENGTH];
+	NSUInteger scrubTicks;
+	CFTimeInterval scrubTime;
+	CFTimeInterval slowestScrubTick;
+	NSUInteger slowScrubTicks;
+	TripPlayback *playback; //made on the first play
+	UIBarButtonItem *playButton;
 }
 
-@synthesize pathForTrip;
-@synthesize GPSLocationsForTrip;
-@synthesize speedDivisions;
+@synthesize track;
 
 #pragma mark - Initialization
 
 - (void)viewDidLoad {
     [super viewDidLoad];
     // Do any additional setup after loading the view.
+	loadStartTime = CACurrentMediaTime();
 	
-	self.pathColors = @[[UIColor redColor],[UIColor orangeColor],[UIColor yellowColor],[UIColor greenColor]];
+	self.pathColors = @[[UIColor redColor],[UIColor orangeColor],[UIColor yellowColor],[UIColor greenColor]]; //one per TripSpans bucket, slowest first
 	
 	[self.speedometerIcon setImage:[MyStyleKit imageOfSpeedometerWithStrokeColor:[UIColor whiteColor]]];
 	
@@ -55,31 +98,45 @@
 	self.followMeButton.layer.masksToBounds = YES;
 	self.followMeButton.layer.cornerRadius = 5.0;
 	
-	dateFormatter = [[NSDateFormatter alloc] init];
-	[dateFormatter setDateFormat:@"HH:mm:ss"];
 	showRealTime = NO;
 	UITapGestureRecognizer *tapRecognizer = [[UITapGestureRecognizer alloc] initWithTarget:self action:@selector(didTapTimeLabel)];
 	self.timeLabel.userInteractionEnabled = YES;
 	[self.timeLabel addGestureRecognizer:tapRecognizer];
 	
 	followingMe = NO;
+	routeMetric = TripSpanMetricSpeed;
+	UIBarButtonItem *colorButton = [[UIBarButtonItem alloc] initWithTitle:@"Color" style:UIBarButtonItemStylePlain target:self action:@selector(colorButtonTapped:)];
+	playButton = [[UIBarButtonItem alloc] initWithTitle:@"Play" style:UIBarButtonItemStylePlain target:self action:@selector(playButtonTapped:)];
+	self.navigationItem.rightBarButtonItems = [self.navigationItem.rightBarButtonItems arrayByAddingObjectsFromArray:@[colorButton, playButton]];
 	
-	self.GPSLocationsForTrip = self.trip.gpsLocations;
 	[self setUpGoogleMaps];
 	[self.speedGauge setUpWithUnits:@"MPH" max:150 startAngle:90 endAngle:270];
 	[self.fuelGauge setUpWithUnits:@"Fuel %" max:100 startAngle:90 endAngle:270];
 	[self.RPMGauge setUpWithUnits:@"RPM" max:10000 startAngle:90 endAngle:270];
-	[self.tripSlider setMaximumValue:self.GPSLocationsForTrip.count-1];
+	[self.tripSlider setEnabled:NO];
+	[self.tripSlider addTarget:self action:@selector(sliderDidBeginScrubbing:) forControlEvents:UIControlEventTouchDown];
+	[self.tripSlider addTarget:self action:@selector(sliderDidEndScrubbing:) forControlEvents:UIControlEventTouchUpInside|UIControlEventTouchUpOutside|UIControlEventTouchCancel];
+	shownScrubIndex = NSNotFound;
+	[self loadTrackInBackground];
 	[[UIDevice currentDevice] setValue:[NSNumber numberWithInteger:UIInterfaceOrientationPortrait] forKey:@"orientation"];
 }
 
 -(void)viewDidAppear:(BOOL)animated
 {
 	[super viewDidAppear:animated];
+	if(!cameraBounds)
+		return; //fitted once the track is loaded
 	GMSCameraUpdate *update = [GMSCameraUpdate fitBounds:cameraBounds withPadding:40];
 	[self.mapView animateWithCameraUpdate:update];
 }
 
+-(void)viewWillDisappear:(BOOL)animated
+{
+	[super viewWillDisappear:animated];
+	[self stopCountingFrames]; //the display link retains self
+	[self stopPlayback];
+}
+
 -(BOOL)shouldAutorotate
 {
 	return YES;
@@ -100,18 +157,125 @@
 - (void) setUpGoogleMaps
 {
 	[self.mapView setPadding:UIEdgeInsetsMake(10, 0, 0, 0)];
-	
-	pathForTrip = [GMSMutablePath path];
-	
-	NSMutableArray *spanStyles = [NSMutableArray array];
-	double segments = 1;
-	UIColor *color = nil;
-	UIColor *newColor = nil;
-	
-	GPSLocation *start = [GPSLocationsForTrip objectAtIndex:0];
-	GPSLocation *end = [GPSLocationsForTrip objectAtIndex:[GPSLocationsForTrip count]-1];
-	GMSMarker *startMarker = [GMSMarker markerWithPosition:CLLocationCoordinate2DMake(start.latitude.doubleValue, start.longitude.doubleValue)];
-	GMSMarker *endMarker =[GMSMarker markerWithPosition:CLLocationCoordinate2DMake(end.latitude.doubleValue, end.longitude.doubleValue)];
+	self.mapView.settings.compassButton = YES;
+	self.mapView.myLocationEnabled = NO;
+	[self.mapView setDelegate:self];
+}
+
+#pragma mark - Loading
+
+//Everything the slider shows at each fix. The clock uses the offset of the trip's own zone at its start
+static ScrubSample *ScrubSamplesCreate(TripTrack *track, NSTimeInterval startTime, NSTimeZone *timeZone)
+{
+	NSUInteger count = track.count;
+	if(count == 0)
+		return NULL;
+	ScrubSample *samples = calloc(count, sizeof(ScrubSample));
+	float *obdSpeeds = malloc(count * sizeof(float));
+	float *rpms = malloc(count * sizeof(float));
+	float *fuels = malloc(count * sizeof(float));
+	[track getValues:obdSpeeds forChannel:TripTrackChannelSpeed];
+	[track getValues:rpms forChannel:TripTrackChannelRPM];
+	[track getValues:fuels forChannel:TripTrackChannelFuel];
+	NSInteger secondsFromGMT = [timeZone secondsFromGMTForDate:[NSDate dateWithTimeIntervalSinceReferenceDate:startTime]];
+	for(NSUInteger i = 0; i < count; i++)
+	{
+		ScrubSample *sample = &samples[i];
+		double timestamp = track.timestamps[i];
+		sample->speed = track.speeds[i];
+		sample->miles = (float)(track.metersFromStart[i] * 0.000621371);
+		sample->elapsedSeconds = (int32_t)(timestamp - startTime);
+		//The reference date is midnight UTC, so the local time of day is the local seconds modulo a day
+		double localSeconds = floor(timestamp) + secondsFromGMT;
+		sample->clockSeconds = (int32_t)(localSeconds - floor(localSeconds / 86400.0) * 86400.0);
+		sample->hasBluetoothData = [track hasBluetoothDataAtIndex:i];
+		//Missing OBD values read as 0, like the nil NSNumbers of BluetoothData did
+		sample->gaugeSpeed = sample->hasBluetoothData ? (isnan(obdSpeeds[i]) ? 0 : obdSpeeds[i]) : sample->speed;
+		sample->rpm = isnan(rpms[i]) ? 0 : rpms[i];
+		sample->fuel = isnan(fuels[i]) ? 0 : fuels[i];
+	}
+	free(obdSpeeds);
+	free(rpms);
+	free(fuels);
+	return samples;
+}
+
+//Decodes the track on a background context so the screen can appear before a long trip is read
+-(void)loadTrackInBackground
+{
+	AppDelegate *appDelegate = [[UIApplication sharedApplication] delegate];
+	loadContext = [appDelegate newBackgroundContext];
+	NSManagedObjectID *tripID = self.trip.objectID;
+	NSManagedObjectContext *tripContext = loadContext;
+	[tripContext performBlock:^{
+		Trip *trip = (Trip *)[tripContext objectWithID:tripID];
+		TripTrack *loadedTrack = [trip track];
+		TripSpans *loadedSpans = [trip spans];
+		if(!loadedSpans && loadedTrack)
+		{
+			//Trips from before spans were stored, or from another bucket scheme
+			[trip updateSpansWithTrack:loadedTrack];
+			loadedSpans = [trip spans];
+			NSError *error = nil;
+			if(![appDelegate saveBackgroundContext:tripContext error:&error])
+				NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+		}
+		NSTimeInterval tripStartTime = [trip.startTime timeIntervalSinceReferenceDate];
+		NSTimeZone *tripTimeZone = [trip timeZone];
+		[tripContext reset];
+		ScrubSample *loadedScrubSamples = ScrubSamplesCreate(loadedTrack, tripStartTime, tripTimeZone);
+		CFTimeInterval pyramidStart = CACurrentMediaTime();
+		TripPathPyramid *loadedPyramid = loadedTrack.count ? [TripPathPyramid pyramidForTripID:tripID track:loadedTrack] : nil;
+		if(loadedPyramid)
+			[UtilityMethods trackPerformanceEvent:@"TripPathPyramid" duration:CACurrentMediaTime() - pyramidStart dimensions:@{@"points":[NSString stringWithFormat:@"%lu",(unsigned long)loadedTrack.count], @"levels":[NSString stringWithFormat:@"%lu",(unsigned long)loadedPyramid.levelCount]}];
+		CLLocationCoordinate2D southWest = {90, 180}, northEast = {-90, -180};
+		for(NSUInteger i = 0; i < loadedTrack.count; i++)
+		{
+			southWest.latitude = MIN(southWest.latitude, loadedTrack.latitudes[i]);
+			southWest.longitude = MIN(southWest.longitude, loadedTrack.longitudes[i]);
+			northEast.latitude = MAX(northEast.latitude, loadedTrack.latitudes[i]);
+			northEast.longitude = MAX(northEast.longitude, loadedTrack.longitudes[i]);
+		}
+		CFTimeInterval treeStart = CACurrentMediaTime();
+		TrackKDTree *loadedTree = TrackKDTreeCreate(loadedTrack.latitudes, loadedTrack.longitudes, loadedTrack.count);
+		if(loadedTree)
+			[UtilityMethods trackPerformanceEvent:@"TripPointTreeBuild" duration:CACurrentMediaTime() - treeStart dimensions:@{@"points":[NSString stringWithFormat:@"%lu",(unsigned long)loadedTrack.count]}];
+
+		dispatch_async(dispatch_get_main_queue(), ^{
+			if(loadedTrack.count == 0)
+			{
+				free(loadedScrubSamples);
+				return;
+			}
+			self.track = loadedTrack;
+			self.spans = loadedSpans;
+			TrackKDTreeFree(pointTree);
+			pointTree = loadedTree;
+			pathPyramid = loadedPyramid;
+			free(scrubSamples);
+			scrubSamples = loadedScrubSamples;
+			cameraBounds = [[GMSCoordinateBounds alloc] initWithCoordinate:southWest coordinate:northEast];
+			[self drawTrack];
+			[self reportDrawEvent:@"TripDetailFirstDraw" pointCount:[pathPyramid countAtLevel:shownLevel]];
+		});
+	}];
+}
+
+-(void)reportDrawEvent:(NSString *)event pointCount:(NSUInteger)pointCount
+{
+	NSUInteger trackCount = track.count;
+	NSString *size = trackCount <= 1000 ? @"<=1k" : trackCount <= 10000 ? @"<=10k" : trackCount <= 100000 ? @"<=100k" : @">100k";
+	NSDictionary *dimensions = @{@"trackPoints":size, @"drawnPoints":[NSString stringWithFormat:@"%lu",(unsigned long)pointCount]};
+	[UtilityMethods trackPerformanceEvent:event duration:CACurrentMediaTime() - loadStartTime dimensions:dimensions];
+}
+
+//Markers, camera and slider, plus the path at the level of detail of the camera
+-(void)drawTrack
+{
+	CLLocationCoordinate2D start = [track coordinateAtIndex:0];
+	CLLocationCoordinate2D end = [track coordinateAtIndex:track.count-1];
+	GMSMarker *startMarker = [GMSMarker markerWithPosition:start];
+	GMSMarker *endMarker =[GMSMarker markerWithPosition:end];
 	
 	[startMarker setGroundAnchor:CGPointMake(0.5, 0.5)];
 	[endMarker setGroundAnchor:CGPointMake(0.5, 0.5)];
@@ -122,51 +286,197 @@
 	[startMarker setIcon:[UIImage imageNamed:@"startPosition"]];
 	[endMarker setIcon:[UIImage imageNamed:@"endPosition"]];
 	
-	self.speedDivisions = [self calculateSpeedBoundaries];
+	GMSCameraPosition *camera = [self.mapView cameraForBounds:cameraBounds insets:UIEdgeInsetsZero];
+	self.mapView.camera = [GMSCameraPosition cameraWithLatitude:start.latitude longitude:start.longitude zoom:camera.zoom>5?camera.zoom-4:camera.zoom bearing:120 viewingAngle:25];
 	
-	for(GPSLocation *gpsLoc in GPSLocationsForTrip)
+	levelPaths = [NSMutableArray arrayWithCapacity:pathPyramid.levelCount];
+	levelSpanStyles = [NSMutableArray arrayWithCapacity:pathPyramid.levelCount];
+	for(NSUInteger level = 0; level < pathPyramid.levelCount; level++)
 	{
-		[pathForTrip addLatitude:[gpsLoc.latitude doubleValue] longitude:[gpsLoc.longitude doubleValue]];
-		
-		for(NSNumber *bound in self.speedDivisions)
-		{
-			if(gpsLoc.speed.doubleValue <= bound.doubleValue)
-			{
-				newColor = [self.pathColors objectAtIndex:[self.speedDivisions indexOfObject:bound]];
-				if([newColor isEqual:color])
-				{
-					segments++;
-				}else
-				{
-					[spanStyles addObject:[GMSStyleSpan spanWithColor:color?color:newColor segments:segments]];
-					segments = 1;
-				}
-				color = newColor;
-				
-				break;
-			}
-		}
+		[levelPaths addObject:[NSNull null]];
+		[levelSpanStyles addObject:[NSNull null]];
 	}
+	shownLevel = [self levelForCamera:self.mapView.camera];
+	self.polylineForTrip = [self polylineWithPath:[self pathAtLevel:shownLevel] spans:[self spanStylesAtLevel:shownLevel]];
+	if(self.view.window)
+		[self.mapView animateWithCameraUpdate:[GMSCameraUpdate fitBounds:cameraBounds withPadding:40]];
 	
-	GMSPolyline *polyline = [GMSPolyline polylineWithPath:pathForTrip];
+	[self.tripSlider setMaximumValue:track.count-1];
+	[self.tripSlider setEnabled:YES];
+}
+
+#pragma mark - Levels of Detail
+
+//The coarsest level that still looks exact: its simplification stays under one screen point
+-(NSUInteger)levelForCamera:(GMSCameraPosition *)camera
+{
+	double metersPerPoint = METERS_PER_POINT_AT_ZOOM_0 * cos(camera.target.latitude * M_PI / 180.0) / pow(2, camera.zoom);
+	return [pathPyramid levelForMetersPerPoint:metersPerPoint];
+}
+
+-(void)showLevel:(NSUInteger)level
+{
+	if(level == shownLevel || !self.polylineForTrip)
+		return;
+	shownLevel = level;
+	self.polylineForTrip.path = [self pathAtLevel:level];
+	self.polylineForTrip.spans = [self spanStylesAtLevel:level];
+}
+
+-(GMSPath *)pathAtLevel:(NSUInteger)level
+{
+	if(levelPaths[level] != [NSNull null])
+		return levelPaths[level];
+	const uint32_t *indexes = [pathPyramid indexesAtLevel:level];
+	NSUInteger count = [pathPyramid countAtLevel:level];
+	GMSMutablePath *path = [GMSMutablePath path];
+	for(NSUInteger i = 0; i < count; i++)
+	{
+		[path addLatitude:track.latitudes[indexes[i]] longitude:track.longitudes[indexes[i]]];
+	}
+	levelPaths[level] = path;
+	return path;
+}
+
+//The route spans carried over to the level's segments, so colors don't shift as levels swap
+-(NSArray *)spanStylesAtLevel:(NSUInteger)level
+{
+	if(!self.spans)
+		return nil;
+	if(levelSpanStyles[level] != [NSNull null])
+		return levelSpanStyles[level];
+	TripSpans *levelSpans = level == 0 ? self.spans : [self.spans spansForIndexes:[pathPyramid indexesAtLevel:level] count:[pathPyramid countAtLevel:level]];
+	NSArray *spanStyles = [self spanStylesForSpans:levelSpans];
+	levelSpanStyles[level] = spanStyles;
+	return spanStyles;
+}
+
+-(NSArray *)spanStylesForSpans:(TripSpans *)spans
+{
+	NSMutableArray *spanStyles = [NSMutableArray arrayWithCapacity:spans.count];
+	for(NSUInteger i = 0; i < spans.count; i++)
+	{
+		uint8_t bucket = spans.buckets[i];
+		UIColor *color = bucket < self.pathColors.count ? self.pathColors[bucket] : [UIColor lightGrayColor];
+		[spanStyles addObject:[GMSStyleSpan spanWithColor:color segments:spans.segmentCounts[i]]];
+	}
+	return spanStyles;
+}
+
+#pragma mark - Frame Rate
+
+-(void)startCountingFrames
+{
+	if(frameCounter)
+		return;
+	movingFrames = 0;
+	moveStartTime = CACurrentMediaTime();
+	frameCounter = [CADisplayLink displayLinkWithTarget:self selector:@selector(countFrame:)];
+	[frameCounter addToRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
+}
+
+-(void)countFrame:(CADisplayLink *)displayLink
+{
+	movingFrames++;
+}
+
+//Reports the frame rate of the pan or zoom that just ended along with the level it ended on
+-(void)stopCountingFrames
+{
+	if(!frameCounter)
+		return;
+	[frameCounter invalidate];
+	frameCounter = nil;
+	CFTimeInterval duration = CACurrentMediaTime() - moveStartTime;
+	if(duration <= 0 || !pathPyramid)
+		return;
+	NSUInteger trackCount = track.count;
+	NSString *size = trackCount <= 1000 ? @"<=1k" : trackCount <= 10000 ? @"<=10k" : trackCount <= 100000 ? @"<=100k" : @">100k";
+	NSDictionary *dimensions = @{@"fps":[NSString stringWithFormat:@"%.0f",movingFrames / duration], @"trackPoints":size, @"level":[NSString stringWithFormat:@"%lu",(unsigned long)shownLevel], @"drawnPoints":[NSString stringWithFormat:@"%lu",(unsigned long)[pathPyramid countAtLevel:shownLevel]]};
+	[UtilityMethods trackPerformanceEvent:@"MapInteraction" duration:duration dimensions:dimensions];
+}
+
+-(GMSPolyline *)polylineWithPath:(GMSPath *)path spans:(NSArray *)spans
+{
+	GMSPolyline *polyline = [GMSPolyline polylineWithPath:path];
 	polyline.strokeWidth = 5;
-	polyline.spans = spanStyles;
+	if(spans)
+		polyline.spans = spans;
+	else
+		polyline.strokeColor = [UIColor colorWithWhite:0.5 alpha:0.8];
 	polyline.geodesic = YES;
 	polyline.map = self.mapView;
+	return polyline;
+}
+
+#pragma mark - Route Coloring
+
+- (void)colorButtonTapped:(UIBarButtonItem *)sender
+{
+	if(!self.polylineForTrip)
+		return; //nothing drawn yet
 	
-	cameraBounds = [[GMSCoordinateBounds alloc] initWithPath:pathForTrip];
-	GMSCameraPosition *camera = [self.mapView cameraForBounds:cameraBounds insets:UIEdgeInsetsZero];
-	
-	self.mapView.camera = [GMSCameraPosition cameraWithLatitude:start.latitude.doubleValue longitude:start.longitude.doubleValue zoom:camera.zoom>5?camera.zoom-4:camera.zoom bearing:120 viewingAngle:25];
-	self.mapView.settings.compassButton = YES;
-	self.mapView.myLocationEnabled = NO;
-	[self.mapView setDelegate:self];
+	UIAlertController *sheet = [UIAlertController alertControllerWithTitle:@"Color route by" message:nil preferredStyle:UIAlertControllerStyleActionSheet];
+	for(TripSpanMetric metric = 0; metric < TripSpanMetricCount; metric++)
+	{
+		if([self metricNeedsBluetoothData:metric] && !track.hasBluetoothData)
+			continue;
+		NSString *title = metric == routeMetric ? [NSString stringWithFormat:@"%@ \u2713",[self nameForMetric:metric]] : [self nameForMetric:metric];
+		[sheet addAction:[UIAlertAction actionWithTitle:title style:UIAlertActionStyleDefault handler:^(UIAlertAction *action) {
+			[self colorRouteByMetric:metric];
+		}]];
+	}
+	[sheet addAction:[UIAlertAction actionWithTitle:@"Cancel" style:UIAlertActionStyleCancel handler:nil]];
+	sheet.popoverPresentationController.barButtonItem = sender;
+	[self presentViewController:sheet animated:YES completion:nil];
+}
+
+-(void)colorRouteByMetric:(TripSpanMetric)metric
+{
+	if(metric == routeMetric)
+		return;
+	CFTimeInterval start = CACurrentMediaTime();
+	routeMetric = metric;
+	//Speed keeps even buckets like the stored spans; the other metrics are too skewed for them
+	TripSpanBounds bounds = metric == TripSpanMetricSpeed ? TripSpanBoundsLinear : TripSpanBoundsQuantile;
+	self.spans = [TripSpans spansWithTrack:track metric:metric bounds:bounds bucketCount:self.pathColors.count];
+	for(NSUInteger level = 0; level < levelSpanStyles.count; level++)
+		levelSpanStyles[level] = [NSNull null];
+	self.polylineForTrip.spans = [self spanStylesAtLevel:shownLevel];
+	
+	NSDictionary *dimensions = @{@"metric":[self nameForMetric:metric], @"points":[NSString stringWithFormat:@"%lu",(unsigned long)track.count]};
+	[UtilityMethods trackPerformanceEvent:@"RouteRecolor" duration:CACurrentMediaTime() - start dimensions:dimensions];
+}
+
+-(NSString *)nameForMetric:(TripSpanMetric)metric
+{
+	switch(metric)
+	{
+		case TripSpanMetricSpeed: return @"Speed";
+		case TripSpanMetricRPM: return @"RPM";
+		case TripSpanMetricThrottle: return @"Throttle";
+		case TripSpanMetricEngineLoad: return @"Engine Load";
+		case TripSpanMetricGrade: return @"Grade";
+		case TripSpanMetricAcceleration: return @"Acceleration";
+		default: return nil;
+	}
+}
+
+-(BOOL)metricNeedsBluetoothData:(TripSpanMetric)metric
+{
+	return metric == TripSpanMetricRPM || metric == TripSpanMetricThrottle || metric == TripSpanMetricEngineLoad;
 }
 
 #pragma mark - Helper Methods
--(void)updateMarkerForSliderWithLocation:(GPSLocation *)location
+-(void)updateMarkerForSliderWithIndex:(NSUInteger)index
+{
+	[self moveMarkerForSliderToCoordinate:[track coordinateAtIndex:index]];
+	if(followingMe)
+		[self.mapView animateToLocation:self.markerForSlider.position];
+}
+
+-(void)moveMarkerForSliderToCoordinate:(CLLocationCoordinate2D)coordinate
 {
-	CLLocationCoordinate2D coordinate = CLLocationCoordinate2DMake(location.latitude.doubleValue, location.longitude.doubleValue);
 	if(!self.markerForSlider)
 	{
 		self.markerForSlider = [GMSMarker markerWithPosition:coordinate];
@@ -181,42 +491,57 @@
 		[self.markerForSlider setPosition:coordinate];
 		[CATransaction commit];
 	}
-	if(followingMe)
-		[self.mapView animateToLocation:coordinate];
 }
 
--(void)updateTapMarkerInMap:(GMSMapView *)myMapView withGPSLocation:(GPSLocation *)gpsLoc
+-(void)updateTapMarkerInMap:(GMSMapView *)myMapView withIndex:(NSUInteger)index passes:(NSUInteger)passes
 {
+	CLLocationCoordinate2D coordinate = [track coordinateAtIndex:index];
 	if(!self.markerForTap)
 	{
-		self.markerForTap = [GMSMarker markerWithPosition:CLLocationCoordinate2DMake(gpsLoc.latitude.doubleValue, gpsLoc.longitude.doubleValue)];
+		self.markerForTap = [GMSMarker markerWithPosition:coordinate];
 		[self.markerForTap setMap:myMapView];
 		[self.markerForTap setAppearAnimation:kGMSMarkerAnimationPop];
 	}
-	self.markerForTap.position = CLLocationCoordinate2DMake(gpsLoc.latitude.doubleValue, gpsLoc.longitude.doubleValue);
-	self.markerForTap.snippet = [NSString stringWithFormat:@"Time: %@\nSpeed: %.2f",gpsLoc.timestamp,gpsLoc.speed.doubleValue];
+	self.markerForTap.position = coordinate;
+	self.markerForTap.snippet = [NSString stringWithFormat:@"Time: %@\nSpeed: %.2f",[track dateAtIndex:index],track.speeds[index]];
+	if(passes > 1)
+		self.markerForTap.snippet = [self.markerForTap.snippet stringByAppendingFormat:@"\nPassed here %lu times",(unsigned long)passes];
 }
 
-/*
- // Find the points to divide the line by color
- var color_division = [];
- for (i = 0; i < colors.length - 1; i++) {
- color_division[i] = min + (i + 1) * (max - min) / colors.length;
- }
- color_division[color_division.length] = max;
- */
--(NSArray *)calculateSpeedBoundaries
+//YES if coordinate lies on one of the two segments that meet at index, for taps between widely spaced fixes
+-(BOOL)isCoordinate:(CLLocationCoordinate2D)coordinate onSegmentsAroundIndex:(NSUInteger)index tolerance:(double)tolerance
 {
-	double max = self.trip.maxSpeed.doubleValue;
-	double min = self.trip.minSpeed.doubleValue;
-	NSMutableArray *colorDivision = [NSMutableArray array];
-	for(int i = 0; i < self.pathColors.count-1; i++)
+	GMSMutablePath *segments = [GMSMutablePath path];
+	for(NSUInteger i = index > 0 ? index - 1 : 0; i <= index + 1 && i < track.count; i++)
 	{
-		double bound = (min + (i+1) * (max-min)) / self.pathColors.count;
-		[colorDivision addObject:[NSNumber numberWithDouble:bound]];
+		[segments addCoordinate:[track coordinateAtIndex:i]];
 	}
-	[colorDivision addObject:self.trip.maxSpeed];
-	return colorDivision;
+	return GMSGeometryIsLocationOnPathTolerance(coordinate, segments, NO, tolerance);
+}
+
+//Separate stretches of the trip within radius of coordinate, e.g. 2 for an out and back road
+-(NSUInteger)passCountNearCoordinate:(CLLocationCoordinate2D)coordinate radius:(double)radius
+{
+	size_t nearbyIndexes[TAP_MAX_NEARBY_POINTS];
+	size_t *indexes = nearbyIndexes;
+	size_t found = TrackKDTreeWithinRadius(pointTree, coordinate.latitude, coordinate.longitude, radius, indexes, TAP_MAX_NEARBY_POINTS);
+	//The buffer holds only the first hits in tree order, which can miss whole passes, so ask again for all of them
+	if(found > TAP_MAX_NEARBY_POINTS)
+	{
+		indexes = malloc(found * sizeof(size_t));
+		if(!indexes)
+			return 0;
+		found = TrackKDTreeWithinRadius(pointTree, coordinate.latitude, coordinate.longitude, radius, indexes, found);
+	}
+	NSUInteger passes = 0;
+	for(size_t i = 0; i < found; i++)
+	{
+		if(i == 0 || indexes[i] != indexes[i-1] + 1)
+			passes++;
+	}
+	if(indexes != nearbyIndexes)
+		free(indexes);
+	return passes;
 }
 
 /*
@@ -233,46 +558,170 @@
 
 - (IBAction)sliderValueChanged:(UISlider *)sender
 {
+	if(!scrubSamples)
+		return;
+	CFTimeInterval start = CACurrentMediaTime();
 	unsigned long value = lround(sender.value);
-	
-	GPSLocation *loc = [self.GPSLocationsForTrip objectAtIndex:value];
-	
-	
-	if(showRealTime)
-	{
-		self.timeLabel.text = [dateFormatter stringFromDate:loc.timestamp];
-	}
-	else
-	{
-        self.timeLabel.text = [UtilityMethods durationInStringOfTimeIntervalFrom:self.trip.startTime to:loc.timestamp];
-	}
-	
-	
-	self.speedLabel.text = [NSString stringWithFormat:@"%.2fmph",loc.speed.doubleValue];
-	self.distanceLabel.text = [NSString stringWithFormat:@"%.2fmi",(loc.metersFromStart.doubleValue * 0.000621371)];
-	
-	
-	//GPS Speed
-	[self.speedGauge setValue:loc.speed.floatValue animated:NO];
-	
-	if(loc.bluetoothInfo)
+	//Fine scrubbing sends many ticks per fix
+	if(value == shownScrubIndex)
+		return;
+	shownScrubIndex = value;
+	[self showScrubSample:&scrubSamples[value]];
+	[self updateMarkerForSliderWithIndex:value];
+	
+	CFTimeInterval duration = CACurrentMediaTime() - start;
+	scrubTicks++;
+	scrubTime += duration;
+	slowestScrubTick = MAX(slowestScrubTick, duration);
+	if(duration > SCRUB_FRAME_BUDGET)
+		slowScrubTicks++;
+}
+
+//Labels and gauges for a fix, or a point between two fixes during playback
+-(void)showScrubSample:(const ScrubSample *)sample
+{
+	char text[SCRUB_TEXT_LENGTH];
+	int32_t seconds = showRealTime ? sample->clockSeconds : sample->elapsedSeconds;
+	snprintf(text, sizeof(text), "%02d:%02d:%02d", seconds / 3600, (seconds / 60) % 60, seconds % 60);
+	[self setLabel:self.timeLabel text:text shownText:shownTimeText];
+	snprintf(text, sizeof(text), "%.2fmph", sample->speed);
+	[self setLabel:self.speedLabel text:text shownText:shownSpeedText];
+	snprintf(text, sizeof(text), "%.2fmi", sample->miles);
+	[self setLabel:self.distanceLabel text:text shownText:shownDistanceText];
+	
+	//GPS Speed, or OBD speed when the fix has it
+	[self setGauge:self.speedGauge value:sample->gaugeSpeed];
+	
+	if(sample->hasBluetoothData)
 	{
 		if(self.fuelGauge.hidden)
 			self.RPMGauge.hidden = NO;
 		if(self.fuelGauge.hidden)
 			self.fuelGauge.hidden = NO;
-		[self.RPMGauge setValue:loc.bluetoothInfo.rpm.floatValue animated:NO];
-		[self.fuelGauge setValue:loc.bluetoothInfo.fuel.floatValue animated:NO];
-		[self.speedGauge setValue:loc.bluetoothInfo.speed.floatValue animated:NO];
+		[self setGauge:self.RPMGauge value:sample->rpm];
+		[self setGauge:self.fuelGauge value:sample->fuel];
+	}
+}
+
+//Labels only get a new string when their text changes
+-(void)setLabel:(UILabel *)label text:(const char *)text shownText:(char *)shownText
+{
+	if(strncmp(text, shownText, SCRUB_TEXT_LENGTH) == 0)
+		return;
+	strlcpy(shownText, text, SCRUB_TEXT_LENGTH);
+	label.text = [NSString stringWithUTF8String:text];
+}
+
+-(void)setGauge:(WMGaugeView *)gauge value:(float)value
+{
+	if(gauge.value != value)
+		[gauge setValue:value animated:NO];
+}
+
+-(void)sliderDidBeginScrubbing:(UISlider *)sender
+{
+	[self pausePlayback];
+}
+
+//Reports the cost of the ticks of the scrub that just ended
+-(void)sliderDidEndScrubbing:(UISlider *)sender
+{
+	if(scrubTicks == 0)
+		return;
+	NSUInteger trackCount = track.count;
+	NSString *size = trackCount <= 1000 ? @"<=1k" : trackCount <= 10000 ? @"<=10k" : trackCount <= 100000 ? @"<=100k" : @">100k";
+	NSDictionary *dimensions = @{@"ticks":[NSString stringWithFormat:@"%lu",(unsigned long)scrubTicks], @"meanTickMs":[NSString stringWithFormat:@"%.3f",scrubTime / scrubTicks * 1000.0], @"maxTickMs":[NSString stringWithFormat:@"%.3f",slowestScrubTick * 1000.0], @"slowTicks":[NSString stringWithFormat:@"%lu",(unsigned long)slowScrubTicks], @"trackPoints":size};
+	[UtilityMethods trackPerformanceEvent:@"SliderScrub" duration:scrubTime dimensions:dimensions];
+	scrubTicks = 0;
+	scrubTime = 0;
+	slowestScrubTick = 0;
+	slowScrubTicks = 0;
+}
+
+#pragma mark - Playback
+
+- (void)playButtonTapped:(UIBarButtonItem *)sender
+{
+	if(!scrubSamples)
+		return;
+	if(playback.playing)
+	{
+		[self pausePlayback];
+		return;
 	}
 	
-	[self updateMarkerForSliderWithLocation:loc];
+	UIAlertController *sheet = [UIAlertController alertControllerWithTitle:@"Play trip at" message:nil preferredStyle:UIAlertControllerStyleActionSheet];
+	for(double rate = TRIP_PLAYBACK_MIN_RATE; rate <= TRIP_PLAYBACK_MAX_RATE; rate *= 2)
+	{
+		[sheet addAction:[UIAlertAction actionWithTitle:[NSString stringWithFormat:@"%.0fx",rate] style:UIAlertActionStyleDefault handler:^(UIAlertAction *action) {
+			[self playAtRate:rate];
+		}]];
+	}
+	[sheet addAction:[UIAlertAction actionWithTitle:@"Cancel" style:UIAlertActionStyleCancel handler:nil]];
+	sheet.popoverPresentationController.barButtonItem = sender;
+	[self presentViewController:sheet animated:YES completion:nil];
+}
+
+-(void)playAtRate:(double)rate
+{
+	if(!playback)
+	{
+		playback = [[TripPlayback alloc] initWithTrack:track];
+		playback.delegate = self;
+	}
+	playback.rate = rate;
+	[playback playFromIndex:lround(self.tripSlider.value)];
+	playButton.title = playback.playing ? @"Pause" : @"Play";
+}
+
+-(void)pausePlayback
+{
+	[playback pause];
+	playButton.title = @"Play";
+}
+
+-(void)stopPlayback
+{
+	[playback stop]; //the display link retains the playback
+	playback = nil;
+	playButton.title = @"Play";
+}
+
+-(void)tripPlayback:(TripPlayback *)aPlayback didMoveToPosition:(TripPlaybackPosition)position
+{
+	NSUInteger index = position.index;
+	const ScrubSample *from = &scrubSamples[index], *to = &scrubSamples[MIN(index + 1, track.count - 1)];
+	float fraction = (float)position.fraction;
+	ScrubSample sample = *from;
+	sample.speed += (to->speed - from->speed) * fraction;
+	sample.gaugeSpeed += (to->gaugeSpeed - from->gaugeSpeed) * fraction;
+	sample.rpm += (to->rpm - from->rpm) * fraction;
+	sample.fuel += (to->fuel - from->fuel) * fraction;
+	sample.miles += (to->miles - from->miles) * fraction;
+	sample.elapsedSeconds += (int32_t)((to->elapsedSeconds - from->elapsedSeconds) * fraction);
+	if(to->clockSeconds >= from->clockSeconds) //not across midnight
+		sample.clockSeconds += (int32_t)((to->clockSeconds - from->clockSeconds) * fraction);
+	[self showScrubSample:&sample];
+	
+	self.tripSlider.value = index + fraction;
+	shownScrubIndex = NSNotFound; //the labels no longer show a fix
+	[self moveMarkerForSliderToCoordinate:position.coordinate];
+	self.markerForSlider.rotation = position.heading;
+	if(followingMe)
+		[self.mapView moveCamera:[GMSCameraUpdate setTarget:position.coordinate]];
+}
+
+-(void)tripPlaybackDidFinish:(TripPlayback *)aPlayback
+{
+	playButton.title = @"Play";
 }
 
 #pragma mark - MyLocationButton Event
 
 - (IBAction)fullScreenButtonTapped:(UIButton *)sender
 {
+	if(!cameraBounds)
+		return;
 	GMSCameraUpdate *update = [GMSCameraUpdate fitBounds:cameraBounds withPadding:40];
 	[self.mapView animateWithCameraUpdate:update];
 }
@@ -294,6 +743,7 @@
 -(void) didTapTimeLabel
 {
 	showRealTime = !showRealTime;
+	shownScrubIndex = NSNotFound;
 	[self sliderValueChanged:self.tripSlider];
 }
 
@@ -344,35 +794,36 @@
 	NSMutableString *log = [[NSMutableString alloc] init];
 	//speed, rpm, throttle, engineLoad, fuel, barometric, ambientTemp, coolantTemp, intakeTemp, distance
 	[log appendFormat:@"Timestamp Lat Long Distance-mi Speed-MPH Altitude-ft RPM-RPM Throttle-%% EngineLoad-%% Fuel-%% Barometric-kPa AmbientTemperature-C CoolantTemperature-C, IntakeTemperature-C, Distance-km\n"];
-	for(GPSLocation *loc in self.GPSLocationsForTrip)
+	for(NSUInteger i = 0; i < track.count; i++)
 	{
-		NSString *timeStamp = [formatter stringFromDate:loc.timestamp];
-		[log appendFormat:@"%@ %lf %lf %lf",timeStamp,loc.latitude.doubleValue,loc.longitude.doubleValue, (loc.metersFromStart.doubleValue * 0.000621371)];
-		if(loc.bluetoothInfo)
+		NSString *timeStamp = [formatter stringFromDate:[track dateAtIndex:i]];
+		[log appendFormat:@"%@ %lf %lf %lf",timeStamp,track.latitudes[i],track.longitudes[i], (track.metersFromStart[i] * 0.000621371)];
+		if([track hasBluetoothDataAtIndex:i])
 		{
-			NSString *speed = loc.bluetoothInfo.speed ? loc.bluetoothInfo.speed.stringValue : loc.speed.stringValue;
-			NSString *rpm = [self stringFromValue:loc.bluetoothInfo.rpm];
-			NSString *throttle = [self stringFromValue:loc.bluetoothInfo.throttle];
-			NSString *engineLoad = [self stringFromValue:loc.bluetoothInfo.engineLoad];
-			NSString *fuel = [self stringFromValue:loc.bluetoothInfo.fuel];
-			NSString *barometric = [self stringFromValue:loc.bluetoothInfo.barometric];
-			NSString *ambient = [self stringFromValue:loc.bluetoothInfo.ambientTemp];
-			NSString *coolant = [self stringFromValue:loc.bluetoothInfo.coolantTemp];
-			NSString *intake = [self stringFromValue:loc.bluetoothInfo.intakeTemp];
-			NSString *distance = [self stringFromValue:loc.bluetoothInfo.distance];
-			[log appendFormat:@"%@ %lf %@ %@ %@ %@ %@ %@ %@ %@ %@",speed,loc.altitude.doubleValue,rpm,throttle,engineLoad,fuel,barometric,ambient,coolant,intake,distance];
+			float bleSpeed = [track valueForChannel:TripTrackChannelSpeed atIndex:i];
+			NSString *speed = [self stringFromValue:isnan(bleSpeed) ? track.speeds[i] : bleSpeed];
+			NSString *rpm = [self stringFromValue:[track valueForChannel:TripTrackChannelRPM atIndex:i]];
+			NSString *throttle = [self stringFromValue:[track valueForChannel:TripTrackChannelThrottle atIndex:i]];
+			NSString *engineLoad = [self stringFromValue:[track valueForChannel:TripTrackChannelEngineLoad atIndex:i]];
+			NSString *fuel = [self stringFromValue:[track valueForChannel:TripTrackChannelFuel atIndex:i]];
+			NSString *barometric = [self stringFromValue:[track valueForChannel:TripTrackChannelBarometric atIndex:i]];
+			NSString *ambient = [self stringFromValue:[track valueForChannel:TripTrackChannelAmbientTemp atIndex:i]];
+			NSString *coolant = [self stringFromValue:[track valueForChannel:TripTrackChannelCoolantTemp atIndex:i]];
+			NSString *intake = [self stringFromValue:[track valueForChannel:TripTrackChannelIntakeTemp atIndex:i]];
+			NSString *distance = [self stringFromValue:[track valueForChannel:TripTrackChannelDistance atIndex:i]];
+			[log appendFormat:@"%@ %f %@ %@ %@ %@ %@ %@ %@ %@ %@",speed,track.altitudes[i],rpm,throttle,engineLoad,fuel,barometric,ambient,coolant,intake,distance];
 		}else
 		{
-			[log appendFormat:@"%@ %lf XX XX XX XX XX XX XX XX XX",loc.speed,loc.altitude.doubleValue];
+			[log appendFormat:@"%@ %f XX XX XX XX XX XX XX XX XX",[self stringFromValue:track.speeds[i]],track.altitudes[i]];
 		}
 		[log appendString:@"\n"];
 	}
 	return log;
 }
 
--(NSString *)stringFromValue:(NSNumber *)val
+-(NSString *)stringFromValue:(float)val
 {
-	return val ? val.stringValue : @"XX";
+	return isnan(val) ? @"XX" : @(val).stringValue;
 }
 
 #pragma mark - MailMessageDelegate
@@ -402,6 +853,7 @@
 
 -(void)mapView:(GMSMapView *)mapView willMove:(BOOL)gesture
 {
+	[self startCountingFrames];
 	if(gesture)
 	{
 		if(followingMe)
@@ -411,35 +863,41 @@
 	}
 }
 
+-(void)mapView:(GMSMapView *)mapView didChangeCameraPosition:(GMSCameraPosition *)position
+{
+	if(pathPyramid)
+		[self showLevel:[self levelForCamera:position]];
+}
+
+-(void)mapView:(GMSMapView *)mapView idleAtCameraPosition:(GMSCameraPosition *)position
+{
+	[self stopCountingFrames];
+}
+
 -(void)mapView:(GMSMapView *)mapView didTapAtCoordinate:(CLLocationCoordinate2D)coordinate
 {
-	//Proceed only if Tap is in path
+	if(!pointTree)
+		return;
 	float tolerance = powf(10.0,(-0.301*mapView.camera.zoom)+9.0731) / 500;
 	
-	if(!GMSGeometryIsLocationOnPathTolerance(coordinate, pathForTrip, NO, tolerance))
+	//Proceed only if Tap is in path: near a fix, or on a segment leaving the closest one
+	double closestDistance;
+	NSUInteger closestIndex = TrackKDTreeNearest(pointTree, coordinate.latitude, coordinate.longitude, &closestDistance);
+	if(closestDistance > tolerance && ![self isCoordinate:coordinate onSegmentsAroundIndex:closestIndex tolerance:tolerance])
 		return;
 	
-	GPSLocation *closestLocation = nil;
-	CLLocationDistance closestDistance = CLLocationDistanceMax;
-	
-	for(GPSLocation *location in GPSLocationsForTrip)
-	{
-		CLLocationCoordinate2D coord = CLLocationCoordinate2DMake(location.latitude.doubleValue, location.longitude.doubleValue);
-		CLLocationDistance distance = GMSGeometryDistance(coord, coordinate);
-		if(distance < closestDistance)
-		{
-			closestDistance = distance;
-			closestLocation = location;
-		}
-	}
-	if(closestLocation)
-	{
-		[self updateTapMarkerInMap:mapView withGPSLocation:closestLocation];
-	}
+	[self updateTapMarkerInMap:mapView withIndex:closestIndex passes:[self passCountNearCoordinate:coordinate radius:MAX(tolerance, closestDistance)]];
 }
 
 #pragma mark - Memory Management
 
+-(void)dealloc
+{
+	[playback stop];
+	TrackKDTreeFree(pointTree);
+	free(scrubSamples);
+}
+
 - (void)didReceiveMemoryWarning {
 	[super didReceiveMemoryWarning];
 	// Dispose of any resources that can be recreated.
@@ -0,0 +1,31 @@
+//
+//  TripFinalizer.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/24/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "TripJournal.h"
+
+//! Posted on the main thread after a trip has been saved. userInfo has TripFinalizerTripIDKey and TripFinalizerDurationKey
+extern NSString * const TripFinalizerDidFinishNotification;
+extern NSString * const TripFinalizerTripIDKey; //NSManagedObjectID of the saved Trip
+extern NSString * const TripFinalizerDurationKey; //NSNumber, seconds spent finalizing
+
+/**
+ Turns closed journals into saved Trips on TripRollup's update context, one job at a time,
+ so stopping a recording never waits on summary stats or the store.
+ */
+@interface TripFinalizer : NSObject
+
++(instancetype)sharedFinalizer;
+
+/**
+ Queues the journal at url to be saved as a Trip and then deleted.
+ @param endTime the trip end time, or nil to use the last recorded fix (recovered journals)
+ */
+-(void)finalizeJournalAtURL:(NSURL *)url endTime:(NSDate *)endTime;
+
+@end
@@ -0,0 +1,111 @@
+//
+//  TripFinalizer.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/24/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripFinalizer.h"
+#import <QuartzCore/QuartzCore.h>
+#import "AppDelegate.h"
+#import "UtilityMethods.h"
+#import "TripRollup.h"
+
+NSString * const TripFinalizerDidFinishNotification = @"TripFinalizerDidFinishNotification";
+NSString * const TripFinalizerTripIDKey = @"tripID";
+NSString * const TripFinalizerDurationKey = @"duration";
+
+@implementation TripFinalizer{
+	AppDelegate *appDelegate;
+	NSManagedObjectContext *context;
+}
+
++(instancetype)sharedFinalizer
+{
+	static TripFinalizer *sharedFinalizer = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedFinalizer = [[self alloc] init];
+	});
+	return sharedFinalizer;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		appDelegate = [[UIApplication sharedApplication] delegate];
+	}
+	return self;
+}
+
+#pragma mark - Finalizing
+
+-(void)finalizeJournalAtURL:(NSURL *)url endTime:(NSDate *)endTime
+{
+	//Finish the save even if the user leaves the app right after tapping Stop
+	__block UIBackgroundTaskIdentifier backgroundTask = [[UIApplication sharedApplication] beginBackgroundTaskWithExpirationHandler:^{
+		[[UIApplication sharedApplication] endBackgroundTask:backgroundTask];
+		backgroundTask = UIBackgroundTaskInvalid;
+	}];
+
+	//A trip stopped while the store is still being migrated is saved once the migration completes
+	[appDelegate performWhenStoreIsOpen:^{
+		if(!context)
+			context = [TripRollup updateContext]; //the trip and its rollups are saved together
+		[context performBlock:^{
+			CFTimeInterval start = CACurrentMediaTime();
+			NSManagedObjectID *tripID = [self saveTripFromJournalAtURL:url endTime:endTime];
+			CFTimeInterval duration = CACurrentMediaTime() - start;
+			[context reset];
+
+			if(tripID)
+			{
+				[UtilityMethods trackPerformanceEvent:@"TripFinalized" duration:duration dimensions:nil];
+				dispatch_async(dispatch_get_main_queue(), ^{
+					[[NSNotificationCenter defaultCenter] postNotificationName:TripFinalizerDidFinishNotification object:self userInfo:@{TripFinalizerTripIDKey:tripID, TripFinalizerDurationKey:@(duration)}];
+				});
+			}
+
+			[[UIApplication sharedApplication] endBackgroundTask:backgroundTask];
+			backgroundTask = UIBackgroundTaskInvalid;
+		}];
+	}];
+}
+
+//Runs on the context queue. @return the saved trip, nil if nothing was saved
+-(NSManagedObjectID *)saveTripFromJournalAtURL:(NSURL *)url endTime:(NSDate *)endTime
+{
+	TripJournal *journal = [[TripJournal alloc] initWithContentsOfURL:url];
+	if(!journal || journal.fixCount == 0 || [self tripExistsWithStartTime:journal.startTime])
+	{
+		[journal close];
+		[[NSFileManager defaultManager] removeItemAtURL:url error:nil];
+		return nil;
+	}
+
+	Trip *trip = [journal insertTripIntoContext:context endTime:endTime];
+	[TripRollup addTrip:trip];
+	NSError *error = nil;
+	if(![context obtainPermanentIDsForObjects:@[trip] error:&error] || ![appDelegate saveBackgroundContext:context error:&error])
+	{
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+		[context rollback];
+		[journal close]; //keep the journal so the trip is recovered on next launch
+		return nil;
+	}
+	[journal discard];
+	return trip.objectID;
+}
+
+//A trip is saved before its journal is deleted, so a journal can outlive a trip that was already saved
+-(BOOL)tripExistsWithStartTime:(NSDate *)startTime
+{
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+	[request setPredicate:[NSPredicate predicateWithFormat:@"startTime == %@",startTime]];
+	return [context countForFetchRequest:request error:nil] > 0;
+}
+
+@end
@@ -0,0 +1,58 @@
+//
+//  TripJournal.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/22/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import <CoreLocation/CoreLocation.h>
+#import "Trip.h"
+
+/**
+ Append-only, memory-mapped log of every fix and OBD sample of a recording in progress.
+ Appends are plain stores into a shared mapping, so they cost no system call and survive
+ the app being killed. A journal that still exists at launch belongs to a recording that
+ never finished and can be turned back into a Trip.
+ */
+@interface TripJournal : NSObject
+
+@property (nonatomic, strong, readonly) NSURL *URL;
+@property (nonatomic, strong, readonly) NSDate *startTime;
+//! The system time zone when the journal was created. nil for journals that did not record it
+@property (nonatomic, strong, readonly) NSTimeZone *timeZone;
+@property (nonatomic, readonly) NSUInteger fixCount;
+
++(NSURL *)journalDirectory;
+//! Journals left behind by recordings that were never finalized
++(NSArray *)unfinishedJournalURLs;
+
+//! Creates a new journal file. @return nil if the file could not be created or mapped
++(instancetype)journalWithStartTime:(NSDate *)startTime;
+//! Opens an existing journal read-only. @return nil if the file is not a valid journal
+-(instancetype)initWithContentsOfURL:(NSURL *)url;
+
+-(void)appendLocation:(CLLocation *)location bluetoothConnected:(BOOL)connected;
+-(void)appendDiagnosticForKey:(NSString *)key withValue:(NSNumber *)value;
+//! Records the OBD values already known when the journal starts, e.g. for a trip split off a connected recording
+-(void)appendDiagnostics:(NSDictionary *)diagnostics atDate:(NSDate *)date;
+//! Forget every OBD value seen so far, e.g. when Bluetooth is turned off
+-(void)appendDiagnosticsReset;
+
+//! Schedules dirty pages to be written to disk without blocking
+-(void)synchronize;
+-(void)close;
+//! Closes the journal and deletes its file
+-(void)discard;
+
+/**
+ Replays the journal into a new Trip (with its packed TripTrack and summary
+ stats) inserted in context. Must be called on the context's queue.
+ @param endTime the trip end time, or nil to use the timestamp of the last fix
+ @return nil if the journal has no fixes
+ */
+-(Trip *)insertTripIntoContext:(NSManagedObjectContext *)context endTime:(NSDate *)endTime;
+
+@end
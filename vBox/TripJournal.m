@@ -0,0 +1,381 @@
+//
+//  TripJournal.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/22/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripJournal.h"
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import "TripTrack.h"
+#import "TripChannels.h"
+#import "TripSpatialIndex.h"
+
+#define JOURNAL_MAGIC 0x4A584256 //"VBXJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_INITIAL_CAPACITY 4096 //records, ~192KB
+#define JOURNAL_EXTENSION @"vboxjournal"
+
+typedef NS_ENUM(uint32_t, JournalRecordType) {
+	JournalRecordTypeFix = 1,
+	JournalRecordTypeDiagnostic,
+	JournalRecordTypeDiagnosticsReset,
+	JournalRecordTypeChannelName
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	double startTime; //seconds since reference date
+	volatile uint64_t recordCount; //committed records, only bumped after the record is written
+	char timeZoneName[40]; //NUL terminated, empty if unknown. Was zeroed reserved space, so older journals read as unknown
+} JournalHeader;
+
+//Fix: values = latitude, longitude, speed (m/s), altitude (m); channel = bluetooth connected
+//Diagnostic: channel = index into diagnosticKeys or a named channel, values[0] = value
+//ChannelName: channel = index past diagnosticKeys given to a key not in the list, values = NUL terminated UTF-8 key
+typedef struct {
+	uint32_t type;
+	uint32_t channel;
+	double timestamp;
+	double values[4];
+} JournalRecord;
+
+//Keys reported by BLEManager, in the order they are stored in the journal. Only append to this list;
+//other keys are named in the journal the first time they are seen
+static NSString * const diagnosticKeys[] = {
+	@"Speed", @"Ambient Temp", @"Barometric", @"RPM", @"Intake Temp", @"Fuel", @"Engine Load",
+	@"Distance", @"Coolant Temp", @"Throttle", @"Runtime", @"Engine Torque Percentage", @"Engine Fuel Rate"
+};
+#define DIAGNOSTIC_KEY_COUNT (sizeof(diagnosticKeys) / sizeof(diagnosticKeys[0]))
+#define CHANNEL_NAME_LENGTH (sizeof(((JournalRecord *)0)->values) - 1)
+
+@implementation TripJournal{
+	int fileDescriptor;
+	BOOL writable;
+	void *mapping;
+	size_t mappingLength;
+	uint64_t capacity;
+	NSMutableDictionary *namedChannels; //key -> channel, for keys not in diagnosticKeys
+}
+
+#pragma mark - Journal Files
+
++(NSURL *)journalDirectory
+{
+	NSURL *documents = [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
+	NSURL *directory = [documents URLByAppendingPathComponent:@"Journals" isDirectory:YES];
+	[[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+	return directory;
+}
+
++(NSArray *)unfinishedJournalURLs
+{
+	NSArray *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:[self journalDirectory] includingPropertiesForKeys:nil options:NSDirectoryEnumerationSkipsHiddenFiles error:nil];
+	return [contents filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"pathExtension == %@",JOURNAL_EXTENSION]];
+}
+
+#pragma mark - Initialization
+
++(instancetype)journalWithStartTime:(NSDate *)startTime
+{
+	NSString *fileName = [[[NSUUID UUID] UUIDString] stringByAppendingPathExtension:JOURNAL_EXTENSION];
+	NSURL *url = [[self journalDirectory] URLByAppendingPathComponent:fileName];
+	return [[self alloc] initWithURL:url startTime:startTime];
+}
+
+-(instancetype)initWithURL:(NSURL *)url startTime:(NSDate *)startTime
+{
+	self = [super init];
+	if(self)
+	{
+		_URL = url;
+		_startTime = startTime;
+		writable = YES;
+		fileDescriptor = open(url.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fileDescriptor < 0 || ![self mapWithCapacity:JOURNAL_INITIAL_CAPACITY])
+		{
+			NSLog(@"Error: could not create journal at %@ (%s)",url.path,strerror(errno));
+			[self discard];
+			return nil;
+		}
+		JournalHeader *header = mapping;
+		header->magic = JOURNAL_MAGIC;
+		header->version = JOURNAL_VERSION;
+		header->startTime = startTime.timeIntervalSinceReferenceDate;
+		header->recordCount = 0;
+		_timeZone = [NSTimeZone systemTimeZone];
+		const char *timeZoneName = _timeZone.name.UTF8String;
+		if(timeZoneName && strlen(timeZoneName) < sizeof(header->timeZoneName))
+			strcpy(header->timeZoneName, timeZoneName);
+	}
+	return self;
+}
+
+-(instancetype)initWithContentsOfURL:(NSURL *)url
+{
+	self = [super init];
+	if(self)
+	{
+		_URL = url;
+		writable = NO;
+		fileDescriptor = open(url.fileSystemRepresentation, O_RDONLY);
+		struct stat fileStat;
+		if(fileDescriptor < 0 || fstat(fileDescriptor, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(JournalHeader))
+		{
+			[self close];
+			return nil;
+		}
+		mappingLength = (size_t)fileStat.st_size;
+		mapping = mmap(NULL, mappingLength, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+		if(mapping == MAP_FAILED)
+		{
+			mapping = NULL;
+			[self close];
+			return nil;
+		}
+		JournalHeader *header = mapping;
+		if(header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION)
+		{
+			[self close];
+			return nil;
+		}
+		capacity = (mappingLength - sizeof(JournalHeader)) / sizeof(JournalRecord);
+		_startTime = [NSDate dateWithTimeIntervalSinceReferenceDate:header->startTime];
+		if(memchr(header->timeZoneName, 0, sizeof(header->timeZoneName)) && header->timeZoneName[0])
+			_timeZone = [NSTimeZone timeZoneWithName:@(header->timeZoneName)];
+		for(uint64_t i = 0; i < [self recordCount]; i++)
+		{
+			if([self records][i].type == JournalRecordTypeFix)
+				_fixCount++;
+		}
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	[self close];
+}
+
+#pragma mark - Mapping
+
+-(BOOL)mapWithCapacity:(uint64_t)newCapacity
+{
+	size_t newLength = sizeof(JournalHeader) + (size_t)newCapacity * sizeof(JournalRecord);
+	if(ftruncate(fileDescriptor, (off_t)newLength) != 0)
+		return NO;
+	if(mapping)
+		munmap(mapping, mappingLength);
+	mapping = mmap(NULL, newLength, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+	if(mapping == MAP_FAILED)
+	{
+		mapping = NULL;
+		return NO;
+	}
+	mappingLength = newLength;
+	capacity = newCapacity;
+	return YES;
+}
+
+-(uint64_t)recordCount
+{
+	uint64_t count = ((JournalHeader *)mapping)->recordCount;
+	return MIN(count, capacity); //a torn header must never send us past the end of the file
+}
+
+-(JournalRecord *)records
+{
+	return (JournalRecord *)((char *)mapping + sizeof(JournalHeader));
+}
+
+-(void)appendRecord:(JournalRecord)record
+{
+	if(!writable || !mapping)
+		return;
+	JournalHeader *header = mapping;
+	uint64_t count = header->recordCount;
+	if(count == capacity && ![self mapWithCapacity:capacity * 2])
+	{
+		NSLog(@"Error: could not grow journal %@ (%s)",self.URL.path,strerror(errno));
+		return;
+	}
+	header = mapping;
+	[self records][count] = record;
+	__sync_synchronize(); //record must be in place before it is counted
+	header->recordCount = count + 1;
+}
+
+#pragma mark - Appending
+
+-(void)appendLocation:(CLLocation *)location bluetoothConnected:(BOOL)connected
+{
+	JournalRecord record = {JournalRecordTypeFix, connected ? 1 : 0, location.timestamp.timeIntervalSinceReferenceDate,
+		{location.coordinate.latitude, location.coordinate.longitude, location.speed, location.altitude}};
+	[self appendRecord:record];
+	_fixCount++;
+}
+
+-(void)appendDiagnosticForKey:(NSString *)key withValue:(NSNumber *)value
+{
+	[self appendDiagnosticForKey:key withValue:value timestamp:[NSDate timeIntervalSinceReferenceDate]];
+}
+
+-(void)appendDiagnostics:(NSDictionary *)diagnostics atDate:(NSDate *)date
+{
+	for(NSString *key in diagnostics)
+	{
+		[self appendDiagnosticForKey:key withValue:diagnostics[key] timestamp:date.timeIntervalSinceReferenceDate];
+	}
+}
+
+-(void)appendDiagnosticForKey:(NSString *)key withValue:(NSNumber *)value timestamp:(NSTimeInterval)timestamp
+{
+	uint32_t channel = 0;
+	while(channel < DIAGNOSTIC_KEY_COUNT && ![diagnosticKeys[channel] isEqualToString:key])
+		channel++;
+	if(channel == DIAGNOSTIC_KEY_COUNT)
+		channel = [self namedChannelForKey:key];
+
+	JournalRecord record = {JournalRecordTypeDiagnostic, channel, timestamp, {value.doubleValue, 0, 0, 0}};
+	[self appendRecord:record];
+}
+
+-(uint32_t)namedChannelForKey:(NSString *)key
+{
+	if(!namedChannels)
+		namedChannels = [NSMutableDictionary dictionary];
+	NSNumber *channel = namedChannels[key];
+	if(channel)
+		return channel.unsignedIntValue;
+
+	channel = @(DIAGNOSTIC_KEY_COUNT + namedChannels.count);
+	namedChannels[key] = channel;
+	JournalRecord record = {JournalRecordTypeChannelName, channel.unsignedIntValue, [NSDate timeIntervalSinceReferenceDate], {0, 0, 0, 0}};
+	NSUInteger length = 0;
+	[key getBytes:record.values maxLength:CHANNEL_NAME_LENGTH usedLength:&length encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, key.length) remainingRange:NULL];
+	[self appendRecord:record];
+	return channel.unsignedIntValue;
+}
+
+-(void)appendDiagnosticsReset
+{
+	JournalRecord record = {JournalRecordTypeDiagnosticsReset, 0, [NSDate timeIntervalSinceReferenceDate], {0, 0, 0, 0}};
+	[self appendRecord:record];
+}
+
+#pragma mark - Closing
+
+-(void)synchronize
+{
+	if(mapping && writable)
+		msync(mapping, mappingLength, MS_ASYNC);
+}
+
+-(void)close
+{
+	if(mapping)
+	{
+		if(writable)
+			msync(mapping, mappingLength, MS_ASYNC);
+		munmap(mapping, mappingLength);
+		mapping = NULL;
+	}
+	if(fileDescriptor >= 0)
+	{
+		close(fileDescriptor);
+		fileDescriptor = -1;
+	}
+}
+
+-(void)discard
+{
+	[self close];
+	[[NSFileManager defaultManager] removeItemAtURL:self.URL error:nil];
+}
+
+#pragma mark - Rebuilding Trip
+
+-(Trip *)insertTripIntoContext:(NSManagedObjectContext *)context endTime:(NSDate *)endTime
+{
+	if(!mapping || self.fixCount == 0)
+		return nil;
+
+	Trip *trip = [NSEntityDescription insertNewObjectForEntityForName:@"Trip" inManagedObjectContext:context];
+	[trip setStartTime:self.startTime];
+	//Journals left by a version that did not record the zone were most likely recorded in this one
+	NSTimeZone *timeZone = self.timeZone ?: [NSTimeZone systemTimeZone];
+	[trip setTimeZoneName:timeZone.name];
+	[trip setDayKey:@([Trip dayKeyForDate:self.startTime timeZone:timeZone])];
+
+	TripTrack *track = [[TripTrack alloc] initWithCapacity:self.fixCount startTime:self.startTime];
+	TripChannels *channels = [[TripChannels alloc] init];
+	NSMutableDictionary *channelKeys = [NSMutableDictionary dictionary]; //named channel -> key
+	BOOL connected = NO;
+	double sumSpeed = 0, maxSpeed = 0, minSpeed = DBL_MAX;
+	double lastTimestamp = 0;
+
+	JournalRecord *records = [self records];
+	uint64_t count = [self recordCount];
+	for(uint64_t i = 0; i < count; i++)
+	{
+		JournalRecord record = records[i];
+		switch(record.type)
+		{
+			case JournalRecordTypeChannelName:
+			{
+				char name[CHANNEL_NAME_LENGTH + 1] = {0};
+				memcpy(name, record.values, CHANNEL_NAME_LENGTH);
+				NSString *key = [NSString stringWithUTF8String:name];
+				if(key)
+					channelKeys[@(record.channel)] = key;
+				break;
+			}
+			case JournalRecordTypeDiagnostic:
+			{
+				NSString *key = record.channel < DIAGNOSTIC_KEY_COUNT ? diagnosticKeys[record.channel] : channelKeys[@(record.channel)];
+				if(key)
+					[channels appendValue:record.values[0] forKey:key timestamp:record.timestamp];
+				break;
+			}
+			case JournalRecordTypeDiagnosticsReset:
+				[channels appendResetAtTimestamp:record.timestamp];
+				break;
+			case JournalRecordTypeFix:
+			{
+				lastTimestamp = record.timestamp;
+				double speedMPH = record.values[2] >= 0 ? record.values[2] * 2.236936284 : 0; //speed is given meters/sec
+				minSpeed = MIN(minSpeed, speedMPH);
+				maxSpeed = MAX(maxSpeed, speedMPH);
+				sumSpeed += speedMPH;
+
+				//Values seen while the adapter was connected don't carry over a disconnect
+				if(connected && !record.channel)
+					[channels appendResetAtTimestamp:record.timestamp];
+				connected = record.channel != 0;
+				[track appendLatitude:record.values[0] longitude:record.values[1] timestamp:record.timestamp speed:speedMPH
+							 altitude:record.values[3] * 3.28084 bluetoothValues:NULL];
+				break;
+			}
+		}
+	}
+
+	track.channels = channels;
+	[trip setTrackData:[track dataRepresentation]];
+	[trip setPointCount:@(track.count)];
+	[trip setEndTime:endTime ? endTime : [NSDate dateWithTimeIntervalSinceReferenceDate:lastTimestamp]];
+	[trip setAvgSpeed:@(sumSpeed / track.count)];
+	[trip setMaxSpeed:@(maxSpeed)];
+	[trip setMinSpeed:@(minSpeed)];
+	[trip setTotalMiles:@(track.metersFromStart[track.count-1] * 0.000621371)];
+	[trip setFuelUsed:@([track fuelUsed])];
+	[trip updateSpansWithTrack:track];
+	[TripSpatialIndex indexTrip:trip track:track];
+	return trip;
+}
+
+@end
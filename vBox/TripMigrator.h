@@ -0,0 +1,29 @@
+//
+//  TripMigrator.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/3/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Fills in what trips saved by older model versions are missing. Runs on its own private queue
+ context and saves in small batches, so it can be interrupted at any point and picks up where
+ it left off on next launch.
+ */
+@interface TripMigrator : NSObject
+
++(instancetype)sharedMigrator;
+
+//! Packs trips from before model version 8 into Trip.trackData and deletes their GPSLocation rows
+-(void)packLegacyTripsInBackground;
+//! Sets Trip.dayKey and Trip.timeZoneName on trips from before model versions 9 and 16. Does nothing once every trip has them
+-(void)backfillDayKeysInBackground;
+//! Adds the TripCell rows of packed trips from before model version 11. Does nothing once every trip has them
+-(void)indexTripsInBackground;
+//! Builds the TripRollup rows for trips from before model version 12, once. Run after packLegacyTripsInBackground so fuel use is known
+-(void)buildRollupsInBackground;
+
+@end
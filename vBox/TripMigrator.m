@@ -0,0 +1,324 @@
+//
+//  TripMigrator.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/3/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripMigrator.h"
+#import <QuartzCore/QuartzCore.h>
+#import "AppDelegate.h"
+#import "Trip.h"
+#import "GPSLocation.h"
+#import "TripTrack.h"
+#import "TripSpatialIndex.h"
+#import "TripRollup.h"
+#import "UtilityMethods.h"
+
+#define DAY_KEY_BATCH_SIZE 200
+#define DAY_KEYS_BACKFILLED_KEY @"dayKeysAndTimeZonesBackfilled" //renamed in model 16 so installs that had day keys also get their trips' zones
+#define INDEX_BATCH_SIZE 20 //each trip's track is decoded to index it
+#define LOCATION_BATCH_SIZE 2000 //legacy rows faulted in at once while numbering, packing or deleting them
+#define TRIPS_INDEXED_KEY @"tripsSpatiallyIndexed"
+#define ROLLUPS_BUILT_KEY @"tripRollupsBuilt"
+
+@implementation TripMigrator{
+	AppDelegate *appDelegate;
+	NSManagedObjectContext *context;
+	BOOL packing;
+}
+
++(instancetype)sharedMigrator
+{
+	static TripMigrator *sharedMigrator = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedMigrator = [[self alloc] init];
+	});
+	return sharedMigrator;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		appDelegate = [[UIApplication sharedApplication] delegate];
+		context = [appDelegate newBackgroundContext];
+	}
+	return self;
+}
+
+-(void)packLegacyTripsInBackground
+{
+	[context performBlock:^{
+		if(packing)
+			return;
+		packing = YES;
+
+		NSUInteger packedCount = 0, pointCount = 0;
+		CFTimeInterval start = CACurrentMediaTime();
+		Trip *trip = nil;
+		while((trip = [self nextLegacyTrip]))
+		{
+			NSUInteger points = [self packTrip:trip];
+			if(points == NSNotFound)
+				break;
+			pointCount += points;
+			packedCount++;
+		}
+
+		if(packedCount > 0)
+		{
+			NSDictionary *dimensions = @{@"trips":[NSString stringWithFormat:@"%lu",(unsigned long)packedCount],
+										 @"points":[NSString stringWithFormat:@"%lu",(unsigned long)pointCount]};
+			[UtilityMethods trackPerformanceEvent:@"TripTrackBackfill" duration:CACurrentMediaTime() - start dimensions:dimensions];
+		}
+		packing = NO;
+	}];
+}
+
+-(void)backfillDayKeysInBackground
+{
+	if([[NSUserDefaults standardUserDefaults] boolForKey:DAY_KEYS_BACKFILLED_KEY])
+		return;
+
+	[context performBlock:^{
+		NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+		[request setPredicate:[NSPredicate predicateWithFormat:@"dayKey == 0 OR timeZoneName == nil"]];
+		[request setPropertiesToFetch:@[@"startTime",@"dayKey",@"timeZoneName"]];
+		[request setFetchLimit:DAY_KEY_BATCH_SIZE];
+
+		CFTimeInterval start = CACurrentMediaTime();
+		NSUInteger updatedCount = 0;
+		NSArray *trips = nil;
+		NSError *error = nil;
+		while((trips = [context executeFetchRequest:request error:&error]).count > 0)
+		{
+			for(Trip *trip in trips)
+			{
+				//The zone was never stored; the one the day keys and rollups have used so far is the best guess, and freezing it keeps the trip on that day
+				if(!trip.timeZoneName)
+					[trip setTimeZoneName:[NSTimeZone systemTimeZone].name];
+				[trip setDayKey:@([Trip dayKeyForDate:trip.startTime timeZone:trip.timeZone])];
+			}
+			if(![appDelegate saveBackgroundContext:context error:&error])
+				break;
+			updatedCount += trips.count;
+			[context reset];
+		}
+
+		if(error)
+		{
+			NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+			[context rollback];
+			return;
+		}
+		[[NSUserDefaults standardUserDefaults] setBool:YES forKey:DAY_KEYS_BACKFILLED_KEY];
+		if(updatedCount > 0)
+		{
+			NSDictionary *dimensions = @{@"trips":[NSString stringWithFormat:@"%lu",(unsigned long)updatedCount]};
+			[UtilityMethods trackPerformanceEvent:@"DayKeyBackfill" duration:CACurrentMediaTime() - start dimensions:dimensions];
+		}
+	}];
+}
+
+-(void)indexTripsInBackground
+{
+	if([[NSUserDefaults standardUserDefaults] boolForKey:TRIPS_INDEXED_KEY])
+		return;
+
+	[context performBlock:^{
+		//Legacy trips are indexed as they are packed
+		NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+		[request setPredicate:[NSPredicate predicateWithFormat:@"trackData != nil AND pointCount > 0 AND cells.@count == 0"]];
+		[request setFetchLimit:INDEX_BATCH_SIZE];
+
+		CFTimeInterval start = CACurrentMediaTime();
+		NSUInteger indexedCount = 0;
+		//Trips still without cells, e.g. because their trackData does not decode, would match the fetch again forever
+		NSMutableArray *skippedIDs = [NSMutableArray array];
+		NSArray *trips = nil;
+		NSError *error = nil;
+		while((trips = [context executeFetchRequest:request error:&error]).count > 0)
+		{
+			for(Trip *trip in trips)
+			{
+				[TripSpatialIndex indexTrip:trip track:[trip track]];
+				if(trip.cells.count > 0)
+					indexedCount++;
+				else
+					[skippedIDs addObject:trip.objectID];
+			}
+			if(![appDelegate saveBackgroundContext:context error:&error])
+				break;
+			[context reset];
+			[request setPredicate:[NSPredicate predicateWithFormat:@"trackData != nil AND pointCount > 0 AND cells.@count == 0 AND NOT (self IN %@)",skippedIDs]];
+		}
+
+		if(error)
+		{
+			NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+			[context rollback];
+			return;
+		}
+		[[NSUserDefaults standardUserDefaults] setBool:YES forKey:TRIPS_INDEXED_KEY];
+		if(indexedCount > 0)
+		{
+			NSDictionary *dimensions = @{@"trips":[NSString stringWithFormat:@"%lu",(unsigned long)indexedCount]};
+			[UtilityMethods trackPerformanceEvent:@"SpatialIndexBackfill" duration:CACurrentMediaTime() - start dimensions:dimensions];
+		}
+	}];
+}
+
+-(void)buildRollupsInBackground
+{
+	if([[NSUserDefaults standardUserDefaults] boolForKey:ROLLUPS_BUILT_KEY])
+		return;
+
+	//Queued behind the packing on this context so fuel use is known, then run on the update context so no trip is added or removed meanwhile
+	[context performBlock:^{
+		NSManagedObjectContext *updateContext = [TripRollup updateContext];
+		[updateContext performBlockAndWait:^{
+			CFTimeInterval start = CACurrentMediaTime();
+			NSError *error = nil;
+			if(![TripRollup rebuildRollupsInContext:updateContext error:&error] || ![appDelegate saveBackgroundContext:updateContext error:&error])
+			{
+				NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+				[updateContext rollback];
+				return;
+			}
+			[updateContext reset];
+			[[NSUserDefaults standardUserDefaults] setBool:YES forKey:ROLLUPS_BUILT_KEY];
+			[UtilityMethods trackPerformanceEvent:@"RollupBackfill" duration:CACurrentMediaTime() - start dimensions:nil];
+		}];
+	}];
+}
+
+//Runs on the context queue
+-(Trip *)nextLegacyTrip
+{
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+	//Also trips packed by a run that was interrupted before all their rows were deleted
+	[request setPredicate:[NSPredicate predicateWithFormat:@"trackData == nil OR gpsLocations.@count > 0"]];
+	[request setFetchLimit:1];
+
+	NSError *error = nil;
+	NSArray *trips = [context executeFetchRequest:request error:&error];
+	if(!trips)
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+	return trips.firstObject;
+}
+
+/**
+ Runs on the context queue. Numbers the trip's rows, builds its track a seq window at a time and
+ saves it, then deletes the rows a batch at a time, so no more than LOCATION_BATCH_SIZE rows are
+ in memory however long the trip is. Every step picks up where an interrupted run left off.
+ @return the number of points packed, NSNotFound if a save failed
+ */
+-(NSUInteger)packTrip:(Trip *)trip
+{
+	//trip is invalidated by the first reset; it is looked up again by ID when needed
+	NSManagedObjectID *tripID = trip.objectID;
+	NSUInteger pointCount = trip.pointCount.unsignedIntegerValue;
+	NSError *error = nil;
+	if(!trip.trackData)
+	{
+		NSDate *startTime = trip.startTime;
+		NSUInteger count = 0;
+		if(![self sequenceLocationsOfTrip:tripID count:&count error:&error])
+			return [self failPackingWithError:error];
+
+		TripTrack *track = [[TripTrack alloc] initWithCapacity:count startTime:startTime];
+		for(NSUInteger start = 0; start < count; start += LOCATION_BATCH_SIZE)
+		{
+			trip = (Trip *)[context existingObjectWithID:tripID error:&error];
+			if(!trip)
+				return [self failPackingWithError:error];
+			[track appendGPSLocations:[trip gpsLocationsInRange:NSMakeRange(start, LOCATION_BATCH_SIZE)]];
+			[context reset];
+		}
+
+		trip = (Trip *)[context existingObjectWithID:tripID error:&error];
+		if(!trip)
+			return [self failPackingWithError:error];
+		[trip setTrackData:[track dataRepresentation]];
+		[trip setPointCount:@(track.count)];
+		[trip setFuelUsed:@([track fuelUsed])];
+		[trip updateSpansWithTrack:track];
+		[TripSpatialIndex indexTrip:trip track:track];
+		if(![appDelegate saveBackgroundContext:context error:&error])
+			return [self failPackingWithError:error];
+		[context reset];
+		pointCount = track.count;
+	}
+
+	//The track is saved, so the rows can go; any left by an interruption are found again by nextLegacyTrip
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"GPSLocation"];
+	[request setPredicate:[NSPredicate predicateWithFormat:@"tripInfo == %@",tripID]];
+	[request setFetchLimit:LOCATION_BATCH_SIZE];
+	NSArray *locations = nil;
+	while((locations = [context executeFetchRequest:request error:&error]).count > 0)
+	{
+		for(NSManagedObject *location in locations)
+		{
+			[context deleteObject:location]; //cascades to its BluetoothData
+		}
+		if(![appDelegate saveBackgroundContext:context error:&error])
+			break;
+		[context reset];
+	}
+	if(error)
+		return [self failPackingWithError:error];
+	return pointCount;
+}
+
+/**
+ Sets GPSLocation.seq of the trip's rows to their position in recording order, a batch per save.
+ Rows migrated from before model version 14 all have seq 0; a trip with more than one row at 0 is
+ numbered again from the start, which also finishes a run that was interrupted.
+ */
+-(BOOL)sequenceLocationsOfTrip:(NSManagedObjectID *)tripID count:(NSUInteger *)count error:(NSError **)error
+{
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"GPSLocation"];
+	[request setPredicate:[NSPredicate predicateWithFormat:@"tripInfo == %@",tripID]];
+	*count = [context countForFetchRequest:request error:error];
+	if(*count == NSNotFound)
+		return NO;
+
+	NSFetchRequest *unsequencedRequest = [NSFetchRequest fetchRequestWithEntityName:@"GPSLocation"];
+	[unsequencedRequest setPredicate:[NSPredicate predicateWithFormat:@"tripInfo == %@ AND seq == 0",tripID]];
+	NSUInteger unsequenced = [context countForFetchRequest:unsequencedRequest error:error];
+	if(unsequenced == NSNotFound)
+		return NO;
+	if(unsequenced <= 1)
+		return YES;
+
+	[request setSortDescriptors:[Trip gpsLocationRecordingOrder]];
+	[request setFetchLimit:LOCATION_BATCH_SIZE];
+	for(NSUInteger start = 0; start < *count; start += LOCATION_BATCH_SIZE)
+	{
+		[request setFetchOffset:start];
+		NSArray *locations = [context executeFetchRequest:request error:error];
+		if(!locations)
+			return NO;
+		[locations enumerateObjectsUsingBlock:^(GPSLocation *location, NSUInteger i, BOOL *stop) {
+			[location setSeq:@(start + i)];
+		}];
+		if(![appDelegate saveBackgroundContext:context error:error])
+			return NO;
+		[context reset];
+	}
+	return YES;
+}
+
+-(NSUInteger)failPackingWithError:(NSError *)error
+{
+	NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+	[context rollback];
+	[context reset];
+	return NSNotFound;
+}
+
+@end
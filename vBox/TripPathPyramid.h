@@ -0,0 +1,40 @@
+//
+//  TripPathPyramid.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/18/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class TripTrack;
+
+/**
+ Levels of detail of a trip's path for drawing at every map zoom. Level 0 holds every fix; each
+ further level is Douglas-Peucker simplified from the one below, at tolerances growing four fold
+ from 2m (about two zoom levels apart). Levels are nested, so a fix kept at one level is kept at
+ all finer ones. Levels stop once they are small enough to draw at any zoom.
+
+ Pyramids are kept in a shared cache by trip so opening a trip again does not rebuild them.
+ */
+@interface TripPathPyramid : NSObject
+
+@property (nonatomic, readonly) NSUInteger levelCount;
+//! Fixes of the track the pyramid was built from
+@property (nonatomic, readonly) NSUInteger trackCount;
+
+//! Builds the pyramid, or returns the cached one for tripID if it was built from a track of the same length
++(instancetype)pyramidForTripID:(NSManagedObjectID *)tripID track:(TripTrack *)track;
++(instancetype)pyramidWithTrack:(TripTrack *)track;
+
+//! Track indexes kept at level, ascending
+-(const uint32_t *)indexesAtLevel:(NSUInteger)level;
+-(NSUInteger)countAtLevel:(NSUInteger)level;
+//! Meters the level's path may stray from the fixes. 0 for level 0
+-(double)toleranceAtLevel:(NSUInteger)level;
+//! The coarsest level whose tolerance is within metersPerPoint, i.e. whose simplification can't be seen
+-(NSUInteger)levelForMetersPerPoint:(double)metersPerPoint;
+
+@end
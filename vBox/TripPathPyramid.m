@@ -0,0 +1,113 @@
+//
+//  TripPathPyramid.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/18/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripPathPyramid.h"
+#import "TripTrack.h"
+
+#define PYRAMID_BASE_TOLERANCE 2.0 //meters at level 1
+#define PYRAMID_TOLERANCE_STEP 4.0 //two zoom levels per pyramid level
+#define PYRAMID_MAX_LEVELS 10
+#define PYRAMID_MIN_POINTS 256 //a level this small is cheap to draw at any zoom
+#define PYRAMID_CACHE_LIMIT 8 //trips
+
+@implementation TripPathPyramid{
+	uint32_t *indexes[PYRAMID_MAX_LEVELS];
+	NSUInteger counts[PYRAMID_MAX_LEVELS];
+	double tolerances[PYRAMID_MAX_LEVELS];
+}
+
++(NSCache *)sharedCache
+{
+	static NSCache *cache = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		cache = [[NSCache alloc] init];
+		[cache setCountLimit:PYRAMID_CACHE_LIMIT];
+	});
+	return cache;
+}
+
++(instancetype)pyramidForTripID:(NSManagedObjectID *)tripID track:(TripTrack *)track
+{
+	TripPathPyramid *pyramid = [[self sharedCache] objectForKey:tripID];
+	if(pyramid && pyramid.trackCount == track.count)
+		return pyramid;
+	pyramid = [self pyramidWithTrack:track];
+	[[self sharedCache] setObject:pyramid forKey:tripID];
+	return pyramid;
+}
+
++(instancetype)pyramidWithTrack:(TripTrack *)track
+{
+	TripPathPyramid *pyramid = [[self alloc] init];
+	pyramid->_trackCount = track.count;
+
+	NSIndexSet *levelIndexes = [NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, track.count)];
+	[pyramid addLevelWithIndexes:levelIndexes tolerance:0];
+	double tolerance = PYRAMID_BASE_TOLERANCE;
+	while(pyramid.levelCount < PYRAMID_MAX_LEVELS && levelIndexes.count > PYRAMID_MIN_POINTS)
+	{
+		//A tolerance that drops nothing adds no level; the next one is tried instead
+		NSIndexSet *coarser = [track indexesSimplifiedWithTolerance:tolerance withinIndexes:levelIndexes];
+		if(coarser.count < levelIndexes.count)
+		{
+			[pyramid addLevelWithIndexes:coarser tolerance:tolerance];
+			levelIndexes = coarser;
+		}
+		tolerance *= PYRAMID_TOLERANCE_STEP;
+	}
+	return pyramid;
+}
+
+-(void)dealloc
+{
+	for(NSUInteger level = 0; level < _levelCount; level++)
+		free(indexes[level]);
+}
+
+-(void)addLevelWithIndexes:(NSIndexSet *)levelIndexes tolerance:(double)tolerance
+{
+	NSUInteger level = _levelCount;
+	NSUInteger count = levelIndexes.count;
+	NSUInteger *all = malloc(MAX(count, 1) * sizeof(NSUInteger));
+	[levelIndexes getIndexes:all maxCount:count inIndexRange:nil];
+	indexes[level] = malloc(MAX(count, 1) * sizeof(uint32_t));
+	for(NSUInteger i = 0; i < count; i++)
+		indexes[level][i] = (uint32_t)all[i];
+	free(all);
+	counts[level] = count;
+	tolerances[level] = tolerance;
+	_levelCount++;
+}
+
+#pragma mark - Levels
+
+-(const uint32_t *)indexesAtLevel:(NSUInteger)level
+{
+	return indexes[level];
+}
+
+-(NSUInteger)countAtLevel:(NSUInteger)level
+{
+	return counts[level];
+}
+
+-(double)toleranceAtLevel:(NSUInteger)level
+{
+	return tolerances[level];
+}
+
+-(NSUInteger)levelForMetersPerPoint:(double)metersPerPoint
+{
+	NSUInteger level = 0;
+	while(level + 1 < _levelCount && [self toleranceAtLevel:level + 1] <= metersPerPoint)
+		level++;
+	return level;
+}
+
+@end
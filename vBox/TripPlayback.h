@@ -0,0 +1,61 @@
+//
+//  TripPlayback.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/19/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreLocation/CoreLocation.h>
+
+@class TripTrack;
+@class TripPlayback;
+
+#define TRIP_PLAYBACK_MIN_RATE 1.0
+#define TRIP_PLAYBACK_MAX_RATE 64.0
+
+//! Where the vehicle is at the playback time, between fix index and the next one
+typedef struct {
+	NSUInteger index;
+	double fraction; //0 at fix index, 1 at the next fix
+	CLLocationCoordinate2D coordinate;
+	CLLocationDirection heading;
+} TripPlaybackPosition;
+
+@protocol TripPlaybackDelegate <NSObject>
+
+//! Called once per frame while playing
+-(void)tripPlayback:(TripPlayback *)playback didMoveToPosition:(TripPlaybackPosition)position;
+-(void)tripPlaybackDidFinish:(TripPlayback *)playback;
+
+@end
+
+/**
+ Replays a trip in trip time, sped up by rate, on a display link clock. Every frame advances a
+ cursor through the track's timestamps from where the last frame left it, so a frame costs O(1)
+ at any rate short of skipping many fixes, and interpolates the position and heading between
+ the two fixes around the playback time. Headings are precomputed per fix (the course from the
+ fix before to the fix after) and turned through the shorter way between fixes.
+ */
+@interface TripPlayback : NSObject
+
+@property (nonatomic, weak) id<TripPlaybackDelegate> delegate;
+//! Trip seconds per second, TRIP_PLAYBACK_MIN_RATE to TRIP_PLAYBACK_MAX_RATE (1)
+@property (nonatomic) double rate;
+@property (nonatomic, readonly, getter=isPlaying) BOOL playing;
+
+//! Frame statistics since the playback was created
+@property (nonatomic, readonly) NSUInteger frameCount;
+@property (nonatomic, readonly) CFTimeInterval averageFrameDuration;
+@property (nonatomic, readonly) CFTimeInterval maximumFrameDuration;
+
+-(instancetype)initWithTrack:(TripTrack *)track;
+
+//! Starts at fix index, or at the first fix if index is the last one
+-(void)playFromIndex:(NSUInteger)index;
+-(void)pause;
+//! Invalidates the display link and reports frame statistics. Must be called before releasing the playback
+-(void)stop;
+
+@end
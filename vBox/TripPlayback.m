@@ -0,0 +1,157 @@
+//
+//  TripPlayback.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/19/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripPlayback.h"
+#import "TripTrack.h"
+#import "UtilityMethods.h"
+#import <QuartzCore/QuartzCore.h>
+
+#define MAX_FRAME_INTERVAL 0.25 //seconds; longer gaps, e.g. after the app was in the background, don't jump ahead
+
+static double HeadingBetween(double latitude1, double longitude1, double latitude2, double longitude2)
+{
+	double phi1 = latitude1 * M_PI / 180.0, phi2 = latitude2 * M_PI / 180.0;
+	double deltaLambda = (longitude2 - longitude1) * M_PI / 180.0;
+	double y = sin(deltaLambda) * cos(phi2);
+	double x = cos(phi1) * sin(phi2) - sin(phi1) * cos(phi2) * cos(deltaLambda);
+	double heading = atan2(y, x) * 180.0 / M_PI;
+	return heading < 0 ? heading + 360.0 : heading;
+}
+
+@implementation TripPlayback{
+	TripTrack *track;
+	float *headings;
+	CADisplayLink *displayLink;
+	NSUInteger cursor; //fix at or before the playback time
+	double playbackTime; //seconds since the reference date, like the track's timestamps
+	CFTimeInterval lastFrameTime;
+	CFTimeInterval totalFrameDuration;
+}
+
+-(instancetype)initWithTrack:(TripTrack *)aTrack
+{
+	self = [super init];
+	if(self)
+	{
+		track = aTrack;
+		_rate = TRIP_PLAYBACK_MIN_RATE;
+
+		NSUInteger count = track.count;
+		const double *latitudes = track.latitudes, *longitudes = track.longitudes;
+		headings = malloc(MAX(count, 1) * sizeof(float));
+		float heading = 0;
+		for(NSUInteger i = 0; i < count; i++)
+		{
+			NSUInteger before = i > 0 ? i - 1 : i, after = i + 1 < count ? i + 1 : i;
+			//Stopped fixes keep the heading they arrived with
+			if(latitudes[before] != latitudes[after] || longitudes[before] != longitudes[after])
+				heading = (float)HeadingBetween(latitudes[before], longitudes[before], latitudes[after], longitudes[after]);
+			headings[i] = heading;
+		}
+
+		displayLink = [CADisplayLink displayLinkWithTarget:self selector:@selector(displayLinkDidFire:)];
+		displayLink.paused = YES;
+		[displayLink addToRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	free(headings);
+}
+
+-(void)setRate:(double)rate
+{
+	_rate = MAX(TRIP_PLAYBACK_MIN_RATE, MIN(TRIP_PLAYBACK_MAX_RATE, rate));
+}
+
+-(BOOL)isPlaying
+{
+	return displayLink && !displayLink.paused;
+}
+
+-(void)playFromIndex:(NSUInteger)index
+{
+	if(!displayLink || track.count < 2)
+		return;
+	cursor = index + 1 < track.count ? index : 0;
+	playbackTime = track.timestamps[cursor];
+	lastFrameTime = 0;
+	displayLink.paused = NO;
+}
+
+-(void)pause
+{
+	displayLink.paused = YES;
+}
+
+-(void)stop
+{
+	[displayLink invalidate];
+	displayLink = nil;
+
+	if(self.frameCount > 0)
+	{
+		NSDictionary *dimensions = @{@"frames":[NSString stringWithFormat:@"%lu",(unsigned long)self.frameCount],
+									 @"maxFrameMs":[NSString stringWithFormat:@"%.2f",self.maximumFrameDuration * 1000.0],
+									 @"points":[NSString stringWithFormat:@"%lu",(unsigned long)track.count]};
+		[UtilityMethods trackPerformanceEvent:@"TripPlaybackFrame" duration:self.averageFrameDuration dimensions:dimensions];
+	}
+}
+
+-(CFTimeInterval)averageFrameDuration
+{
+	return self.frameCount > 0 ? totalFrameDuration / self.frameCount : 0;
+}
+
+#pragma mark - Display Link
+
+-(void)displayLinkDidFire:(CADisplayLink *)link
+{
+	CFTimeInterval frameStart = CACurrentMediaTime();
+	if(lastFrameTime > 0)
+		playbackTime += MIN(link.timestamp - lastFrameTime, MAX_FRAME_INTERVAL) * self.rate;
+	lastFrameTime = link.timestamp;
+
+	const double *timestamps = track.timestamps;
+	NSUInteger last = track.count - 1;
+	while(cursor < last - 1 && timestamps[cursor + 1] <= playbackTime)
+		cursor++;
+	BOOL finished = playbackTime >= timestamps[last];
+
+	TripPlaybackPosition position;
+	position.index = cursor;
+	if(finished)
+	{
+		position.fraction = 1;
+	}
+	else
+	{
+		double interval = timestamps[cursor + 1] - timestamps[cursor];
+		position.fraction = interval > 0 ? MAX(0, MIN(1, (playbackTime - timestamps[cursor]) / interval)) : 0;
+	}
+	double fraction = position.fraction;
+	position.coordinate.latitude = track.latitudes[cursor] + (track.latitudes[cursor + 1] - track.latitudes[cursor]) * fraction;
+	position.coordinate.longitude = track.longitudes[cursor] + (track.longitudes[cursor + 1] - track.longitudes[cursor]) * fraction;
+	double turn = fmod(headings[cursor + 1] - headings[cursor] + 540.0, 360.0) - 180.0; //shorter way, -180 to 180
+	position.heading = fmod(headings[cursor] + turn * fraction + 360.0, 360.0);
+
+	if(finished)
+		link.paused = YES;
+	[self.delegate tripPlayback:self didMoveToPosition:position];
+	if(finished)
+		[self.delegate tripPlaybackDidFinish:self];
+
+	CFTimeInterval frameDuration = CACurrentMediaTime() - frameStart;
+	totalFrameDuration += frameDuration;
+	_maximumFrameDuration = MAX(_maximumFrameDuration, frameDuration);
+	_frameCount++;
+}
+
+@end
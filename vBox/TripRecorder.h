@@ -0,0 +1,67 @@
+//
+//  TripRecorder.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/20/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreLocation/CoreLocation.h>
+#import <GoogleMaps/GoogleMaps.h>
+#import "BLEManager.h"
+#import "Trip.h"
+#import "TripJournal.h"
+#import "TripSegmenter.h"
+
+@class TripRecorder;
+
+//! Bluetooth callbacks are forwarded unchanged from the recorder's BLEManager
+@protocol TripRecorderDelegate <BLEManagerDelegate>
+@optional
+
+//! Called once per location batch with the newest fix, whether or not it was accurate enough to be recorded
+-(void)tripRecorder:(TripRecorder *)recorder didUpdateLocation:(CLLocation *)location;
+-(void)tripRecorderDidStopRecording:(TripRecorder *)recorder;
+
+@end
+
+/**
+ Owns everything needed to record a drive: location updates, the OBD/BLE connection and
+ persistence of the current Trip. It keeps running with no view attached, so the map
+ screen only subscribes as the delegate while it is on screen.
+ 
+ Fixes and OBD samples are appended to a TripJournal as they arrive; the Trip is only
+ saved from the journal, by TripFinalizer in the background, once recording stops.
+ 
+ While recording, a TripSegmenter closes the current trip after a long enough stop and
+ opens a new one when the vehicle moves again, so one recording can produce several trips.
+ Stats, path and distance always describe the current trip.
+ */
+@interface TripRecorder : NSObject <CLLocationManagerDelegate, BLEManagerDelegate>
+
+@property (nonatomic, weak) id <TripRecorderDelegate> delegate;
+@property (nonatomic, readonly) BOOL recording;
+@property (nonatomic, strong, readonly) NSDate *startTime;
+//! nil between trips
+@property (nonatomic, strong, readonly) TripJournal *journal;
+@property (nonatomic, strong, readonly) TripSegmenter *segmenter;
+@property (nonatomic, strong, readonly) GMSMutablePath *path;
+@property (nonatomic, strong, readonly) CLLocation *lastLocation;
+@property (nonatomic, readonly) CLLocationDistance distance;
+@property (nonatomic, readonly) double maxSpeed;
+@property (nonatomic, readonly) double minSpeed;
+@property (nonatomic, readonly) double avgSpeed;
+@property (nonatomic, strong, readonly) CLLocationManager *locationManager;
+@property (nonatomic, strong, readonly) BLEManager *bluetoothManager;
+@property (nonatomic, strong, readonly) NSMutableDictionary *bluetoothDiagnostics;
+
++(instancetype)sharedRecorder;
+
+-(void)startRecording;
+-(void)stopRecording;
+
+-(void)startBluetooth;
+-(void)stopBluetooth;
+
+@end
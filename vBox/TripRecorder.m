@@ -0,0 +1,350 @@
+//
+//  TripRecorder.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/20/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripRecorder.h"
+#import <UIKit/UIKit.h>
+#import "UtilityMethods.h"
+#import "TripFinalizer.h"
+#import <Parse/Parse.h>
+
+@implementation TripRecorder{
+	double sumSpeed;
+	unsigned long recordedCount;
+	CLLocation *lastStoppedLocation; //latest fix since the vehicle stopped, recorded if it moves on before the trip ends
+}
+
+#pragma mark - Initialization
+
++(instancetype)sharedRecorder
+{
+	static TripRecorder *sharedRecorder = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedRecorder = [[self alloc] init];
+	});
+	return sharedRecorder;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		_recording = NO;
+		_bluetoothDiagnostics = [NSMutableDictionary dictionary];
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationDidEnterBackground:) name:UIApplicationDidEnterBackgroundNotification object:nil];
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+-(void)applicationDidEnterBackground:(NSNotification *)notification
+{
+	[self.journal synchronize];
+}
+
+#pragma mark - Recording
+
+-(void)startRecording
+{
+	if(self.recording)
+		return;
+
+	_recording = YES;
+	_lastLocation = nil;
+	_segmenter = [[TripSegmenter alloc] init];
+	[self beginTripWithStartTime:[NSDate date]];
+
+	[self setUpLocationManager];
+}
+
+-(void)stopRecording
+{
+	if(!self.recording)
+		return;
+
+	_recording = NO;
+	[self recordStoppedLocations]; //the trip ends now, so its stop is part of it
+	[_locationManager stopUpdatingLocation];
+	_locationManager.delegate = nil;
+	_locationManager = nil;
+
+	[self stopBluetooth];
+	[self finishTripWithEndTime:[NSDate date]];
+
+	if([self.delegate respondsToSelector:@selector(tripRecorderDidStopRecording:)])
+		[self.delegate tripRecorderDidStopRecording:self];
+}
+
+-(void)beginTripWithStartTime:(NSDate *)startTime
+{
+	_startTime = startTime;
+	_journal = [TripJournal journalWithStartTime:_startTime];
+	//A split keeps the adapter connected, so the new trip starts from the values already known
+	if(self.bluetoothManager.connected && self.bluetoothDiagnostics.count > 0)
+		[_journal appendDiagnostics:self.bluetoothDiagnostics atDate:startTime];
+	lastStoppedLocation = nil;
+
+	_path = [GMSMutablePath path];
+	_distance = 0;
+	_maxSpeed = 0;
+	_minSpeed = DBL_MAX;
+	sumSpeed = 0;
+	recordedCount = 0;
+}
+
+-(void)finishTripWithEndTime:(NSDate *)endTime
+{
+	if(!self.journal)
+		return;
+
+	//Nothing to save if no locations were recorded
+	if(recordedCount == 0)
+	{
+		[_journal discard];
+	}
+	else
+	{
+		[_journal close];
+		[[TripFinalizer sharedFinalizer] finalizeJournalAtURL:_journal.URL endTime:endTime];
+		[self reverseGeocodeAndTrackInBackground:self.lastLocation];
+	}
+	_journal = nil;
+	lastStoppedLocation = nil; //the stop that ended the trip
+}
+
+-(double)avgSpeed
+{
+	return recordedCount > 0 ? sumSpeed / recordedCount : 0;
+}
+
+#pragma mark - SetUp Methods
+
+-(void)setUpLocationManager
+{
+	_locationManager = [[CLLocationManager alloc] init];
+
+	[_locationManager setDelegate:self];
+	_locationManager.distanceFilter = kCLDistanceFilterNone; //Best Accuracy
+	_locationManager.desiredAccuracy = kCLLocationAccuracyBestForNavigation;
+	_locationManager.activityType = CLActivityTypeAutomotiveNavigation;
+	_locationManager.pausesLocationUpdatesAutomatically = YES;//help save battery life when user is stopped
+	_locationManager.allowsBackgroundLocationUpdates = YES; //keep recording with the screen locked
+
+	[_locationManager requestWhenInUseAuthorization];
+	[_locationManager requestAlwaysAuthorization];
+	[_locationManager startUpdatingLocation];
+}
+
+#pragma mark - Bluetooth
+
+-(void)startBluetooth
+{
+	if(self.bluetoothManager)
+		return;
+	_bluetoothManager = [[BLEManager alloc] init];
+	_bluetoothManager.delegate = self;
+}
+
+-(void)stopBluetooth
+{
+	if(!self.bluetoothManager)
+		return;
+
+	if(self.bluetoothManager.connected)
+	{
+		[self.bluetoothManager disconnect];
+	}
+
+	[self.bluetoothManager stopScanning];
+	[self.bluetoothManager stopAdvertisingPeripheral];
+	_bluetoothManager.delegate = nil;
+	_bluetoothManager = nil;
+	[self.bluetoothDiagnostics removeAllObjects];
+	[self.journal appendDiagnosticsReset];
+}
+
+#pragma mark - CLLocation Delegate
+
+-(void)locationManager:(CLLocationManager *)manager didUpdateLocations:(NSArray *)locations
+{
+	for(CLLocation *location in locations)
+	{
+		if(location.horizontalAccuracy > 30)
+			continue;
+
+		double speedMPH = location.speed >= 0 ? location.speed * 2.236936284 : 0;
+
+		switch([self.segmenter updateWithLocation:location speed:speedMPH rpm:[self currentRPM]])
+		{
+			case TripSegmenterEventTripEnded:
+				[self finishTripWithEndTime:self.segmenter.stopDate];
+				break;
+			case TripSegmenterEventTripSplit:
+				[self finishTripWithEndTime:self.segmenter.stopDate];
+				[self beginTripWithStartTime:location.timestamp];
+				break;
+			case TripSegmenterEventTripStarted:
+				[self beginTripWithStartTime:location.timestamp];
+				break;
+			case TripSegmenterEventStopped:
+				[self recordLocation:location speed:speedMPH]; //keep where we stopped
+				continue;
+			case TripSegmenterEventResumed:
+				[self recordLastStoppedLocation];
+				break;
+			default:
+				break;
+		}
+
+		if(self.segmenter.state == TripSegmenterStateMoving)
+			[self recordLocation:location speed:speedMPH];
+		else if(self.segmenter.state == TripSegmenterStateStopped)
+			lastStoppedLocation = location; //held back until we know whether the trip goes on
+	}
+
+	_lastLocation = locations.lastObject;
+
+	if([self.delegate respondsToSelector:@selector(tripRecorder:didUpdateLocation:)])
+		[self.delegate tripRecorder:self didUpdateLocation:_lastLocation];
+}
+
+-(void)recordLocation:(CLLocation *)location speed:(double)speedMPH
+{
+	if(speedMPH < _minSpeed)
+	{
+		_minSpeed = speedMPH;
+	}
+	if(speedMPH > _maxSpeed)
+	{
+		_maxSpeed = speedMPH;
+	}
+	sumSpeed += speedMPH;
+
+	CLLocationCoordinate2D lastCoordinate = _path.count > 0 ? [_path coordinateAtIndex:_path.count-1] : location.coordinate;
+	_distance += GMSGeometryDistance(lastCoordinate, location.coordinate);
+	[_path addCoordinate:location.coordinate];
+
+	[self.journal appendLocation:location bluetoothConnected:self.bluetoothManager.connected];
+	recordedCount++;
+}
+
+//The fixes in between sat inside the stop radius, so the first (recorded on stopping) and the last describe the stop
+-(void)recordLastStoppedLocation
+{
+	if(!lastStoppedLocation)
+		return;
+	[self recordLocation:lastStoppedLocation speed:lastStoppedLocation.speed >= 0 ? lastStoppedLocation.speed * 2.236936284 : 0];
+	lastStoppedLocation = nil;
+}
+
+//! @return -1 when there is no OBD connection to read RPM from
+-(double)currentRPM
+{
+	NSNumber *rpm = self.bluetoothDiagnostics[@"RPM"];
+	return (self.bluetoothManager.connected && rpm) ? rpm.doubleValue : -1;
+}
+
+-(void)locationManager:(CLLocationManager *)manager didFailWithError:(NSError *)error
+{
+	if([error domain] == kCLErrorDomain)
+	{
+		return; //sometimes I get this error // fix later?
+	}
+	UIAlertView *errorAlert = [[UIAlertView alloc]initWithTitle:[error localizedDescription] message:@"There was an error retrieving your location" delegate:nil cancelButtonTitle:@"OK" otherButtonTitles: nil];
+	[errorAlert show];
+}
+
+#pragma mark - BLEManager Delegate
+
+-(void)didChangeBluetoothState:(BLEState)state
+{
+	if(state == BLEStateOn)
+	{
+		if([[NSUserDefaults standardUserDefaults] boolForKey:@"connectToOBD"])
+		{
+			[self.bluetoothManager scanForPeripheralType:PeripheralTypeOBDAdapter];
+		}
+		else
+		{
+			[self.bluetoothManager scanForPeripheralType:PeripheralTypeBeagleBone];
+		}
+	}
+	[self.delegate didChangeBluetoothState:state];
+}
+
+-(void)didUpdateDiagnosticForKey:(NSString *)key withValue:(NSNumber *)value
+{
+	self.bluetoothDiagnostics[key] = value;
+	[self.journal appendDiagnosticForKey:key withValue:value];
+	[self.delegate didUpdateDiagnosticForKey:key withValue:value];
+}
+
+-(void)didBeginScanningForPeripheral
+{
+	if([self.delegate respondsToSelector:@selector(didBeginScanningForPeripheral)])
+		[self.delegate didBeginScanningForPeripheral];
+}
+
+-(void)didConnectPeripheral
+{
+	if([self.delegate respondsToSelector:@selector(didConnectPeripheral)])
+		[self.delegate didConnectPeripheral];
+}
+
+-(void)didDisconnectPeripheral
+{
+	if([self.delegate respondsToSelector:@selector(didDisconnectPeripheral)])
+		[self.delegate didDisconnectPeripheral];
+}
+
+-(void)didStopScanning
+{
+	if([self.delegate respondsToSelector:@selector(didStopScanning)])
+		[self.delegate didStopScanning];
+}
+
+#pragma mark - Helper Methods
+
+-(void)reverseGeocodeAndTrackInBackground:(CLLocation *)location
+{
+	NSString *startTime = [UtilityMethods formattedStringFromDate:self.startTime];
+	NSString *maxSpeed = [NSString stringWithFormat:@"%@ mph",@(self.maxSpeed)];
+	NSString *avgSpeed = [NSString stringWithFormat:@"%@ mph",@(self.avgSpeed)];
+	NSString *miles = [NSString stringWithFormat:@"%@ mi",@(self.distance * 0.000621371)];
+
+	CLGeocoder *geoCoder = [[CLGeocoder alloc] init];
+	[geoCoder reverseGeocodeLocation:location completionHandler:^(NSArray *placemarks, NSError *error) {
+		if(error)
+		{
+			[PFAnalytics trackEventInBackground:@"ReverseGeoCodeError" dimensions:@{@"error":error.description} block:nil];
+		}
+		else
+		{
+			CLPlacemark *placemark = placemarks.lastObject;
+			NSMutableDictionary *dimensions = [[NSMutableDictionary alloc] init];
+
+			dimensions[@"City"] = (NSString *) placemark.addressDictionary[@"City"];
+			dimensions[@"State"] = (NSString *) placemark.addressDictionary[@"State"];
+			dimensions[@"Country"] = (NSString *) placemark.addressDictionary[@"CountryCode"];
+			dimensions[@"Street"] = (NSString *) placemark.addressDictionary[@"Street"];
+			dimensions[@"StartTime"] = startTime;
+			dimensions[@"MaxSpeed"] = maxSpeed;
+			dimensions[@"AvgSpeed"] = avgSpeed;
+			dimensions[@"Miles"] = miles;
+
+			[PFAnalytics trackEventInBackground:@"TripEndDetail" dimensions:dimensions block:nil];
+		}
+	}];
+}
+
+@end
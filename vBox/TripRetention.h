@@ -0,0 +1,36 @@
+//
+//  TripRetention.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/13/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(int16_t, TripRetentionTier) {
+	TripRetentionTierFull = 0, //every fix
+	TripRetentionTierSimplified, //Douglas-Peucker at RetentionToleranceMeters
+	TripRetentionTierSummary //first and last fix only, enough to place the trip on a map
+};
+
+//! NSUserDefaults keys of the tiers. A day count of 0 turns its tier off
+extern NSString * const TripRetentionFullResolutionDaysKey; //default 30
+extern NSString * const TripRetentionSimplifiedDaysKey; //default 365
+extern NSString * const TripRetentionToleranceMetersKey; //default 5
+
+/**
+ Shrinks the tracks of old trips in place. Trip summary fields (distance, speeds, times, fuel)
+ and rollups are left untouched; only trackData, pointCount and the spatial index rows change.
+ */
+@interface TripRetention : NSObject
+
++(instancetype)sharedRetention;
+
+/**
+ Moves every trip that has aged past a tier into it, a few trips per save on a background
+ priority queue. Reclaimed track bytes are reported as RetentionPass.
+ */
+-(void)applyRetentionInBackground;
+
+@end
@@ -0,0 +1,186 @@
+//
+//  TripRetention.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/13/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripRetention.h"
+#import <QuartzCore/QuartzCore.h>
+#import "AppDelegate.h"
+#import "Trip.h"
+#import "TripTrack.h"
+#import "TripSpatialIndex.h"
+#import "UtilityMethods.h"
+
+#define RETENTION_BATCH_SIZE 10 //trips decoded and re-encoded per save
+
+NSString * const TripRetentionFullResolutionDaysKey = @"RetentionFullResolutionDays";
+NSString * const TripRetentionSimplifiedDaysKey = @"RetentionSimplifiedDays";
+NSString * const TripRetentionToleranceMetersKey = @"RetentionToleranceMeters";
+
+@implementation TripRetention{
+	AppDelegate *appDelegate;
+	NSManagedObjectContext *context;
+	BOOL running;
+	NSUInteger tripCount;
+	long long bytesReclaimed;
+	CFTimeInterval startTime;
+}
+
++(instancetype)sharedRetention
+{
+	static TripRetention *sharedRetention = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		[[NSUserDefaults standardUserDefaults] registerDefaults:@{TripRetentionFullResolutionDaysKey:@30,
+																  TripRetentionSimplifiedDaysKey:@365,
+																  TripRetentionToleranceMetersKey:@5}];
+		sharedRetention = [[self alloc] init];
+	});
+	return sharedRetention;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		appDelegate = [[UIApplication sharedApplication] delegate];
+		context = [appDelegate newBackgroundContext];
+	}
+	return self;
+}
+
+-(void)applyRetentionInBackground
+{
+	[context performBlock:^{
+		if(running)
+			return;
+		running = YES;
+		tripCount = 0;
+		bytesReclaimed = 0;
+		startTime = CACurrentMediaTime();
+		[self scheduleNextBatch];
+	}];
+}
+
+//Each batch is run from a background priority queue, so the work inherits its low priority
+-(void)scheduleNextBatch
+{
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+		__block BOOL more = NO;
+		[context performBlockAndWait:^{
+			more = [self applyNextBatch];
+			if(!more)
+				[self finish];
+		}];
+		if(more)
+			[self scheduleNextBatch];
+	});
+}
+
+//Runs on the context queue
+-(void)finish
+{
+	running = NO;
+	if(tripCount == 0)
+		return;
+	NSDictionary *dimensions = @{@"trips":[NSString stringWithFormat:@"%lu",(unsigned long)tripCount],
+								 @"bytesReclaimed":[NSString stringWithFormat:@"%lld",bytesReclaimed]};
+	[UtilityMethods trackPerformanceEvent:@"RetentionPass" duration:CACurrentMediaTime() - startTime dimensions:dimensions];
+}
+
+#pragma mark - Batches
+
+//Runs on the context queue. @return NO when no trip is left to process or a save failed
+-(BOOL)applyNextBatch
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	NSInteger fullDays = [defaults integerForKey:TripRetentionFullResolutionDaysKey];
+	NSInteger simplifiedDays = [defaults integerForKey:TripRetentionSimplifiedDaysKey];
+	double tolerance = [defaults doubleForKey:TripRetentionToleranceMetersKey];
+
+	//Oldest tier first, so a trip past both cutoffs goes straight to its summary
+	NSArray *trips = simplifiedDays > 0 ? [self tripsOlderThanDays:simplifiedDays belowTier:TripRetentionTierSummary] : nil;
+	TripRetentionTier tier = TripRetentionTierSummary;
+	if(trips.count == 0 && fullDays > 0 && tolerance > 0)
+	{
+		trips = [self tripsOlderThanDays:fullDays belowTier:TripRetentionTierSimplified];
+		tier = TripRetentionTierSimplified;
+	}
+	if(trips.count == 0)
+		return NO;
+
+	long long reclaimed = 0;
+	for(Trip *trip in trips)
+	{
+		reclaimed += [self reduceTrip:trip toTier:tier tolerance:tolerance];
+	}
+
+	NSError *error = nil;
+	BOOL saved = [appDelegate saveBackgroundContext:context error:&error];
+	if(saved)
+	{
+		tripCount += trips.count;
+		bytesReclaimed += reclaimed;
+	}
+	else
+	{
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+		[context rollback];
+	}
+	[context reset];
+	return saved;
+}
+
+-(NSArray *)tripsOlderThanDays:(NSInteger)days belowTier:(TripRetentionTier)tier
+{
+	NSDate *cutoff = [NSDate dateWithTimeIntervalSinceNow:-days * 24 * 60 * 60];
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+	//Legacy trips are left until TripMigrator has packed them
+	[request setPredicate:[NSPredicate predicateWithFormat:@"startTime < %@ AND retentionTier < %d AND trackData != nil",cutoff,tier]];
+	[request setSortDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"startTime" ascending:YES]]];
+	[request setFetchLimit:RETENTION_BATCH_SIZE];
+
+	NSError *error = nil;
+	NSArray *trips = [context executeFetchRequest:request error:&error];
+	if(!trips)
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+	return trips;
+}
+
+//@return the number of track bytes freed
+-(long long)reduceTrip:(Trip *)trip toTier:(TripRetentionTier)tier tolerance:(double)tolerance
+{
+	[trip setRetentionTier:@(tier)];
+	TripTrack *track = [trip track];
+	if(!track || track.count < 3)
+		return 0;
+
+	NSIndexSet *indexes = nil;
+	if(tier == TripRetentionTierSummary)
+	{
+		NSMutableIndexSet *ends = [NSMutableIndexSet indexSetWithIndex:0];
+		[ends addIndex:track.count - 1];
+		indexes = ends;
+	}
+	else
+	{
+		indexes = [track indexesSimplifiedWithTolerance:tolerance];
+	}
+	if(indexes.count == track.count)
+		return 0;
+
+	TripTrack *reduced = [track trackWithIndexes:indexes];
+	NSData *data = [reduced dataRepresentation];
+	long long reclaimed = (long long)trip.trackData.length - (long long)data.length;
+	[trip setTrackData:data];
+	[trip setPointCount:@(reduced.count)];
+	[trip updateSpansWithTrack:reduced];
+	[TripSpatialIndex reindexTrip:trip track:reduced];
+	return reclaimed;
+}
+
+@end
@@ -0,0 +1,61 @@
+//
+//  TripRollup.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/12/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class Trip;
+
+typedef NS_ENUM(int16_t, TripRollupPeriod) {
+	TripRollupPeriodDay = 0, //periodKey yyyymmdd, same as Trip.dayKey
+	TripRollupPeriodWeek, //periodKey yyyyww, ISO week numbering
+	TripRollupPeriodMonth, //periodKey yyyymm
+	TripRollupPeriodLifetime, //periodKey 0
+	TripRollupPeriodCount
+};
+
+/**
+ Running totals of the trips in a day, week, month or of every trip. Rollups are updated in the
+ same save that inserts or deletes a trip, so reading one is a single indexed fetch.
+
+ A save from a child context overwrites whatever the writer holds, so two contexts updating the
+ same rollup would lose one of the updates. Every trip insert, trip delete and rebuild therefore
+ runs on updateContext, one block at a time.
+ */
+@interface TripRollup : NSManagedObject
+
+@property (nonatomic, retain) NSNumber * period;
+@property (nonatomic, retain) NSNumber * periodKey;
+@property (nonatomic, retain) NSNumber * tripCount;
+@property (nonatomic, retain) NSNumber * totalMiles;
+//! Seconds
+@property (nonatomic, retain) NSNumber * driveTime;
+@property (nonatomic, retain) NSNumber * maxSpeed;
+//! % of the tank, summed over the trips with OBD fuel data
+@property (nonatomic, retain) NSNumber * fuelUsed;
+
+//! Miles per hour of drive time
+-(double)averageSpeed;
+
++(int32_t)keyForPeriod:(TripRollupPeriod)period date:(NSDate *)date timeZone:(NSTimeZone *)timeZone;
+//! The period a trip counts toward, in the time zone it was recorded in
++(int32_t)keyForPeriod:(TripRollupPeriod)period trip:(Trip *)trip;
+//! @return nil if no trip falls in the period
++(TripRollup *)rollupForPeriod:(TripRollupPeriod)period key:(int32_t)key inContext:(NSManagedObjectContext *)context;
+
+//! The private queue context every change to trips or rollups goes through
++(NSManagedObjectContext *)updateContext;
+
+//! Adds a trip inserted in updateContext to its rollups. Call on its queue, before the save that inserts the trip
++(void)addTrip:(Trip *)trip;
+//! Takes trips in updateContext out of their rollups. Call on its queue, before deleting them
++(void)removeTrips:(NSArray *)trips;
+//! Deletes every rollup and rebuilds them from the saved trips. Call on updateContext's queue, then save
++(BOOL)rebuildRollupsInContext:(NSManagedObjectContext *)context error:(NSError **)error;
+
+@end
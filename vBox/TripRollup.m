@@ -0,0 +1,269 @@
+//
+//  TripRollup.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/12/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripRollup.h"
+#import "Trip.h"
+#import "AppDelegate.h"
+
+#define REBUILD_BATCH_SIZE 200
+#define UTC_OFFSET_SPREAD (26 * 3600) //seconds between the furthest apart zones, UTC-12 and UTC+14
+
+@implementation TripRollup
+
+@dynamic period;
+@dynamic periodKey;
+@dynamic tripCount;
+@dynamic totalMiles;
+@dynamic driveTime;
+@dynamic maxSpeed;
+@dynamic fuelUsed;
+
+-(double)averageSpeed
+{
+	double hours = self.driveTime.doubleValue / 3600;
+	return hours > 0 ? self.totalMiles.doubleValue / hours : 0;
+}
+
+#pragma mark - Periods
+
+//Weeks start on Monday, as in ISO 8601
++(NSCalendar *)calendar
+{
+	static NSCalendar *calendar = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		calendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSCalendarIdentifierGregorian];
+		[calendar setFirstWeekday:2];
+		[calendar setMinimumDaysInFirstWeek:4];
+	});
+	return calendar;
+}
+
++(int32_t)keyForPeriod:(TripRollupPeriod)period date:(NSDate *)date timeZone:(NSTimeZone *)timeZone
+{
+	if(period == TripRollupPeriodDay)
+		return [Trip dayKeyForDate:date timeZone:timeZone];
+	if(period == TripRollupPeriodLifetime)
+		return 0;
+
+	NSCalendar *calendar = [self calendar];
+	@synchronized(calendar)
+	{
+		[calendar setTimeZone:timeZone];
+		if(period == TripRollupPeriodWeek)
+		{
+			NSDateComponents *components = [calendar components:NSCalendarUnitYearForWeekOfYear | NSCalendarUnitWeekOfYear fromDate:date];
+			return (int32_t)(components.yearForWeekOfYear * 100 + components.weekOfYear);
+		}
+		NSDateComponents *components = [calendar components:NSCalendarUnitYear | NSCalendarUnitMonth fromDate:date];
+		return (int32_t)(components.year * 100 + components.month);
+	}
+}
+
++(int32_t)keyForPeriod:(TripRollupPeriod)period trip:(Trip *)trip
+{
+	if(period == TripRollupPeriodDay && trip.dayKey.intValue != 0)
+		return trip.dayKey.intValue;
+	return [self keyForPeriod:period date:trip.startTime timeZone:trip.timeZone];
+}
+
+#pragma mark - Updates
+
++(NSManagedObjectContext *)updateContext
+{
+	static NSManagedObjectContext *updateContext = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		updateContext = [(AppDelegate *)[[UIApplication sharedApplication] delegate] newBackgroundContext];
+	});
+	return updateContext;
+}
+
+#pragma mark - Lookup
+
++(TripRollup *)rollupForPeriod:(TripRollupPeriod)period key:(int32_t)key inContext:(NSManagedObjectContext *)context
+{
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"TripRollup"];
+	[request setPredicate:[NSPredicate predicateWithFormat:@"periodKey == %d AND period == %d",key,period]];
+	[request setFetchLimit:1];
+
+	NSError *error = nil;
+	NSArray *rollups = [context executeFetchRequest:request error:&error];
+	if(!rollups)
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+	return rollups.firstObject;
+}
+
+//cache maps "period:key" to rollups already looked up. It is only passed by a rebuild, which has deleted every stored rollup, so the store is not searched
++(TripRollup *)rollupForPeriod:(TripRollupPeriod)period key:(int32_t)key inContext:(NSManagedObjectContext *)context cache:(NSMutableDictionary *)cache create:(BOOL)create
+{
+	NSString *cacheKey = [NSString stringWithFormat:@"%d:%d",period,key];
+	TripRollup *rollup = cache[cacheKey];
+	if(!rollup && !cache)
+		rollup = [self rollupForPeriod:period key:key inContext:context];
+	if(!rollup && create)
+	{
+		rollup = [NSEntityDescription insertNewObjectForEntityForName:@"TripRollup" inManagedObjectContext:context];
+		[rollup setPeriod:@(period)];
+		[rollup setPeriodKey:@(key)];
+	}
+	if(rollup)
+		cache[cacheKey] = rollup;
+	return rollup;
+}
+
+#pragma mark - Updating
+
+-(void)addTotalsOfTrip:(Trip *)trip sign:(double)sign
+{
+	double driveTime = trip.endTime ? MAX(0, [trip.endTime timeIntervalSinceDate:trip.startTime]) : 0;
+	//Clamped so repeated float subtraction never leaves a slightly negative total
+	[self setTripCount:@(self.tripCount.intValue + (int)sign)];
+	[self setTotalMiles:@(MAX(0, self.totalMiles.doubleValue + sign * trip.totalMiles.doubleValue))];
+	[self setDriveTime:@(MAX(0, self.driveTime.doubleValue + sign * driveTime))];
+	[self setFuelUsed:@(MAX(0, self.fuelUsed.doubleValue + sign * trip.fuelUsed.doubleValue))];
+	if(sign > 0)
+		[self setMaxSpeed:@(MAX(self.maxSpeed.doubleValue, trip.maxSpeed.doubleValue))];
+}
+
++(void)addTrip:(Trip *)trip
+{
+	NSAssert(trip.managedObjectContext == [self updateContext], @"Rollups are only changed on updateContext");
+	[self addTrip:trip cache:nil];
+}
+
++(void)addTrip:(Trip *)trip cache:(NSMutableDictionary *)cache
+{
+	for(TripRollupPeriod period = 0; period < TripRollupPeriodCount; period++)
+	{
+		int32_t key = [self keyForPeriod:period trip:trip];
+		TripRollup *rollup = [self rollupForPeriod:period key:key inContext:trip.managedObjectContext cache:cache create:YES];
+		[rollup addTotalsOfTrip:trip sign:1];
+	}
+}
+
++(void)removeTrips:(NSArray *)trips
+{
+	if(trips.count == 0)
+		return;
+	NSManagedObjectContext *context = [trips.firstObject managedObjectContext];
+	NSAssert(context == [self updateContext], @"Rollups are only changed on updateContext");
+
+	//A max can't be subtracted; rollups whose max came from a removed trip are recomputed below
+	NSMutableDictionary *staleMaxTrips = [NSMutableDictionary dictionary];
+	for(Trip *trip in trips)
+	{
+		for(TripRollupPeriod period = 0; period < TripRollupPeriodCount; period++)
+		{
+			int32_t key = [self keyForPeriod:period trip:trip];
+			TripRollup *rollup = [self rollupForPeriod:period key:key inContext:context];
+			if(!rollup)
+				continue;
+
+			[rollup addTotalsOfTrip:trip sign:-1];
+			if(rollup.tripCount.intValue <= 0)
+				[context deleteObject:rollup];
+			else if(trip.maxSpeed.doubleValue >= rollup.maxSpeed.doubleValue)
+				staleMaxTrips[rollup.objectID] = trip;
+		}
+	}
+
+	[staleMaxTrips enumerateKeysAndObjectsUsingBlock:^(NSManagedObjectID *rollupID, Trip *trip, BOOL *stop) {
+		TripRollup *rollup = (TripRollup *)[context objectWithID:rollupID];
+		if(rollup.isDeleted)
+			return;
+		[rollup setMaxSpeed:@([self maxSpeedInPeriod:rollup.period.shortValue key:rollup.periodKey.intValue nearTrip:trip excludingTrips:trips])];
+	}];
+}
+
+//Max speed of the trips left in a period that trip was in
++(double)maxSpeedInPeriod:(TripRollupPeriod)period key:(int32_t)key nearTrip:(Trip *)trip excludingTrips:(NSArray *)trips
+{
+	NSManagedObjectContext *context = trip.managedObjectContext;
+	NSPredicate *remaining = [NSPredicate predicateWithFormat:@"NOT (self IN %@)",trips];
+	if(period == TripRollupPeriodLifetime)
+		return [self maxSpeedOfTripsMatching:remaining inContext:context];
+	if(period == TripRollupPeriodDay)
+		return [self maxSpeedOfTripsMatching:[NSCompoundPredicate andPredicateWithSubpredicates:@[remaining,[NSPredicate predicateWithFormat:@"dayKey == %d",key]]] inContext:context];
+
+	//Week and month keys depend on each trip's own zone, which a predicate can't apply. The period's trips all start within
+	//UTC_OFFSET_SPREAD of its bounds in trip's zone, so those are fetched and keyed one by one
+	NSCalendarUnit unit = period == TripRollupPeriodWeek ? NSCalendarUnitWeekOfYear : NSCalendarUnitMonth;
+	NSDate *start = nil;
+	NSTimeInterval interval = 0;
+	NSCalendar *calendar = [self calendar];
+	@synchronized(calendar)
+	{
+		[calendar setTimeZone:trip.timeZone];
+		[calendar rangeOfUnit:unit startDate:&start interval:&interval forDate:trip.startTime];
+	}
+	NSPredicate *nearby = [NSPredicate predicateWithFormat:@"startTime >= %@ AND startTime < %@",[start dateByAddingTimeInterval:-UTC_OFFSET_SPREAD],[start dateByAddingTimeInterval:interval + UTC_OFFSET_SPREAD]];
+
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+	[request setPredicate:[NSCompoundPredicate andPredicateWithSubpredicates:@[remaining,nearby]]];
+	[request setPropertiesToFetch:@[@"startTime",@"dayKey",@"timeZoneName",@"maxSpeed"]];
+
+	NSError *error = nil;
+	NSArray *candidates = [context executeFetchRequest:request error:&error];
+	if(!candidates)
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+	double maxSpeed = 0;
+	for(Trip *candidate in candidates)
+	{
+		if([self keyForPeriod:period trip:candidate] == key)
+			maxSpeed = MAX(maxSpeed, candidate.maxSpeed.doubleValue);
+	}
+	return maxSpeed;
+}
+
++(double)maxSpeedOfTripsMatching:(NSPredicate *)predicate inContext:(NSManagedObjectContext *)context
+{
+	NSExpressionDescription *maxDescription = [[NSExpressionDescription alloc] init];
+	[maxDescription setName:@"maxSpeed"];
+	[maxDescription setExpression:[NSExpression expressionForFunction:@"max:" arguments:@[[NSExpression expressionForKeyPath:@"maxSpeed"]]]];
+	[maxDescription setExpressionResultType:NSDoubleAttributeType];
+
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+	[request setPredicate:predicate];
+	[request setResultType:NSDictionaryResultType];
+	[request setPropertiesToFetch:@[maxDescription]];
+
+	NSError *error = nil;
+	NSArray *results = [context executeFetchRequest:request error:&error];
+	if(!results)
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+	return [[results.firstObject objectForKey:@"maxSpeed"] doubleValue];
+}
+
++(BOOL)rebuildRollupsInContext:(NSManagedObjectContext *)context error:(NSError **)error
+{
+	NSAssert(context == [self updateContext], @"Rollups are only changed on updateContext");
+	NSArray *rollups = [context executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"TripRollup"] error:error];
+	if(!rollups)
+		return NO;
+	for(TripRollup *rollup in rollups)
+	{
+		[context deleteObject:rollup];
+	}
+
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Trip"];
+	[request setPropertiesToFetch:@[@"startTime",@"dayKey",@"timeZoneName",@"endTime",@"totalMiles",@"maxSpeed",@"fuelUsed"]];
+	[request setFetchBatchSize:REBUILD_BATCH_SIZE];
+	NSArray *trips = [context executeFetchRequest:request error:error];
+	if(!trips)
+		return NO;
+
+	NSMutableDictionary *cache = [NSMutableDictionary dictionary];
+	for(Trip *trip in trips)
+	{
+		[self addTrip:trip cache:cache];
+	}
+	return YES;
+}
+
+@end
@@ -0,0 +1,66 @@
+//
+//  TripSegmenter.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/27/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreLocation/CoreLocation.h>
+
+typedef NS_ENUM(NSInteger, TripSegmenterState) {
+	TripSegmenterStateMoving = 0,
+	TripSegmenterStateStopped, //in a trip, waiting to see if the stop is long enough to end it
+	TripSegmenterStateIdle //between trips
+};
+
+typedef NS_ENUM(NSInteger, TripSegmenterEvent) {
+	TripSegmenterEventNone = 0,
+	TripSegmenterEventStopped, //vehicle came to a stop, the trip may end here
+	TripSegmenterEventResumed, //moved away from the stop before it was long enough
+	TripSegmenterEventTripEnded, //the trip ended at stopDate; this sample is not part of any trip
+	TripSegmenterEventTripStarted, //a new trip starts with this sample
+	TripSegmenterEventTripSplit //no samples for a whole stop (updates paused); end the trip at stopDate and start a new one with this sample
+};
+
+/**
+ Streaming state machine that splits a continuous recording into trips from speed, dwell
+ time and, when an OBD adapter is connected, engine RPM. It only keeps the current state, a
+ couple of timestamps and where the vehicle stopped, so it costs the same on the first fix as
+ on the millionth.
+
+ A stop ends when the vehicle drives off or leaves stopRadius, so crawling in stop-and-go
+ traffic keeps the trip open; the trip only ends once the vehicle stayed inside stopRadius
+ for the whole stop duration.
+ */
+@interface TripSegmenter : NSObject
+
+//! Defaults to the autoSplitTrips setting (on)
+@property (nonatomic) BOOL enabled;
+//! How long the vehicle must stay stopped before the trip ends. Defaults to the autoSplitStopMinutes setting (5 min)
+@property (nonatomic) NSTimeInterval stopDuration;
+//! How long a stop with the engine off must last before the trip ends (60s)
+@property (nonatomic) NSTimeInterval engineOffStopDuration;
+//! At or above this speed the vehicle is moving (5 mph)
+@property (nonatomic) double motionSpeed;
+//! Below this speed the vehicle is stopped (2 mph)
+@property (nonatomic) double stoppedSpeed;
+//! Moving farther than this from where the vehicle stopped ends the stop, whatever the speed (50m). Widened by the horizontal accuracy of both fixes, so GPS jitter alone can't end a stop
+@property (nonatomic) CLLocationDistance stopRadius;
+
+@property (nonatomic, readonly) TripSegmenterState state;
+//! When the current (or last) stop began
+@property (nonatomic, strong, readonly) NSDate *stopDate;
+
+//! Starts in TripSegmenterStateMoving, i.e. with a trip open
+-(void)reset;
+
+/**
+ Feeds one fix into the state machine.
+ @param speed speed in mph
+ @param rpm engine RPM, or a negative value when no OBD adapter is connected
+ */
+-(TripSegmenterEvent)updateWithLocation:(CLLocation *)location speed:(double)speed rpm:(double)rpm;
+
+@end
@@ -0,0 +1,118 @@
+//
+//  TripSegmenter.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 9/27/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripSegmenter.h"
+
+@implementation TripSegmenter{
+	NSTimeInterval lastSampleTime;
+	NSTimeInterval stopStartTime;
+	CLLocation *stopLocation;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		//Settings.bundle defaults are not registered, so fall back when the user never opened Settings
+		NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+		_enabled = [defaults objectForKey:@"autoSplitTrips"] ? [defaults boolForKey:@"autoSplitTrips"] : YES;
+		NSInteger stopMinutes = [defaults integerForKey:@"autoSplitStopMinutes"];
+		_stopDuration = (stopMinutes > 0 ? stopMinutes : 5) * 60;
+		_engineOffStopDuration = 60;
+		_motionSpeed = 5;
+		_stoppedSpeed = 2;
+		_stopRadius = 50;
+		[self reset];
+	}
+	return self;
+}
+
+-(void)reset
+{
+	_state = TripSegmenterStateMoving;
+	lastSampleTime = 0;
+	stopStartTime = 0;
+	stopLocation = nil;
+}
+
+-(NSDate *)stopDate
+{
+	return stopStartTime > 0 ? [NSDate dateWithTimeIntervalSinceReferenceDate:stopStartTime] : nil;
+}
+
+-(TripSegmenterEvent)updateWithLocation:(CLLocation *)location speed:(double)speed rpm:(double)rpm
+{
+	if(!self.enabled)
+		return TripSegmenterEventNone;
+
+	NSTimeInterval now = location.timestamp.timeIntervalSinceReferenceDate;
+	NSTimeInterval previousSampleTime = lastSampleTime;
+	lastSampleTime = now;
+
+	BOOL moving = speed >= self.motionSpeed;
+	BOOL stopped = speed < self.stoppedSpeed;
+	BOOL engineOff = rpm >= 0 && rpm < 1;
+
+	switch(self.state)
+	{
+		case TripSegmenterStateMoving:
+			//Location updates were paused for a whole stop: the trip ended at the last sample we saw
+			if(previousSampleTime > 0 && now - previousSampleTime >= self.stopDuration)
+			{
+				stopStartTime = previousSampleTime;
+				return moving ? TripSegmenterEventTripSplit : [self endTrip];
+			}
+			if(stopped)
+			{
+				_state = TripSegmenterStateStopped;
+				stopStartTime = now;
+				stopLocation = location;
+				return TripSegmenterEventStopped;
+			}
+			return TripSegmenterEventNone;
+
+		case TripSegmenterStateStopped:
+		{
+			NSTimeInterval dwell = now - stopStartTime;
+			BOOL stopIsOver = dwell >= self.stopDuration || (engineOff && dwell >= self.engineOffStopDuration);
+			//Crawling below motionSpeed still counts once it has taken the vehicle away from the stop,
+			//and only once the two fixes are that far apart even if each is off by its full accuracy
+			CLLocationDistance radius = self.stopRadius + MAX(location.horizontalAccuracy, 0) + MAX(stopLocation.horizontalAccuracy, 0);
+			BOOL leftStop = [location distanceFromLocation:stopLocation] > radius;
+			if(moving || leftStop)
+			{
+				if(stopIsOver)
+				{
+					_state = TripSegmenterStateMoving;
+					return TripSegmenterEventTripSplit;
+				}
+				_state = TripSegmenterStateMoving;
+				return TripSegmenterEventResumed;
+			}
+			return stopIsOver ? [self endTrip] : TripSegmenterEventNone;
+		}
+
+		case TripSegmenterStateIdle:
+			if(moving)
+			{
+				_state = TripSegmenterStateMoving;
+				return TripSegmenterEventTripStarted;
+			}
+			return TripSegmenterEventNone;
+	}
+	return TripSegmenterEventNone;
+}
+
+-(TripSegmenterEvent)endTrip
+{
+	_state = TripSegmenterStateIdle;
+	return TripSegmenterEventTripEnded;
+}
+
+@end
@@ -0,0 +1,66 @@
+//
+//  TripSpans.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/16/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class TripTrack;
+
+//! Buckets of the stored speed spans, slowest first. TripDetailViewController has one path color per bucket
+#define TRIP_SPAN_BUCKET_COUNT 4
+//! Bucket of the segments whose fix has no value for the metric, e.g. no OBD data
+#define TRIP_SPAN_NO_VALUE 0xFF
+
+//! Per fix value the route can be colored by
+typedef NS_ENUM(NSInteger, TripSpanMetric) {
+	TripSpanMetricSpeed = 0,
+	TripSpanMetricRPM,
+	TripSpanMetricThrottle,
+	TripSpanMetricEngineLoad,
+	TripSpanMetricGrade,
+	TripSpanMetricAcceleration,
+	TripSpanMetricCount
+};
+
+typedef NS_ENUM(NSInteger, TripSpanBounds) {
+	TripSpanBoundsLinear = 0, //even split between the lowest and highest value
+	TripSpanBoundsQuantile //about as many fixes in every bucket
+};
+
+/**
+ The colored route of a trip as a run list: the bucket of each run and how many path segments
+ it covers, ready to become GMSStyleSpans. Segment i, from fix i to fix i+1, takes the bucket of
+ fix i. Buckets are found by RouteColoring in a single pass over the metric's float column.
+
+ The speed spans (linear, TRIP_SPAN_BUCKET_COUNT buckets) are computed once when a trip is
+ finalized and stored on Trip.spanData as a small header followed by varint (bucket, segments)
+ pairs. The header records the bucket scheme, so spans written under another scheme read back
+ as nil and get recomputed. Other metrics are cheap enough to compute when they are picked.
+ */
+@interface TripSpans : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) const uint8_t *buckets;
+@property (nonatomic, readonly) const uint32_t *segmentCounts;
+
+//! The stored speed spans
++(instancetype)spansWithTrack:(TripTrack *)track;
+//! @param bucketCount at most 16
++(instancetype)spansWithTrack:(TripTrack *)track metric:(TripSpanMetric)metric bounds:(TripSpanBounds)bounds bucketCount:(NSUInteger)bucketCount;
+//! @return nil if data is malformed or was written under another bucket scheme
++(instancetype)spansWithData:(NSData *)data;
+
+-(NSData *)dataRepresentation;
+
+/**
+ The spans of a simplified path through the given fixes: its segment from indexes[t] to
+ indexes[t+1] takes the bucket of fix indexes[t], so every level of detail is colored alike.
+ @param indexes ascending fix indexes
+ */
+-(TripSpans *)spansForIndexes:(const uint32_t *)indexes count:(NSUInteger)count;
+
+@end
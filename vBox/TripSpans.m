@@ -0,0 +1,186 @@
+//
+//  TripSpans.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/16/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripSpans.h"
+#import "TripTrack.h"
+#import "TrackCodec.h"
+#import "RouteColoring.h"
+
+#define SPAN_MAGIC 0x53584256 //"VBXS"
+#define SPAN_VERSION 1
+#define SPAN_SCHEME 2 //bump whenever the buckets change so stored spans are recomputed
+
+//All fields little-endian, (bucket, segments) varint pairs follow
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t scheme;
+	uint32_t count;
+} SpanHeader;
+
+@implementation TripSpans{
+	uint8_t *buckets;
+	uint32_t *segmentCounts;
+}
+
+-(instancetype)initWithCount:(NSUInteger)count
+{
+	self = [super init];
+	if(self)
+	{
+		_count = count;
+		buckets = malloc(MAX(count, 1));
+		segmentCounts = malloc(MAX(count, 1) * sizeof(uint32_t));
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	free(buckets);
+	free(segmentCounts);
+}
+
++(instancetype)spansWithTrack:(TripTrack *)track
+{
+	return [self spansWithTrack:track metric:TripSpanMetricSpeed bounds:TripSpanBoundsLinear bucketCount:TRIP_SPAN_BUCKET_COUNT];
+}
+
++(instancetype)spansWithTrack:(TripTrack *)track metric:(TripSpanMetric)metric bounds:(TripSpanBounds)bounds bucketCount:(NSUInteger)bucketCount
+{
+	NSUInteger count = track.count;
+	float *values = malloc(MAX(count, 1) * sizeof(float));
+	switch(metric)
+	{
+		case TripSpanMetricSpeed:
+			memcpy(values, track.speeds, count * sizeof(float));
+			break;
+		case TripSpanMetricRPM:
+			[track getValues:values forChannel:TripTrackChannelRPM];
+			break;
+		case TripSpanMetricThrottle:
+			[track getValues:values forChannel:TripTrackChannelThrottle];
+			break;
+		case TripSpanMetricEngineLoad:
+			[track getValues:values forChannel:TripTrackChannelEngineLoad];
+			break;
+		case TripSpanMetricGrade:
+			[track getGrades:values];
+			break;
+		case TripSpanMetricAcceleration:
+			[track getAccelerations:values];
+			break;
+		default:
+			for(NSUInteger i = 0; i < count; i++)
+				values[i] = NAN;
+			break;
+	}
+
+	float bucketBounds[ROUTE_COLORING_MAX_BUCKETS];
+	int colorCount = (int)MIN(bucketCount, (NSUInteger)ROUTE_COLORING_MAX_BUCKETS);
+	size_t boundCount = bounds == TripSpanBoundsQuantile ? RouteColoringQuantileBounds(values, count, colorCount, bucketBounds) : RouteColoringLinearBounds(values, count, colorCount, bucketBounds);
+	uint8_t *fixBuckets = malloc(MAX(count, 1));
+	RouteColoringClassify(values, count, bucketBounds, boundCount, fixBuckets);
+	free(values);
+
+	NSUInteger segmentCount = count > 0 ? count - 1 : 0;
+	TripSpans *spans = [[self alloc] initWithCount:segmentCount];
+	spans->_count = RouteColoringRuns(fixBuckets, segmentCount, spans->buckets, spans->segmentCounts);
+	free(fixBuckets);
+	return spans;
+}
+
++(instancetype)spansWithData:(NSData *)data
+{
+	if(data.length < sizeof(SpanHeader))
+		return nil;
+	SpanHeader header;
+	[data getBytes:&header length:sizeof(SpanHeader)];
+	//Each run takes at least two bytes
+	if(header.magic != SPAN_MAGIC || header.version != SPAN_VERSION || header.scheme != SPAN_SCHEME || header.count > data.length / 2)
+		return nil;
+
+	TripSpans *spans = [[self alloc] initWithCount:header.count];
+	const uint8_t *bytes = (const uint8_t *)data.bytes;
+	size_t length = data.length, offset = sizeof(SpanHeader);
+	for(uint32_t i = 0; i < header.count; i++)
+	{
+		uint64_t bucket, segments;
+		size_t read = TrackCodecReadVarint(bytes + offset, length - offset, &bucket);
+		if(!read || bucket >= TRIP_SPAN_BUCKET_COUNT)
+			return nil;
+		offset += read;
+		read = TrackCodecReadVarint(bytes + offset, length - offset, &segments);
+		if(!read || segments == 0 || segments > UINT32_MAX)
+			return nil;
+		offset += read;
+		spans->buckets[i] = (uint8_t)bucket;
+		spans->segmentCounts[i] = (uint32_t)segments;
+	}
+	return offset == length ? spans : nil;
+}
+
+-(NSData *)dataRepresentation
+{
+	SpanHeader header = {SPAN_MAGIC, SPAN_VERSION, SPAN_SCHEME, (uint32_t)_count};
+	NSMutableData *data = [NSMutableData dataWithLength:sizeof(SpanHeader) + _count * 11];
+	uint8_t *bytes = data.mutableBytes;
+	memcpy(bytes, &header, sizeof(SpanHeader));
+	size_t size = sizeof(SpanHeader);
+	for(NSUInteger i = 0; i < _count; i++)
+	{
+		size += TrackCodecWriteVarint(buckets[i], bytes + size);
+		size += TrackCodecWriteVarint(segmentCounts[i], bytes + size);
+	}
+	[data setLength:size];
+	return data;
+}
+
+#pragma mark - Levels of Detail
+
+-(TripSpans *)spansForIndexes:(const uint32_t *)indexes count:(NSUInteger)count
+{
+	NSUInteger segmentCount = count > 0 ? count - 1 : 0;
+	TripSpans *spans = [[TripSpans alloc] initWithCount:segmentCount];
+	NSUInteger runs = 0;
+	NSUInteger run = 0;
+	uint64_t runEnd = _count > 0 ? segmentCounts[0] : 0;
+	for(NSUInteger t = 0; t < segmentCount; t++)
+	{
+		//Indexes ascend, so the run holding each fix's segment only moves forward
+		while(run + 1 < _count && indexes[t] >= runEnd)
+			runEnd += segmentCounts[++run];
+		uint8_t bucket = _count > 0 ? buckets[run] : TRIP_SPAN_NO_VALUE;
+		if(runs > 0 && spans->buckets[runs-1] == bucket)
+		{
+			spans->segmentCounts[runs-1]++;
+		}
+		else
+		{
+			spans->buckets[runs] = bucket;
+			spans->segmentCounts[runs] = 1;
+			runs++;
+		}
+	}
+	spans->_count = runs;
+	return spans;
+}
+
+#pragma mark - Accessors
+
+-(const uint8_t *)buckets
+{
+	return buckets;
+}
+
+-(const uint32_t *)segmentCounts
+{
+	return segmentCounts;
+}
+
+@end
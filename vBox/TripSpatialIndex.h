@@ -0,0 +1,50 @@
+//
+//  TripSpatialIndex.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/11/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import <CoreLocation/CoreLocation.h>
+
+@class Trip, TripTrack;
+
+//! The fixes of one trip that fall inside a queried area
+@interface TripSpatialMatch : NSObject
+
+@property (nonatomic, strong, readonly) NSManagedObjectID *tripID;
+//! Indexes into the trip's track. Each range starts one fix early so the segment entering the area is included
+@property (nonatomic, strong, readonly) NSIndexSet *pointIndexes;
+
+@end
+
+/**
+ Answers "which trips went through here?" from TripCell rows instead of the tracks.
+
+ The world is split into a fixed grid of 2^16 x 2^16 cells (about 600m x 300m at the equator)
+ numbered along a Z-order (Morton) curve, so every cell of a coarser grid covers one contiguous
+ range of cell codes. A query covers the viewport with at most a handful of coarse cells and
+ fetches the TripCell rows in those code ranges through the index on TripCell.cell.
+ */
+@interface TripSpatialIndex : NSObject
+
++(instancetype)sharedIndex;
+
+/**
+ Inserts the TripCell rows for track into trip's context. Call on that context's queue, before
+ saving; trip must not have been indexed already.
+ */
++(void)indexTrip:(Trip *)trip track:(TripTrack *)track;
+//! Replaces trip's TripCell rows with those of track, e.g. after its fixes were thinned out
++(void)reindexTrip:(Trip *)trip track:(TripTrack *)track;
+
+/**
+ Finds the trips with fixes inside the bounds. Crossing the 180th meridian is supported.
+ @param completion called on the main queue with TripSpatialMatch objects, in no particular order
+ */
+-(void)findTripsWithSouthWest:(CLLocationCoordinate2D)southWest northEast:(CLLocationCoordinate2D)northEast completion:(void (^)(NSArray *matches))completion;
+
+@end
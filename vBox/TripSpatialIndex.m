@@ -0,0 +1,227 @@
+//
+//  TripSpatialIndex.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/11/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripSpatialIndex.h"
+#import <QuartzCore/QuartzCore.h>
+#import "AppDelegate.h"
+#import "Trip.h"
+#import "TripCell.h"
+#import "TripTrack.h"
+#import "UtilityMethods.h"
+
+#define CELL_BITS 16 //per axis
+#define MAX_QUERY_CELLS 16 //coarse cells a query is allowed to cover
+
+#pragma mark - Cell Codes
+
+static inline uint32_t CellX(double longitude)
+{
+	double x = floor((longitude + 180.0) / 360.0 * (1 << CELL_BITS));
+	return (uint32_t)MAX(0, MIN(x, (1 << CELL_BITS) - 1));
+}
+
+static inline uint32_t CellY(double latitude)
+{
+	double y = floor((latitude + 90.0) / 180.0 * (1 << CELL_BITS));
+	return (uint32_t)MAX(0, MIN(y, (1 << CELL_BITS) - 1));
+}
+
+static inline uint64_t SpreadBits(uint32_t value)
+{
+	uint64_t x = value;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | (x << 2)) & 0x3333333333333333ull;
+	x = (x | (x << 1)) & 0x5555555555555555ull;
+	return x;
+}
+
+static inline uint32_t CompactBits(uint64_t x)
+{
+	x &= 0x5555555555555555ull;
+	x = (x | (x >> 1)) & 0x3333333333333333ull;
+	x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+	x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+	x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+	return (uint32_t)x;
+}
+
+static inline uint64_t CellCode(uint32_t x, uint32_t y)
+{
+	return (SpreadBits(y) << 1) | SpreadBits(x);
+}
+
+@interface TripSpatialMatch ()
+
+@property (nonatomic, strong, readwrite) NSManagedObjectID *tripID;
+@property (nonatomic, strong, readwrite) NSIndexSet *pointIndexes;
+
+@end
+
+@implementation TripSpatialMatch
+
+@end
+
+@implementation TripSpatialIndex{
+	NSManagedObjectContext *context;
+}
+
++(instancetype)sharedIndex
+{
+	static TripSpatialIndex *sharedIndex = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedIndex = [[self alloc] init];
+	});
+	return sharedIndex;
+}
+
+-(id)init
+{
+	self = [super init];
+	if(self)
+	{
+		AppDelegate *appDelegate = [[UIApplication sharedApplication] delegate];
+		context = [appDelegate newBackgroundContext];
+	}
+	return self;
+}
+
+#pragma mark - Indexing
+
++(void)indexTrip:(Trip *)trip track:(TripTrack *)track
+{
+	if(track.count == 0)
+		return;
+
+	NSManagedObjectContext *tripContext = trip.managedObjectContext;
+	NSEntityDescription *entity = [NSEntityDescription entityForName:@"TripCell" inManagedObjectContext:tripContext];
+	const double *latitudes = track.latitudes, *longitudes = track.longitudes;
+
+	uint64_t runCell = CellCode(CellX(longitudes[0]), CellY(latitudes[0]));
+	NSUInteger runStart = 0;
+	for(NSUInteger i = 1; i <= track.count; i++)
+	{
+		uint64_t cell = i < track.count ? CellCode(CellX(longitudes[i]), CellY(latitudes[i])) : UINT64_MAX;
+		if(cell == runCell)
+			continue;
+
+		TripCell *tripCell = [[TripCell alloc] initWithEntity:entity insertIntoManagedObjectContext:tripContext];
+		[tripCell setCell:@(runCell)];
+		[tripCell setFirstIndex:@(runStart > 0 ? runStart - 1 : 0)];
+		[tripCell setLastIndex:@(i - 1)];
+		[tripCell setTrip:trip];
+		runCell = cell;
+		runStart = i;
+	}
+}
+
++(void)reindexTrip:(Trip *)trip track:(TripTrack *)track
+{
+	for(TripCell *tripCell in [trip.cells allObjects])
+	{
+		[trip.managedObjectContext deleteObject:tripCell];
+	}
+	[self indexTrip:trip track:track];
+}
+
+#pragma mark - Queries
+
+-(void)findTripsWithSouthWest:(CLLocationCoordinate2D)southWest northEast:(CLLocationCoordinate2D)northEast completion:(void (^)(NSArray *matches))completion
+{
+	[context performBlock:^{
+		CFTimeInterval start = CACurrentMediaTime();
+		uint32_t y0 = CellY(southWest.latitude), y1 = CellY(northEast.latitude);
+		NSMutableDictionary *indexesByTrip = [NSMutableDictionary dictionary];
+		NSUInteger rowCount = 0;
+		if(southWest.longitude <= northEast.longitude)
+		{
+			rowCount += [self collectCellsFromX:CellX(southWest.longitude) toX:CellX(northEast.longitude) fromY:y0 toY:y1 into:indexesByTrip];
+		}
+		else
+		{
+			rowCount += [self collectCellsFromX:CellX(southWest.longitude) toX:(1 << CELL_BITS) - 1 fromY:y0 toY:y1 into:indexesByTrip];
+			rowCount += [self collectCellsFromX:0 toX:CellX(northEast.longitude) fromY:y0 toY:y1 into:indexesByTrip];
+		}
+
+		NSMutableArray *matches = [NSMutableArray arrayWithCapacity:indexesByTrip.count];
+		[indexesByTrip enumerateKeysAndObjectsUsingBlock:^(NSManagedObjectID *tripID, NSIndexSet *indexes, BOOL *stop) {
+			TripSpatialMatch *match = [[TripSpatialMatch alloc] init];
+			match.tripID = tripID;
+			match.pointIndexes = indexes;
+			[matches addObject:match];
+		}];
+
+		NSDictionary *dimensions = @{@"rows":[NSString stringWithFormat:@"%lu",(unsigned long)rowCount],
+									 @"trips":[NSString stringWithFormat:@"%lu",(unsigned long)matches.count]};
+		[UtilityMethods trackPerformanceEvent:@"SpatialQuery" duration:CACurrentMediaTime() - start dimensions:dimensions];
+
+		dispatch_async(dispatch_get_main_queue(), ^{
+			completion(matches);
+		});
+	}];
+}
+
+//Runs on the context queue. @return the number of TripCell rows that fell inside the cell rectangle
+-(NSUInteger)collectCellsFromX:(uint32_t)x0 toX:(uint32_t)x1 fromY:(uint32_t)y0 toY:(uint32_t)y1 into:(NSMutableDictionary *)indexesByTrip
+{
+	//Coarsen until the rectangle is covered by few enough cells; each one is a contiguous code range
+	int shift = 0;
+	while(shift < CELL_BITS && (uint64_t)((x1 >> shift) - (x0 >> shift) + 1) * ((y1 >> shift) - (y0 >> shift) + 1) > MAX_QUERY_CELLS)
+		shift++;
+
+	NSMutableArray *rangePredicates = [NSMutableArray array];
+	for(uint32_t y = y0 >> shift; y <= y1 >> shift; y++)
+	{
+		for(uint32_t x = x0 >> shift; x <= x1 >> shift; x++)
+		{
+			uint64_t first = CellCode(x, y) << (2 * shift);
+			uint64_t end = (CellCode(x, y) + 1) << (2 * shift);
+			[rangePredicates addObject:[NSPredicate predicateWithFormat:@"cell >= %llu AND cell < %llu",first,end]];
+		}
+	}
+
+	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"TripCell"];
+	[request setPredicate:[NSCompoundPredicate orPredicateWithSubpredicates:rangePredicates]];
+	[request setResultType:NSDictionaryResultType];
+	[request setPropertiesToFetch:@[@"cell",@"firstIndex",@"lastIndex",@"trip"]];
+
+	NSError *error = nil;
+	NSArray *rows = [context executeFetchRequest:request error:&error];
+	if(!rows)
+	{
+		NSLog(@"Unresolved Error %@, %@", error, [error userInfo]);
+		return 0;
+	}
+
+	//Coarse cells overhang the rectangle, so check each row's own cell
+	NSUInteger matchedCount = 0;
+	for(NSDictionary *row in rows)
+	{
+		uint64_t cell = [row[@"cell"] unsignedLongLongValue];
+		uint32_t x = CompactBits(cell), y = CompactBits(cell >> 1);
+		NSManagedObjectID *tripID = row[@"trip"];
+		if(x < x0 || x > x1 || y < y0 || y > y1 || !tripID)
+			continue;
+
+		NSMutableIndexSet *indexes = indexesByTrip[tripID];
+		if(!indexes)
+		{
+			indexes = [NSMutableIndexSet indexSet];
+			indexesByTrip[tripID] = indexes;
+		}
+		NSUInteger first = [row[@"firstIndex"] unsignedIntegerValue];
+		[indexes addIndexesInRange:NSMakeRange(first, [row[@"lastIndex"] unsignedIntegerValue] - first + 1)];
+		matchedCount++;
+	}
+	return matchedCount;
+}
+
+@end
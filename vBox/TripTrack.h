@@ -0,0 +1,99 @@
+//
+//  TripTrack.h
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/3/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreLocation/CoreLocation.h>
+
+@class TripChannels;
+
+//! OBD values of a fix, in the order of the BluetoothData attributes
+typedef NS_ENUM(NSInteger, TripTrackChannel) {
+	TripTrackChannelSpeed = 0, //mph
+	TripTrackChannelAmbientTemp,
+	TripTrackChannelBarometric,
+	TripTrackChannelRPM,
+	TripTrackChannelIntakeTemp,
+	TripTrackChannelFuel,
+	TripTrackChannelEngineLoad,
+	TripTrackChannelDistance,
+	TripTrackChannelCoolantTemp,
+	TripTrackChannelThrottle,
+	TripTrackChannelCount
+};
+
+/**
+ Every fix of a trip held as plain C columns instead of one GPSLocation object per fix.
+
+ dataRepresentation packs the columns into a single blob stored on Trip.trackData. Values are
+ quantized (latitude/longitude at 1e-7 degrees, milliseconds from the start, speed at 0.01 mph,
+ altitude in feet, whole OBD values) and written with TrackCodec: second order deltas for
+ position and time, first order for speed and altitude, runs for the OBD channels, and an LZ
+ pass when it makes the blob smaller. metersFromStart is not stored; it is rebuilt on decode.
+ Version 1 blobs (fixed width columns) are still read.
+
+ Since version 3, trips record their OBD data as sparse TripChannels samples appended to the
+ blob instead of per fix channel columns, and the channel accessors look the values up at each
+ fix's time. Per fix columns are still read from older blobs and legacy rows.
+ */
+@interface TripTrack : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, strong, readonly) NSDate *startTime;
+//! Degrees
+@property (nonatomic, readonly) const double *latitudes;
+@property (nonatomic, readonly) const double *longitudes;
+//! Seconds since the reference date
+@property (nonatomic, readonly) const double *timestamps;
+//! mph
+@property (nonatomic, readonly) const float *speeds;
+//! Feet
+@property (nonatomic, readonly) const float *altitudes;
+@property (nonatomic, readonly) const double *metersFromStart;
+//! YES if any fix has OBD values
+@property (nonatomic, readonly) BOOL hasBluetoothData;
+//! OBD samples of the trip, by diagnostic key. nil when the OBD values are held per fix
+@property (nonatomic, strong) TripChannels *channels;
+
++(instancetype)trackWithData:(NSData *)data;
+//! Builds a track from legacy GPSLocation rows (with their BluetoothData), in order
++(instancetype)trackWithGPSLocations:(id<NSFastEnumeration>)locations count:(NSUInteger)count startTime:(NSDate *)startTime;
+//! Appends legacy rows in order, e.g. a window of them at a time
+-(void)appendGPSLocations:(id<NSFastEnumeration>)locations;
+
+-(instancetype)initWithCapacity:(NSUInteger)capacity startTime:(NSDate *)startTime;
+
+/**
+ Appends a fix. metersFromStart is accumulated from the previous fix.
+ @param bluetoothValues TripTrackChannelCount values (NAN when a channel has no value), or NULL if no OBD adapter was connected
+ */
+-(void)appendLatitude:(double)latitude longitude:(double)longitude timestamp:(NSTimeInterval)timestamp speed:(float)speed altitude:(float)altitude bluetoothValues:(const float *)bluetoothValues;
+
+-(NSData *)dataRepresentation;
+
+-(CLLocationCoordinate2D)coordinateAtIndex:(NSUInteger)index;
+-(NSDate *)dateAtIndex:(NSUInteger)index;
+-(BOOL)hasBluetoothDataAtIndex:(NSUInteger)index;
+//! @return NAN if the fix has no value for channel
+-(float)valueForChannel:(TripTrackChannel)channel atIndex:(NSUInteger)index;
+//! Fills values with channel at every fix, NAN where the fix has no value
+-(void)getValues:(float *)values forChannel:(TripTrackChannel)channel;
+//! Road grade in % at every fix, over the last 20m or more driven. NAN until the trip has covered that
+-(void)getGrades:(float *)grades;
+//! mph per second at every fix, from the previous fix. NAN for the first fix
+-(void)getAccelerations:(float *)accelerations;
+//! Drop in the OBD fuel level between the first and last fix that report it, in % of the tank. 0 without OBD data
+-(double)fuelUsed;
+
+//! Fixes Douglas-Peucker keeps at toleranceMeters off the simplified line. Always has the first and last fix
+-(NSIndexSet *)indexesSimplifiedWithTolerance:(double)toleranceMeters;
+//! Same, but only over the fixes at indexes, e.g. to simplify an already simplified path further
+-(NSIndexSet *)indexesSimplifiedWithTolerance:(double)toleranceMeters withinIndexes:(NSIndexSet *)indexes;
+//! A new track holding only the fixes at indexes, with their OBD values and the same channels. metersFromStart follows the kept fixes
+-(TripTrack *)trackWithIndexes:(NSIndexSet *)indexes;
+
+@end
@@ -0,0 +1,704 @@
+//
+//  TripTrack.m
+//  vBox
+//
+//  Created by Rosbel Sanroman on 10/3/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import "TripTrack.h"
+#import "GPSLocation.h"
+#import "BluetoothData.h"
+#import "TrackCodec.h"
+#import "TripChannels.h"
+
+#define TRACK_MAGIC 0x54584256 //"VBXT"
+#define TRACK_VERSION 3
+#define TRACK_FLAG_BLUETOOTH 0x1
+#define TRACK_FLAG_COMPRESSED 0x2
+#define TRACK_FLAG_CHANNELS 0x4 //version 3 only
+#define TRACK_MISSING_VALUE INT32_MIN
+#define EARTH_RADIUS 6371009.0 //same sphere as GMSGeometryDistance
+
+//All fields little-endian, columns follow the header back to back. With TRACK_FLAG_CHANNELS the
+//columns are prefixed by their varint length and followed by the TripChannels section
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t count;
+	uint32_t reserved;
+	double startTime; //seconds since reference date
+} TrackHeader;
+
+//Quantized columns as they are stored. times are milliseconds from the rounded start time
+typedef struct {
+	size_t count;
+	int32_t *latitudes;
+	int32_t *longitudes;
+	int32_t *times;
+	int32_t *speeds;
+	int32_t *altitudes;
+	int32_t *presence; //NULL without OBD data
+	int32_t *channels[TripTrackChannelCount];
+} TrackColumns;
+
+//Version 2 and 3 column order and codecs; presence and OBD channels follow only with TRACK_FLAG_BLUETOOTH
+#define TRACK_DELTA_COLUMNS 5
+static const int trackDeltaOrders[TRACK_DELTA_COLUMNS] = {2, 2, 2, 1, 1};
+
+static void TrackColumnsFree(TrackColumns *columns)
+{
+	free(columns->latitudes);
+	free(columns->longitudes);
+	free(columns->times);
+	free(columns->speeds);
+	free(columns->altitudes);
+	free(columns->presence);
+	for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+		free(columns->channels[channel]);
+}
+
+//Returns NO, with nothing left allocated, if any column could not be allocated
+static BOOL TrackColumnsAllocate(TrackColumns *columns, size_t count, BOOL bluetooth)
+{
+	memset(columns, 0, sizeof(TrackColumns));
+	columns->count = count;
+	BOOL allocated = YES;
+	int32_t **deltaColumns[TRACK_DELTA_COLUMNS] = {&columns->latitudes, &columns->longitudes, &columns->times, &columns->speeds, &columns->altitudes};
+	for(int column = 0; column < TRACK_DELTA_COLUMNS; column++)
+		allocated = (*deltaColumns[column] = calloc(MAX(count, 1), sizeof(int32_t))) != NULL && allocated;
+	if(bluetooth)
+	{
+		allocated = (columns->presence = calloc(MAX(count, 1), sizeof(int32_t))) != NULL && allocated;
+		for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+			allocated = (columns->channels[channel] = calloc(MAX(count, 1), sizeof(int32_t))) != NULL && allocated;
+	}
+	if(!allocated)
+		TrackColumnsFree(columns);
+	return allocated;
+}
+
+static size_t TrackColumnsWriteBound(const TrackColumns *columns)
+{
+	size_t runColumns = columns->presence ? 1 + TripTrackChannelCount : 0;
+	return (TRACK_DELTA_COLUMNS + runColumns) * 10 + TRACK_DELTA_COLUMNS * TrackCodecDeltaBound(columns->count) + runColumns * TrackCodecRunBound(columns->count);
+}
+
+//Each column is written as [varint byte length][encoded values]
+static size_t TrackColumnsWrite(const TrackColumns *columns, uint8_t *out)
+{
+	size_t size = 0;
+	uint8_t *scratch = malloc(MAX(TrackCodecRunBound(columns->count), (size_t)1));
+	int32_t *deltaColumns[TRACK_DELTA_COLUMNS] = {columns->latitudes, columns->longitudes, columns->times, columns->speeds, columns->altitudes};
+	for(int column = 0; column < TRACK_DELTA_COLUMNS; column++)
+	{
+		size_t length = TrackCodecEncodeDeltas(deltaColumns[column], columns->count, trackDeltaOrders[column], scratch);
+		size += TrackCodecWriteVarint(length, out + size);
+		memcpy(out + size, scratch, length);
+		size += length;
+	}
+	for(NSInteger column = -1; columns->presence && column < TripTrackChannelCount; column++)
+	{
+		size_t length = TrackCodecEncodeRuns(column < 0 ? columns->presence : columns->channels[column], columns->count, scratch);
+		size += TrackCodecWriteVarint(length, out + size);
+		memcpy(out + size, scratch, length);
+		size += length;
+	}
+	free(scratch);
+	return size;
+}
+
+static BOOL TrackColumnsReadVersion2(TrackColumns *columns, const uint8_t *bytes, size_t length, BOOL compressed)
+{
+	uint8_t *decompressed = NULL;
+	if(compressed)
+	{
+		uint64_t rawLength;
+		size_t read = TrackCodecReadVarint(bytes, length, &rawLength);
+		if(!read || rawLength > TrackColumnsWriteBound(columns))
+			return NO;
+		decompressed = malloc(MAX(rawLength, 1));
+		if(!decompressed)
+			return NO;
+		if(TrackCodecDecompress(bytes + read, length - read, decompressed, rawLength) != rawLength)
+		{
+			free(decompressed);
+			return NO;
+		}
+		bytes = decompressed;
+		length = rawLength;
+	}
+
+	BOOL valid = YES;
+	size_t offset = 0;
+	int32_t *deltaColumns[TRACK_DELTA_COLUMNS] = {columns->latitudes, columns->longitudes, columns->times, columns->speeds, columns->altitudes};
+	for(NSInteger column = 0; valid && column < TRACK_DELTA_COLUMNS + (columns->presence ? 1 + TripTrackChannelCount : 0); column++)
+	{
+		uint64_t columnLength;
+		size_t read = TrackCodecReadVarint(bytes + offset, length - offset, &columnLength);
+		valid = read && columnLength <= length - offset - read;
+		if(!valid)
+			break;
+		offset += read;
+
+		size_t decoded;
+		if(column < TRACK_DELTA_COLUMNS)
+			decoded = TrackCodecDecodeDeltas(bytes + offset, columnLength, trackDeltaOrders[column], deltaColumns[column], columns->count);
+		else
+			decoded = TrackCodecDecodeRuns(bytes + offset, columnLength, column == TRACK_DELTA_COLUMNS ? columns->presence : columns->channels[column - TRACK_DELTA_COLUMNS - 1], columns->count);
+		valid = decoded == columnLength;
+		offset += columnLength;
+	}
+	free(decompressed);
+	return valid;
+}
+
+//Fixed width columns: int32 lat, lon, time deltas, uint16 speed, int16 altitude, uint8 presence, int32 channels
+static BOOL TrackColumnsReadVersion1(TrackColumns *columns, const uint8_t *bytes, size_t length)
+{
+	size_t count = columns->count;
+	size_t rowSize = 4 + 4 + 4 + 2 + 2 + (columns->presence ? 1 + 4 * TripTrackChannelCount : 0);
+	if(length < count * rowSize)
+		return NO;
+
+	const int32_t *lat = (const int32_t *)bytes;
+	const int32_t *lon = lat + count;
+	const int32_t *timeDeltas = lon + count;
+	const uint16_t *speed = (const uint16_t *)(timeDeltas + count);
+	const int16_t *altitude = (const int16_t *)(speed + count);
+	const uint8_t *flags = (const uint8_t *)(altitude + count);
+	int64_t time = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		time += timeDeltas[i];
+		columns->latitudes[i] = lat[i];
+		columns->longitudes[i] = lon[i];
+		columns->times[i] = (int32_t)time;
+		columns->speeds[i] = speed[i];
+		columns->altitudes[i] = altitude[i];
+		if(columns->presence)
+			columns->presence[i] = flags[i];
+	}
+	for(NSInteger channel = 0; columns->presence && channel < TripTrackChannelCount; channel++)
+		memcpy(columns->channels[channel], flags + count + channel * count * sizeof(int32_t), count * sizeof(int32_t)); //unaligned after the flag column
+	return YES;
+}
+
+//Rejects a count the payload is too short to hold before any column is allocated for it. Every encoded value
+//takes at least one byte (a varint), and compressed payloads are checked by the raw length they claim, which
+//is first checked against how far the block could possibly expand
+static BOOL TrackCountFitsPayload(size_t count, uint16_t version, BOOL bluetooth, BOOL compressed, const uint8_t *bytes, size_t length)
+{
+	if(version == 1)
+	{
+		size_t rowSize = 4 + 4 + 4 + 2 + 2 + (bluetooth ? 1 + 4 * TripTrackChannelCount : 0);
+		return count <= length / rowSize;
+	}
+	if(compressed)
+	{
+		uint64_t rawLength;
+		size_t read = TrackCodecReadVarint(bytes, length, &rawLength);
+		if(!read || rawLength > TrackCodecDecompressBound(length - read))
+			return NO;
+		length = (size_t)rawLength;
+	}
+	return count <= length / TRACK_DELTA_COLUMNS;
+}
+
+//Diagnostic keys of the TripTrackChannel values, for tracks whose OBD data is held in TripChannels
+static NSString * const trackChannelKeys[TripTrackChannelCount] = {
+	@"Speed", @"Ambient Temp", @"Barometric", @"RPM", @"Intake Temp", @"Fuel", @"Engine Load", @"Distance", @"Coolant Temp", @"Throttle"
+};
+#define KPH_TO_MPH 0.621371
+#define GRADE_MIN_METERS 20.0 //GPS altitude is too noisy for the grade of shorter stretches
+#define FEET_TO_METERS 0.3048
+
+static double TrackDistance(double lat1, double lon1, double lat2, double lon2)
+{
+	double phi1 = lat1 * M_PI / 180.0, phi2 = lat2 * M_PI / 180.0;
+	double dPhi = phi2 - phi1, dLambda = (lon2 - lon1) * M_PI / 180.0;
+	double a = sin(dPhi / 2) * sin(dPhi / 2) + cos(phi1) * cos(phi2) * sin(dLambda / 2) * sin(dLambda / 2);
+	return 2.0 * EARTH_RADIUS * atan2(sqrt(a), sqrt(1.0 - a));
+}
+
+@implementation TripTrack{
+	NSUInteger capacity;
+	double *latitudes;
+	double *longitudes;
+	double *timestamps;
+	float *speeds;
+	float *altitudes;
+	double *metersFromStart;
+	uint8_t *bluetoothFlags; //NULL until the first fix with OBD data
+	float *channels[TripTrackChannelCount];
+}
+
+#pragma mark - Initialization
+
+-(instancetype)initWithCapacity:(NSUInteger)initialCapacity startTime:(NSDate *)startTime
+{
+	self = [super init];
+	if(self)
+	{
+		_startTime = startTime;
+		[self reserveCapacity:MAX(initialCapacity, (NSUInteger)16)];
+	}
+	return self;
+}
+
++(instancetype)trackWithGPSLocations:(id<NSFastEnumeration>)locations count:(NSUInteger)count startTime:(NSDate *)startTime
+{
+	TripTrack *track = [[self alloc] initWithCapacity:count startTime:startTime];
+	[track appendGPSLocations:locations];
+	return track;
+}
+
+-(void)appendGPSLocations:(id<NSFastEnumeration>)locations
+{
+	float values[TripTrackChannelCount];
+	for(GPSLocation *location in locations)
+	{
+		BluetoothData *bleData = location.bluetoothInfo;
+		if(bleData)
+		{
+			NSNumber *numbers[TripTrackChannelCount] = {bleData.speed, bleData.ambientTemp, bleData.barometric, bleData.rpm, bleData.intakeTemp,
+				bleData.fuel, bleData.engineLoad, bleData.distance, bleData.coolantTemp, bleData.throttle};
+			for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+				values[channel] = numbers[channel] ? numbers[channel].floatValue : NAN;
+		}
+		[self appendLatitude:location.latitude.doubleValue longitude:location.longitude.doubleValue timestamp:location.timestamp.timeIntervalSinceReferenceDate
+					   speed:location.speed.floatValue altitude:location.altitude.floatValue bluetoothValues:bleData ? values : NULL];
+	}
+}
+
++(instancetype)trackWithData:(NSData *)data
+{
+	if(data.length < sizeof(TrackHeader))
+		return nil;
+	TrackHeader header;
+	[data getBytes:&header length:sizeof(TrackHeader)];
+	if(header.magic != TRACK_MAGIC || header.version < 1 || header.version > TRACK_VERSION)
+		return nil;
+
+	NSUInteger count = header.count;
+	BOOL hasBluetooth = (header.flags & TRACK_FLAG_BLUETOOTH) != 0;
+	const uint8_t *payload = (const uint8_t *)data.bytes + sizeof(TrackHeader);
+	NSUInteger payloadLength = data.length - sizeof(TrackHeader);
+
+	TripChannels *trackChannels = nil;
+	if(header.version == TRACK_VERSION && (header.flags & TRACK_FLAG_CHANNELS))
+	{
+		uint64_t columnsLength;
+		size_t read = TrackCodecReadVarint(payload, payloadLength, &columnsLength);
+		if(!read || columnsLength > payloadLength - read)
+			return nil;
+		NSRange channelsRange = NSMakeRange(sizeof(TrackHeader) + read + (NSUInteger)columnsLength, payloadLength - read - (NSUInteger)columnsLength);
+		trackChannels = [TripChannels channelsWithData:[data subdataWithRange:channelsRange] startTime:header.startTime];
+		if(!trackChannels)
+			return nil;
+		payload += read;
+		payloadLength = (NSUInteger)columnsLength;
+	}
+
+	BOOL compressed = (header.flags & TRACK_FLAG_COMPRESSED) != 0;
+	if(!TrackCountFitsPayload(count, header.version, hasBluetooth, compressed && header.version != 1, payload, payloadLength))
+		return nil;
+
+	TrackColumns columns;
+	if(!TrackColumnsAllocate(&columns, count, hasBluetooth))
+		return nil;
+	BOOL decoded = NO;
+	if(header.version == 1)
+		decoded = TrackColumnsReadVersion1(&columns, payload, payloadLength);
+	else if(header.version == 2 || header.version == TRACK_VERSION)
+		decoded = TrackColumnsReadVersion2(&columns, payload, payloadLength, compressed);
+
+	TripTrack *track = nil;
+	if(decoded)
+	{
+		track = [[self alloc] initWithCapacity:count startTime:[NSDate dateWithTimeIntervalSinceReferenceDate:header.startTime]];
+		int64_t startMilliseconds = llround(header.startTime * 1000.0);
+		float values[TripTrackChannelCount];
+		for(NSUInteger i = 0; i < count; i++)
+		{
+			BOOL bluetooth = hasBluetooth && columns.presence[i];
+			if(bluetooth)
+			{
+				for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+				{
+					int32_t value = columns.channels[channel][i];
+					values[channel] = value == TRACK_MISSING_VALUE ? NAN : (float)value;
+				}
+			}
+			[track appendLatitude:columns.latitudes[i] / 1e7 longitude:columns.longitudes[i] / 1e7 timestamp:(startMilliseconds + columns.times[i]) / 1000.0
+							speed:columns.speeds[i] / 100.0f altitude:columns.altitudes[i] bluetoothValues:bluetooth ? values : NULL];
+		}
+		track.channels = trackChannels;
+	}
+	TrackColumnsFree(&columns);
+	return track;
+}
+
+-(void)dealloc
+{
+	free(latitudes);
+	free(longitudes);
+	free(timestamps);
+	free(speeds);
+	free(altitudes);
+	free(metersFromStart);
+	free(bluetoothFlags);
+	for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+		free(channels[channel]);
+}
+
+#pragma mark - Appending
+
+-(void)reserveCapacity:(NSUInteger)newCapacity
+{
+	if(newCapacity <= capacity)
+		return;
+	latitudes = realloc(latitudes, newCapacity * sizeof(double));
+	longitudes = realloc(longitudes, newCapacity * sizeof(double));
+	timestamps = realloc(timestamps, newCapacity * sizeof(double));
+	speeds = realloc(speeds, newCapacity * sizeof(float));
+	altitudes = realloc(altitudes, newCapacity * sizeof(float));
+	metersFromStart = realloc(metersFromStart, newCapacity * sizeof(double));
+	if(bluetoothFlags)
+	{
+		bluetoothFlags = realloc(bluetoothFlags, newCapacity);
+		for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+			channels[channel] = realloc(channels[channel], newCapacity * sizeof(float));
+	}
+	capacity = newCapacity;
+}
+
+-(void)appendLatitude:(double)latitude longitude:(double)longitude timestamp:(NSTimeInterval)timestamp speed:(float)speed altitude:(float)altitude bluetoothValues:(const float *)bluetoothValues
+{
+	if(_count == capacity)
+		[self reserveCapacity:capacity * 2];
+
+	NSUInteger i = _count;
+	latitudes[i] = latitude;
+	longitudes[i] = longitude;
+	timestamps[i] = timestamp;
+	speeds[i] = speed;
+	altitudes[i] = altitude;
+	metersFromStart[i] = i == 0 ? 0 : metersFromStart[i-1] + TrackDistance(latitudes[i-1], longitudes[i-1], latitude, longitude);
+
+	if(bluetoothValues && !bluetoothFlags)
+	{
+		bluetoothFlags = calloc(capacity, 1);
+		for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+			channels[channel] = malloc(capacity * sizeof(float));
+	}
+	if(bluetoothFlags)
+	{
+		bluetoothFlags[i] = bluetoothValues != NULL;
+		for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+			channels[channel][i] = bluetoothValues ? bluetoothValues[channel] : NAN;
+	}
+	_count++;
+}
+
+#pragma mark - Simplifying
+
+//Distance in meters from point p to segment ab, all projected onto a local plane
+static double SegmentDistance(double px, double py, double ax, double ay, double bx, double by)
+{
+	double dx = bx - ax, dy = by - ay;
+	double lengthSquared = dx * dx + dy * dy;
+	double t = lengthSquared > 0 ? ((px - ax) * dx + (py - ay) * dy) / lengthSquared : 0;
+	t = MAX(0, MIN(1, t));
+	double ex = ax + t * dx - px, ey = ay + t * dy - py;
+	return sqrt(ex * ex + ey * ey);
+}
+
+//Douglas-Peucker with an explicit stack so long tracks can't overflow the call stack. keep must be zeroed
+static void TrackSimplify(const double *latitudes, const double *longitudes, size_t count, double tolerance, uint8_t *keep)
+{
+	if(count == 0)
+		return;
+	keep[0] = keep[count-1] = 1;
+	if(count < 3)
+		return;
+
+	//Equirectangular projection around the first fix; plenty for the extent of one trip
+	double metersPerDegree = EARTH_RADIUS * M_PI / 180.0;
+	double metersPerLongitude = metersPerDegree * cos(latitudes[0] * M_PI / 180.0);
+	double *x = malloc(count * sizeof(double)), *y = malloc(count * sizeof(double));
+	for(size_t i = 0; i < count; i++)
+	{
+		x[i] = (longitudes[i] - longitudes[0]) * metersPerLongitude;
+		y[i] = (latitudes[i] - latitudes[0]) * metersPerDegree;
+	}
+
+	size_t *stack = malloc(2 * count * sizeof(size_t));
+	size_t depth = 0;
+	stack[depth++] = 0;
+	stack[depth++] = count - 1;
+	while(depth > 0)
+	{
+		size_t last = stack[--depth], first = stack[--depth];
+		double maxDistance = 0;
+		size_t farthest = first;
+		for(size_t i = first + 1; i < last; i++)
+		{
+			double distance = SegmentDistance(x[i], y[i], x[first], y[first], x[last], y[last]);
+			if(distance > maxDistance)
+			{
+				maxDistance = distance;
+				farthest = i;
+			}
+		}
+		if(maxDistance <= tolerance)
+			continue;
+		keep[farthest] = 1;
+		stack[depth++] = first;
+		stack[depth++] = farthest;
+		stack[depth++] = farthest;
+		stack[depth++] = last;
+	}
+	free(stack);
+	free(x);
+	free(y);
+}
+
+-(NSIndexSet *)indexesSimplifiedWithTolerance:(double)toleranceMeters
+{
+	uint8_t *keep = calloc(MAX(_count, 1), 1);
+	TrackSimplify(latitudes, longitudes, _count, toleranceMeters, keep);
+	NSMutableIndexSet *indexes = [NSMutableIndexSet indexSet];
+	for(NSUInteger i = 0; i < _count; i++)
+	{
+		if(keep[i])
+			[indexes addIndex:i];
+	}
+	free(keep);
+	return indexes;
+}
+
+-(NSIndexSet *)indexesSimplifiedWithTolerance:(double)toleranceMeters withinIndexes:(NSIndexSet *)indexes
+{
+	NSUInteger count = indexes.count;
+	NSUInteger *subset = malloc(MAX(count, 1) * sizeof(NSUInteger));
+	double *subsetLatitudes = malloc(MAX(count, 1) * sizeof(double));
+	double *subsetLongitudes = malloc(MAX(count, 1) * sizeof(double));
+	[indexes getIndexes:subset maxCount:count inIndexRange:nil];
+	for(NSUInteger i = 0; i < count; i++)
+	{
+		subsetLatitudes[i] = latitudes[subset[i]];
+		subsetLongitudes[i] = longitudes[subset[i]];
+	}
+
+	uint8_t *keep = calloc(MAX(count, 1), 1);
+	TrackSimplify(subsetLatitudes, subsetLongitudes, count, toleranceMeters, keep);
+	NSMutableIndexSet *kept = [NSMutableIndexSet indexSet];
+	for(NSUInteger i = 0; i < count; i++)
+	{
+		if(keep[i])
+			[kept addIndex:subset[i]];
+	}
+	free(keep);
+	free(subset);
+	free(subsetLatitudes);
+	free(subsetLongitudes);
+	return kept;
+}
+
+-(TripTrack *)trackWithIndexes:(NSIndexSet *)indexes
+{
+	TripTrack *track = [[TripTrack alloc] initWithCapacity:indexes.count startTime:self.startTime];
+	track.channels = self.channels;
+	float values[TripTrackChannelCount];
+	for(NSUInteger i = [indexes firstIndex]; i != NSNotFound; i = [indexes indexGreaterThanIndex:i])
+	{
+		BOOL hasValues = bluetoothFlags && bluetoothFlags[i];
+		for(NSInteger channel = 0; hasValues && channel < TripTrackChannelCount; channel++)
+			values[channel] = channels[channel][i];
+		[track appendLatitude:latitudes[i] longitude:longitudes[i] timestamp:timestamps[i] speed:speeds[i] altitude:altitudes[i] bluetoothValues:hasValues ? values : NULL];
+	}
+	return track;
+}
+
+#pragma mark - Encoding
+
+-(NSData *)dataRepresentation
+{
+	NSUInteger count = self.count;
+	TrackColumns columns;
+	BOOL hasColumns = bluetoothFlags != NULL;
+	TrackColumnsAllocate(&columns, count, hasColumns);
+
+	//Times are taken from the rounded start so rounding errors don't accumulate
+	int64_t startMilliseconds = llround(self.startTime.timeIntervalSinceReferenceDate * 1000.0);
+	for(NSUInteger i = 0; i < count; i++)
+	{
+		columns.latitudes[i] = (int32_t)lround(latitudes[i] * 1e7);
+		columns.longitudes[i] = (int32_t)lround(longitudes[i] * 1e7);
+		int64_t milliseconds = llround(timestamps[i] * 1000.0) - startMilliseconds;
+		columns.times[i] = (int32_t)MAX(MIN(milliseconds, (int64_t)INT32_MAX), (int64_t)INT32_MIN);
+		columns.speeds[i] = (int32_t)MIN(MAX(lroundf(speeds[i] * 100.0f), 0L), (long)UINT16_MAX);
+		columns.altitudes[i] = (int32_t)MIN(MAX(lroundf(altitudes[i]), (long)INT16_MIN), (long)INT16_MAX);
+		if(hasColumns)
+		{
+			columns.presence[i] = bluetoothFlags[i];
+			for(NSInteger channel = 0; channel < TripTrackChannelCount; channel++)
+			{
+				float value = channels[channel][i];
+				columns.channels[channel][i] = isnan(value) ? TRACK_MISSING_VALUE : (int32_t)lroundf(value);
+			}
+		}
+	}
+
+	NSMutableData *payload = [NSMutableData dataWithLength:TrackColumnsWriteBound(&columns)];
+	size_t payloadLength = TrackColumnsWrite(&columns, payload.mutableBytes);
+	TrackColumnsFree(&columns);
+
+	//LZ only pays off on long trips with repeating patterns, keep whichever is smaller
+	NSMutableData *compressed = [NSMutableData dataWithLength:TrackCodecCompressBound(payloadLength) + 10];
+	size_t compressedLength = 0;
+	if(payloadLength > 0)
+	{
+		uint8_t *bytes = compressed.mutableBytes;
+		size_t prefix = TrackCodecWriteVarint(payloadLength, bytes);
+		size_t blockLength = TrackCodecCompress(payload.bytes, payloadLength, bytes + prefix, compressed.length - prefix);
+		compressedLength = blockLength ? prefix + blockLength : 0;
+	}
+	BOOL useCompressed = compressedLength > 0 && compressedLength < payloadLength;
+
+	NSData *channelsData = self.channels.keys.count > 0 ? [self.channels dataRepresentationWithStartTime:startMilliseconds / 1000.0] : nil;
+	uint16_t flags = (hasColumns ? TRACK_FLAG_BLUETOOTH : 0) | (useCompressed ? TRACK_FLAG_COMPRESSED : 0) | (channelsData ? TRACK_FLAG_CHANNELS : 0);
+	TrackHeader header = {TRACK_MAGIC, TRACK_VERSION, flags, (uint32_t)count, 0, startMilliseconds / 1000.0};
+	size_t columnsLength = useCompressed ? compressedLength : payloadLength;
+	NSMutableData *data = [NSMutableData dataWithCapacity:sizeof(TrackHeader) + 10 + columnsLength + channelsData.length];
+	[data appendBytes:&header length:sizeof(TrackHeader)];
+	if(channelsData)
+	{
+		uint8_t prefix[10];
+		[data appendBytes:prefix length:TrackCodecWriteVarint(columnsLength, prefix)];
+	}
+	[data appendBytes:useCompressed ? compressed.bytes : payload.bytes length:columnsLength];
+	[data appendData:channelsData];
+	return data;
+}
+
+#pragma mark - Accessors
+
+-(const double *)latitudes
+{
+	return latitudes;
+}
+
+-(const double *)longitudes
+{
+	return longitudes;
+}
+
+-(const double *)timestamps
+{
+	return timestamps;
+}
+
+-(const float *)speeds
+{
+	return speeds;
+}
+
+-(const float *)altitudes
+{
+	return altitudes;
+}
+
+-(const double *)metersFromStart
+{
+	return metersFromStart;
+}
+
+-(CLLocationCoordinate2D)coordinateAtIndex:(NSUInteger)index
+{
+	return CLLocationCoordinate2DMake(latitudes[index], longitudes[index]);
+}
+
+-(NSDate *)dateAtIndex:(NSUInteger)index
+{
+	return [NSDate dateWithTimeIntervalSinceReferenceDate:timestamps[index]];
+}
+
+-(BOOL)hasBluetoothData
+{
+	return bluetoothFlags != NULL || self.channels.keys.count > 0;
+}
+
+-(BOOL)hasBluetoothDataAtIndex:(NSUInteger)index
+{
+	if(bluetoothFlags)
+		return bluetoothFlags[index];
+	return [self.channels hasValuesAtTimestamp:timestamps[index]];
+}
+
+-(float)valueForChannel:(TripTrackChannel)channel atIndex:(NSUInteger)index
+{
+	if(bluetoothFlags)
+		return channels[channel][index];
+	if(!self.channels)
+		return NAN;
+	double value = [self.channels valueForKey:trackChannelKeys[channel] atTimestamp:timestamps[index]];
+	return channel == TripTrackChannelSpeed ? value * KPH_TO_MPH : value; //BLEManager reports km/h
+}
+
+-(void)getValues:(float *)values forChannel:(TripTrackChannel)channel
+{
+	if(bluetoothFlags)
+	{
+		memcpy(values, channels[channel], _count * sizeof(float));
+		return;
+	}
+	for(NSUInteger i = 0; i < _count; i++)
+		values[i] = [self valueForChannel:channel atIndex:i];
+}
+
+-(void)getGrades:(float *)grades
+{
+	NSUInteger from = 0;
+	for(NSUInteger i = 0; i < _count; i++)
+	{
+		while(from + 1 < i && metersFromStart[i] - metersFromStart[from + 1] >= GRADE_MIN_METERS)
+			from++;
+		double meters = metersFromStart[i] - metersFromStart[from];
+		grades[i] = meters >= GRADE_MIN_METERS ? (float)((altitudes[i] - altitudes[from]) * FEET_TO_METERS / meters * 100.0) : NAN;
+	}
+}
+
+-(void)getAccelerations:(float *)accelerations
+{
+	for(NSUInteger i = 0; i < _count; i++)
+	{
+		double seconds = i > 0 ? timestamps[i] - timestamps[i-1] : 0;
+		accelerations[i] = seconds > 0 ? (float)((speeds[i] - speeds[i-1]) / seconds) : NAN;
+	}
+}
+
+-(double)fuelUsed
+{
+	if(!bluetoothFlags)
+	{
+		double first = [self.channels firstValueForKey:trackChannelKeys[TripTrackChannelFuel]];
+		double last = [self.channels lastValueForKey:trackChannelKeys[TripTrackChannelFuel]];
+		return isnan(first) ? 0 : MAX(0, first - last);
+	}
+	const float *fuel = channels[TripTrackChannelFuel];
+	float first = NAN, last = NAN;
+	for(NSUInteger i = 0; i < _count; i++)
+	{
+		if(isnan(fuel[i]))
+			continue;
+		if(isnan(first))
+			first = fuel[i];
+		last = fuel[i];
+	}
+	return isnan(first) ? 0 : MAX(0, first - last);
+}
+
+@end
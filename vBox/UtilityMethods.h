@@ -12,5 +12,7 @@
 
 +(NSString *)durationInStringOfTimeIntervalFrom:(NSDate *)starTime to:(NSDate *)endTime;
 +(NSString *)formattedStringFromDate:(NSDate *)date;
+//! Logs how long something took and reports it to analytics, bucketed so dashboards stay readable
++(void)trackPerformanceEvent:(NSString *)event duration:(NSTimeInterval)duration dimensions:(NSDictionary *)dimensions;
 
 @end
@@ -7,6 +7,7 @@
 //
 
 #import "UtilityMethods.h"
+#import <Parse/Parse.h>
 
 @implementation UtilityMethods
 
@@ -27,4 +28,18 @@
     return [dateFormatter stringFromDate:date];
 }
 
++(void)trackPerformanceEvent:(NSString *)event duration:(NSTimeInterval)duration dimensions:(NSDictionary *)dimensions
+{
+    double milliseconds = duration * 1000.0;
+    NSLog(@"[Performance] %@: %.2f ms %@",event,milliseconds,dimensions ? dimensions : @"");
+    
+    //PFAnalytics dimensions are strings, so report powers of two instead of raw values
+    long bucket = 1;
+    while(bucket < milliseconds && bucket < (1L << 20))
+        bucket <<= 1;
+    NSMutableDictionary *allDimensions = [NSMutableDictionary dictionaryWithDictionary:dimensions];
+    allDimensions[@"ms"] = [NSString stringWithFormat:@"<=%ld",bucket];
+    [PFAnalytics trackEventInBackground:event dimensions:allDimensions block:nil];
+}
+
 @end
@@ -0,0 +1,98 @@
+//
+//  RouteColoringBenchmark.c
+//  vBoxTests
+//
+//  Created by Rosbel Sanroman on 10/20/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+/*
+ Standalone timing of RouteColoring, for machines without Xcode. Not part of the test target;
+ build and run it from the repository root with
+
+	cc -std=c99 -O2 -I vBox vBoxTests/RouteColoringBenchmark.c vBox/RouteColoring.c -lm -o /tmp/RouteColoringBenchmark
+	/tmp/RouteColoringBenchmark [fix count]
+
+ The channel is the same speed walk testColoringThroughput uses, and each scheme reports the
+ best of BENCHMARK_RUNS so the numbers compare across machines.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include "RouteColoring.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCHMARK_COUNT 100000 //a long drive at 1Hz
+#define BENCHMARK_BUCKETS 4
+#define BENCHMARK_RUNS 50
+
+static uint64_t fuzzState = 0x9E3779B97F4A7C15ull;
+
+static uint32_t FuzzRandom(void)
+{
+	fuzzState ^= fuzzState << 13;
+	fuzzState ^= fuzzState >> 7;
+	fuzzState ^= fuzzState << 17;
+	return (uint32_t)(fuzzState >> 32);
+}
+
+static double Now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+typedef size_t (*BoundsFunction)(const float *values, size_t count, int bucketCount, float *bounds);
+
+//Bounds, classify and runs: the work of one recolor. @return the best time in seconds
+static double TimeColoring(BoundsFunction boundsFunction, const float *values, size_t count, uint8_t *buckets, uint8_t *runBuckets, uint32_t *runLengths, size_t *runCount)
+{
+	double best = INFINITY;
+	for(int run = 0; run < BENCHMARK_RUNS; run++)
+	{
+		float bounds[ROUTE_COLORING_MAX_BUCKETS];
+		double start = Now();
+		size_t boundCount = boundsFunction(values, count, BENCHMARK_BUCKETS, bounds);
+		RouteColoringClassify(values, count, bounds, boundCount, buckets);
+		*runCount = RouteColoringRuns(buckets, count, runBuckets, runLengths);
+		best = fmin(best, Now() - start);
+	}
+	return best;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : BENCHMARK_COUNT;
+	float *values = malloc((count ? count : 1) * sizeof(float));
+	uint8_t *buckets = malloc(count ? count : 1);
+	uint8_t *runBuckets = malloc(count ? count : 1);
+	uint32_t *runLengths = malloc((count ? count : 1) * sizeof(uint32_t));
+	if(!values || !buckets || !runBuckets || !runLengths)
+	{
+		fprintf(stderr, "Could not allocate %lu fixes\n", (unsigned long)count);
+		return 1;
+	}
+
+	//A speed walk that never goes negative, with an OBD dropout every so often
+	float speed = 30;
+	for(size_t i = 0; i < count; i++)
+	{
+		speed = fmaxf(0, speed + (float)((int)(FuzzRandom() % 101) - 50) / 100.0f);
+		values[i] = FuzzRandom() % 5000 == 0 ? NAN : speed;
+	}
+
+	size_t linearRuns = 0, quantileRuns = 0;
+	double linearTime = TimeColoring(RouteColoringLinearBounds, values, count, buckets, runBuckets, runLengths, &linearRuns);
+	double quantileTime = TimeColoring(RouteColoringQuantileBounds, values, count, buckets, runBuckets, runLengths, &quantileRuns);
+	printf("[Benchmark] route coloring, %lu fixes, %d buckets, best of %d: linear %.2f ms (%lu runs), quantile %.2f ms (%lu runs)\n",
+		   (unsigned long)count, BENCHMARK_BUCKETS, BENCHMARK_RUNS, linearTime * 1000, (unsigned long)linearRuns, quantileTime * 1000, (unsigned long)quantileRuns);
+
+	free(values);
+	free(buckets);
+	free(runBuckets);
+	free(runLengths);
+	return 0;
+}
@@ -0,0 +1,246 @@
+//
+//  RouteColoringTests.m
+//  vBoxTests
+//
+//  Created by Rosbel Sanroman on 10/20/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "RouteColoring.h"
+
+#define FUZZ_ROUNDS 200
+#define FUZZ_MAX_COUNT 2000 //spans several classify blocks and a partial one
+#define BENCHMARK_COUNT 100000 //a long drive at 1Hz
+#define BENCHMARK_BUCKETS 4
+
+//Deterministic so a failing round can be replayed
+static uint64_t fuzzState;
+
+static uint32_t FuzzRandom(void)
+{
+	fuzzState ^= fuzzState << 13;
+	fuzzState ^= fuzzState >> 7;
+	fuzzState ^= fuzzState << 17;
+	return (uint32_t)(fuzzState >> 32);
+}
+
+//A speed channel: a walk that never goes negative, with a NAN gap every so often as when OBD drops out
+static void FillSpeedWalk(float *values, size_t count, uint32_t gapInterval)
+{
+	float speed = 30;
+	for(size_t i = 0; i < count; i++)
+	{
+		speed = fmaxf(0, speed + ((int)(FuzzRandom() % 101) - 50) / 100.0f);
+		values[i] = gapInterval && FuzzRandom() % gapInterval == 0 ? NAN : speed;
+	}
+}
+
+//What RouteColoringClassify must agree with, one value at a time
+static uint8_t ScalarBucket(float value, const float *bounds, size_t boundCount)
+{
+	if(isnan(value))
+		return ROUTE_COLORING_NO_VALUE;
+	uint8_t bucket = 0;
+	while(bucket < boundCount && value > bounds[bucket])
+		bucket++;
+	return bucket;
+}
+
+@interface RouteColoringTests : XCTestCase
+
+@end
+
+@implementation RouteColoringTests
+
+-(void)setUp
+{
+	[super setUp];
+	fuzzState = 0x9E3779B97F4A7C15ull;
+}
+
+#pragma mark - Bounds
+
+-(void)testLinearBounds
+{
+	float values[100], bounds[ROUTE_COLORING_MAX_BUCKETS];
+	for(int i = 0; i < 100; i++)
+		values[i] = i;
+	values[50] = NAN;
+	XCTAssertEqual(RouteColoringLinearBounds(values, 100, 4, bounds), (size_t)3);
+	XCTAssertEqualWithAccuracy(bounds[0], 24.75f, 1e-4);
+	XCTAssertEqualWithAccuracy(bounds[1], 49.5f, 1e-4);
+	XCTAssertEqualWithAccuracy(bounds[2], 74.25f, 1e-4);
+	XCTAssertEqual(RouteColoringLinearBounds(values, 100, 100, bounds), (size_t)(ROUTE_COLORING_MAX_BUCKETS - 1), @"bucket count is clamped");
+}
+
+-(void)testQuantileBoundsBalanceBuckets
+{
+	float *values = malloc(BENCHMARK_COUNT * sizeof(float));
+	uint8_t *buckets = malloc(BENCHMARK_COUNT);
+	FillSpeedWalk(values, BENCHMARK_COUNT, 0);
+	float bounds[ROUTE_COLORING_MAX_BUCKETS];
+	size_t boundCount = RouteColoringQuantileBounds(values, BENCHMARK_COUNT, BENCHMARK_BUCKETS, bounds);
+	XCTAssertEqual(boundCount, (size_t)(BENCHMARK_BUCKETS - 1));
+	RouteColoringClassify(values, BENCHMARK_COUNT, bounds, boundCount, buckets);
+
+	size_t counts[BENCHMARK_BUCKETS] = {0};
+	for(size_t i = 0; i < BENCHMARK_COUNT; i++)
+		counts[buckets[i]]++;
+	//Bounds fall on histogram bin edges, so each bucket is off by at most a bin's worth of fixes
+	for(int b = 0; b < BENCHMARK_BUCKETS; b++)
+		XCTAssertEqualWithAccuracy((double)counts[b], BENCHMARK_COUNT / BENCHMARK_BUCKETS, BENCHMARK_COUNT * 0.02, @"bucket %d", b);
+	free(values);
+	free(buckets);
+}
+
+-(void)testBoundsOfDegenerateChannels
+{
+	float bounds[ROUTE_COLORING_MAX_BUCKETS];
+	float missing[3] = {NAN, NAN, NAN};
+	XCTAssertEqual(RouteColoringLinearBounds(missing, 3, 4, bounds), (size_t)0);
+	XCTAssertEqual(RouteColoringQuantileBounds(missing, 3, 4, bounds), (size_t)0);
+	XCTAssertEqual(RouteColoringQuantileBounds(missing, 0, 4, bounds), (size_t)0);
+
+	float parked[4] = {0, 0, NAN, 0};
+	XCTAssertEqual(RouteColoringQuantileBounds(parked, 4, 4, bounds), (size_t)3);
+	uint8_t buckets[4];
+	RouteColoringClassify(parked, 4, bounds, 3, buckets);
+	XCTAssertEqual(buckets[0], 0);
+	XCTAssertEqual(buckets[2], ROUTE_COLORING_NO_VALUE);
+
+	RouteColoringClassify(parked, 4, bounds, 0, buckets);
+	XCTAssertEqual(buckets[3], 0, @"no bounds puts every finite value in bucket 0");
+}
+
+-(void)testBoundsIgnoreInfinities
+{
+	float bounds[ROUTE_COLORING_MAX_BUCKETS];
+	float spiked[6] = {0, INFINITY, 10, -INFINITY, 20, 30};
+	XCTAssertEqual(RouteColoringLinearBounds(spiked, 6, 4, bounds), (size_t)3);
+	XCTAssertEqualWithAccuracy(bounds[0], 7.5f, 1e-4);
+	XCTAssertEqualWithAccuracy(bounds[2], 22.5f, 1e-4);
+	XCTAssertEqual(RouteColoringQuantileBounds(spiked, 6, 4, bounds), (size_t)3);
+	for(int i = 0; i < 3; i++)
+		XCTAssert(isfinite(bounds[i]) && bounds[i] >= 0 && bounds[i] <= 30, @"bound %d is %f", i, bounds[i]);
+
+	float onlyInfinite[2] = {INFINITY, -INFINITY};
+	XCTAssertEqual(RouteColoringQuantileBounds(onlyInfinite, 2, 4, bounds), (size_t)0);
+}
+
+//Ranges whose width underflows or overflows a float must still give finite, ordered bounds
+-(void)testBoundsOfExtremeRanges
+{
+	float bounds[ROUTE_COLORING_MAX_BUCKETS];
+	float denormal[4] = {0, 1e-45f, 0, 1e-45f};
+	float huge[4] = {-3e38f, 3e38f, 0, 1};
+	float *channels[2] = {denormal, huge};
+	for(int c = 0; c < 2; c++)
+	{
+		XCTAssertEqual(RouteColoringLinearBounds(channels[c], 4, 4, bounds), (size_t)3);
+		for(int i = 0; i < 3; i++)
+			XCTAssert(isfinite(bounds[i]) && (i == 0 || bounds[i-1] <= bounds[i]), @"linear channel %d bound %d is %g", c, i, bounds[i]);
+		XCTAssertEqual(RouteColoringQuantileBounds(channels[c], 4, 4, bounds), (size_t)3);
+		for(int i = 0; i < 3; i++)
+			XCTAssert(isfinite(bounds[i]) && (i == 0 || bounds[i-1] <= bounds[i]), @"quantile channel %d bound %d is %g", c, i, bounds[i]);
+	}
+}
+
+#pragma mark - Classifying
+
+-(void)testClassifyMatchesScalar
+{
+	float *values = malloc(FUZZ_MAX_COUNT * sizeof(float));
+	uint8_t *buckets = malloc(FUZZ_MAX_COUNT);
+	float bounds[ROUTE_COLORING_MAX_BUCKETS];
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		size_t count = FuzzRandom() % FUZZ_MAX_COUNT;
+		FillSpeedWalk(values, count, 50);
+		size_t boundCount = round % 2 ? RouteColoringQuantileBounds(values, count, 1 + round % ROUTE_COLORING_MAX_BUCKETS, bounds)
+									  : RouteColoringLinearBounds(values, count, 1 + round % ROUTE_COLORING_MAX_BUCKETS, bounds);
+		RouteColoringClassify(values, count, bounds, boundCount, buckets);
+		for(size_t i = 0; i < count; i++)
+		{
+			if(buckets[i] != ScalarBucket(values[i], bounds, boundCount))
+			{
+				XCTFail(@"round %d fix %lu: bucket %d, expected %d", round, (unsigned long)i, buckets[i], ScalarBucket(values[i], bounds, boundCount));
+				break;
+			}
+		}
+	}
+	free(values);
+	free(buckets);
+}
+
+-(void)testRunsExpandToBuckets
+{
+	uint8_t *buckets = malloc(FUZZ_MAX_COUNT);
+	uint8_t *runBuckets = malloc(FUZZ_MAX_COUNT);
+	uint32_t *runLengths = malloc(FUZZ_MAX_COUNT * sizeof(uint32_t));
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		size_t count = FuzzRandom() % FUZZ_MAX_COUNT, changes = 0;
+		uint8_t bucket = 0;
+		for(size_t i = 0; i < count; i++)
+		{
+			if(FuzzRandom() % 16 == 0)
+				bucket = FuzzRandom() % 5 == 0 ? ROUTE_COLORING_NO_VALUE : (uint8_t)(FuzzRandom() % 4);
+			changes += i > 0 && bucket != buckets[i-1];
+			buckets[i] = bucket;
+		}
+		size_t runCount = RouteColoringRuns(buckets, count, runBuckets, runLengths);
+		XCTAssertEqual(runCount, count > 0 ? changes + 1 : 0, @"round %d", round);
+
+		size_t position = 0;
+		for(size_t r = 0; r < runCount; r++)
+		{
+			XCTAssertGreaterThan(runLengths[r], 0u);
+			if(r > 0)
+				XCTAssertNotEqual(runBuckets[r], runBuckets[r-1], @"round %d: adjacent runs should have been merged", round);
+			for(uint32_t j = 0; j < runLengths[r] && position < count; j++, position++)
+				XCTAssertEqual(buckets[position], runBuckets[r], @"round %d fix %lu", round, (unsigned long)position);
+		}
+		XCTAssertEqual(position, count, @"round %d", round);
+	}
+	free(buckets);
+	free(runBuckets);
+	free(runLengths);
+}
+
+#pragma mark - Benchmarks
+
+//Bounds, classify and runs over a long drive, the work of one recolor, logged so runs on different devices compare
+-(void)testColoringThroughput
+{
+	float *values = malloc(BENCHMARK_COUNT * sizeof(float));
+	uint8_t *buckets = malloc(BENCHMARK_COUNT);
+	uint8_t *runBuckets = malloc(BENCHMARK_COUNT);
+	uint32_t *runLengths = malloc(BENCHMARK_COUNT * sizeof(uint32_t));
+	FillSpeedWalk(values, BENCHMARK_COUNT, 5000);
+	__block CFTimeInterval linearTime = 0, quantileTime = 0;
+	__block size_t runCount = 0;
+	[self measureBlock:^{
+		float bounds[ROUTE_COLORING_MAX_BUCKETS];
+		CFTimeInterval start = CACurrentMediaTime();
+		size_t boundCount = RouteColoringLinearBounds(values, BENCHMARK_COUNT, BENCHMARK_BUCKETS, bounds);
+		RouteColoringClassify(values, BENCHMARK_COUNT, bounds, boundCount, buckets);
+		RouteColoringRuns(buckets, BENCHMARK_COUNT - 1, runBuckets, runLengths);
+		CFTimeInterval middle = CACurrentMediaTime();
+		boundCount = RouteColoringQuantileBounds(values, BENCHMARK_COUNT, BENCHMARK_BUCKETS, bounds);
+		RouteColoringClassify(values, BENCHMARK_COUNT, bounds, boundCount, buckets);
+		runCount = RouteColoringRuns(buckets, BENCHMARK_COUNT - 1, runBuckets, runLengths);
+		linearTime += middle - start;
+		quantileTime += CACurrentMediaTime() - middle;
+	}];
+	XCTAssertGreaterThan(runCount, (size_t)0);
+	//measureBlock runs 10 times
+	NSLog(@"[Benchmark] route coloring, %d fixes, %d buckets: linear %.2f ms, quantile %.2f ms, %lu runs", BENCHMARK_COUNT, BENCHMARK_BUCKETS, linearTime * 100, quantileTime * 100, (unsigned long)runCount);
+	free(values);
+	free(buckets);
+	free(runBuckets);
+	free(runLengths);
+}
+
+@end
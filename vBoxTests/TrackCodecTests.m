@@ -0,0 +1,304 @@
+//
+//  TrackCodecTests.m
+//  vBoxTests
+//
+//  Created by Rosbel Sanroman on 10/20/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "TrackCodec.h"
+#import "TripTrack.h"
+
+#define FUZZ_ROUNDS 200
+#define FUZZ_MAX_COUNT 4096
+#define BENCHMARK_COUNT 1000000 //a million fixes, the size of the largest stores we've seen
+
+//Deterministic so a failing round can be replayed
+static uint64_t fuzzState;
+
+static uint32_t FuzzRandom(void)
+{
+	fuzzState ^= fuzzState << 13;
+	fuzzState ^= fuzzState >> 7;
+	fuzzState ^= fuzzState << 17;
+	return (uint32_t)(fuzzState >> 32);
+}
+
+//Mixes the shapes the track columns take: steady steps, repeats, noise and the int32 extremes
+static void FuzzFillColumn(int32_t *values, size_t count)
+{
+	int32_t value = (int32_t)FuzzRandom();
+	int32_t step = (int32_t)(FuzzRandom() % 2001) - 1000;
+	for(size_t i = 0; i < count; i++)
+	{
+		switch(FuzzRandom() % 8)
+		{
+			case 0: value = (int32_t)FuzzRandom(); break;
+			case 1: value = FuzzRandom() & 1 ? INT32_MAX : INT32_MIN; break;
+			case 2: break; //repeat
+			default: value = (int32_t)((uint32_t)value + (uint32_t)step + FuzzRandom() % 3 - 1); break;
+		}
+		values[i] = value;
+	}
+}
+
+@interface TrackCodecTests : XCTestCase
+
+@end
+
+@implementation TrackCodecTests
+
+-(void)setUp
+{
+	[super setUp];
+	fuzzState = 0x9E3779B97F4A7C15ull;
+}
+
+#pragma mark - Round Trips
+
+-(void)testDeltasRoundTrip
+{
+	int32_t *values = malloc(FUZZ_MAX_COUNT * sizeof(int32_t));
+	int32_t *decoded = malloc(FUZZ_MAX_COUNT * sizeof(int32_t));
+	uint8_t *encoded = malloc(TrackCodecDeltaBound(FUZZ_MAX_COUNT));
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		size_t count = FuzzRandom() % FUZZ_MAX_COUNT;
+		int order = 1 + round % 2;
+		FuzzFillColumn(values, count);
+		size_t length = TrackCodecEncodeDeltas(values, count, order, encoded);
+		XCTAssertLessThanOrEqual(length, TrackCodecDeltaBound(count));
+		XCTAssertEqual(TrackCodecDecodeDeltas(encoded, length, order, decoded, count), length, @"round %d", round);
+		XCTAssertEqual(memcmp(values, decoded, count * sizeof(int32_t)), 0, @"round %d", round);
+		if(count > 0)
+			XCTAssertEqual(TrackCodecDecodeDeltas(encoded, length - 1, order, decoded, count), (size_t)0, @"truncated round %d", round);
+	}
+	free(values);
+	free(decoded);
+	free(encoded);
+}
+
+-(void)testRunsRoundTrip
+{
+	int32_t *values = malloc(FUZZ_MAX_COUNT * sizeof(int32_t));
+	int32_t *decoded = malloc(FUZZ_MAX_COUNT * sizeof(int32_t));
+	uint8_t *encoded = malloc(TrackCodecRunBound(FUZZ_MAX_COUNT));
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		size_t count = FuzzRandom() % FUZZ_MAX_COUNT;
+		FuzzFillColumn(values, count);
+		size_t length = TrackCodecEncodeRuns(values, count, encoded);
+		XCTAssertLessThanOrEqual(length, TrackCodecRunBound(count));
+		XCTAssertEqual(TrackCodecDecodeRuns(encoded, length, decoded, count), length, @"round %d", round);
+		XCTAssertEqual(memcmp(values, decoded, count * sizeof(int32_t)), 0, @"round %d", round);
+		if(count > 0)
+			XCTAssertEqual(TrackCodecDecodeRuns(encoded, length - 1, decoded, count), (size_t)0, @"truncated round %d", round);
+	}
+	free(values);
+	free(decoded);
+	free(encoded);
+}
+
+-(void)testBlocksRoundTrip
+{
+	size_t maxLength = FUZZ_MAX_COUNT * sizeof(int32_t);
+	int32_t *values = malloc(FUZZ_MAX_COUNT * sizeof(int32_t));
+	uint8_t *raw = malloc(maxLength);
+	uint8_t *compressed = malloc(TrackCodecCompressBound(maxLength));
+	uint8_t *decompressed = malloc(maxLength);
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		//Varint encoded columns are what the blocks compress in practice
+		size_t count = FuzzRandom() % (FUZZ_MAX_COUNT / 4);
+		FuzzFillColumn(values, count);
+		size_t length = round % 2 ? TrackCodecEncodeDeltas(values, count, 2, raw) : count * sizeof(int32_t);
+		if(round % 2 == 0)
+			memcpy(raw, values, length);
+		size_t compressedLength = TrackCodecCompress(raw, length, compressed, TrackCodecCompressBound(length));
+		XCTAssertGreaterThan(compressedLength, (size_t)0, @"round %d", round);
+		XCTAssertEqual(TrackCodecDecompress(compressed, compressedLength, decompressed, length), length, @"round %d", round);
+		XCTAssertEqual(memcmp(raw, decompressed, length), 0, @"round %d", round);
+		if(length > 0)
+			XCTAssertEqual(TrackCodecDecompress(compressed, compressedLength, decompressed, length - 1), (size_t)0, @"short capacity round %d", round);
+	}
+	free(values);
+	free(raw);
+	free(compressed);
+	free(decompressed);
+}
+
+//Decoders are run on whatever is read back from disk, so garbage must fail cleanly, never overrun
+-(void)testDecodersRejectGarbage
+{
+	uint8_t garbage[512];
+	int32_t values[256];
+	uint8_t out[1024];
+	for(int round = 0; round < FUZZ_ROUNDS * 10; round++)
+	{
+		size_t length = FuzzRandom() % sizeof(garbage);
+		for(size_t i = 0; i < length; i++)
+			garbage[i] = (uint8_t)FuzzRandom();
+		size_t count = FuzzRandom() % 256;
+		XCTAssertLessThanOrEqual(TrackCodecDecodeDeltas(garbage, length, 2, values, count), length);
+		XCTAssertLessThanOrEqual(TrackCodecDecodeRuns(garbage, length, values, count), length);
+		XCTAssertLessThanOrEqual(TrackCodecDecompress(garbage, length, out, sizeof(out)), sizeof(out));
+	}
+}
+
+//The bound is what lets a stored block's claimed raw length be trusted, so the block that expands most must fit it
+-(void)testBlocksStayWithinDecompressBound
+{
+	size_t length = 100000;
+	uint8_t *raw = calloc(length, 1);
+	uint8_t *compressed = malloc(TrackCodecCompressBound(length));
+	uint8_t *decompressed = malloc(length);
+	size_t compressedLength = TrackCodecCompress(raw, length, compressed, TrackCodecCompressBound(length));
+	XCTAssertGreaterThan(compressedLength, (size_t)0);
+	XCTAssertLessThanOrEqual(length, TrackCodecDecompressBound(compressedLength));
+	XCTAssertEqual(TrackCodecDecompress(compressed, compressedLength, decompressed, length), length);
+	XCTAssertEqual(memcmp(raw, decompressed, length), 0);
+
+	//One literal, then a match of 255 and of 256 bytes at offset 1
+	uint8_t longest[] = {1, 'a', 0xFF, 0x01, 1, 0, 0};
+	uint8_t tooLong[] = {1, 'a', 0x80, 0x02, 1, 0, 0};
+	XCTAssertEqual(TrackCodecDecompress(longest, sizeof(longest), decompressed, length), (size_t)256);
+	XCTAssertEqual(TrackCodecDecompress(tooLong, sizeof(tooLong), decompressed, length), (size_t)0);
+	free(raw);
+	free(compressed);
+	free(decompressed);
+}
+
+-(void)testTrackRoundTrip
+{
+	NSUInteger count = 5000;
+	TripTrack *track = [self randomWalkTrackWithCount:count];
+	TripTrack *decoded = [TripTrack trackWithData:[track dataRepresentation]];
+	XCTAssertNotNil(decoded);
+	XCTAssertEqual(decoded.count, count);
+	for(NSUInteger i = 0; i < count; i++)
+	{
+		XCTAssertEqualWithAccuracy(decoded.latitudes[i], track.latitudes[i], 1e-7);
+		XCTAssertEqualWithAccuracy(decoded.longitudes[i], track.longitudes[i], 1e-7);
+		XCTAssertEqualWithAccuracy(decoded.timestamps[i], track.timestamps[i], 1e-3);
+		XCTAssertEqualWithAccuracy(decoded.speeds[i], track.speeds[i], 0.01);
+		XCTAssertEqualWithAccuracy(decoded.altitudes[i], track.altitudes[i], 1);
+	}
+}
+
+-(void)testTrackRejectsCorruptBlobs
+{
+	NSData *data = [[self randomWalkTrackWithCount:2000] dataRepresentation];
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		NSMutableData *corrupt = [data mutableCopy];
+		[corrupt setLength:FuzzRandom() % data.length];
+		XCTAssertNil([TripTrack trackWithData:corrupt], @"truncated round %d", round);
+
+		corrupt = [data mutableCopy];
+		uint8_t *bytes = corrupt.mutableBytes;
+		for(int flip = 0; flip < 8; flip++)
+			bytes[FuzzRandom() % corrupt.length] ^= (uint8_t)(1 + FuzzRandom() % 255);
+		[TripTrack trackWithData:corrupt]; //may decode to other values, but must not crash
+	}
+
+	//A count far beyond what the payload holds is refused before columns are allocated for it
+	NSMutableData *huge = [data mutableCopy];
+	uint32_t count = UINT32_MAX;
+	[huge replaceBytesInRange:NSMakeRange(8, sizeof(count)) withBytes:&count];
+	XCTAssertNil([TripTrack trackWithData:huge]);
+}
+
+#pragma mark - Benchmarks
+
+//Raw column bytes per second through the codecs, logged so runs on different devices compare
+-(void)testDeltaThroughput
+{
+	int32_t *values = malloc(BENCHMARK_COUNT * sizeof(int32_t));
+	int32_t *decoded = malloc(BENCHMARK_COUNT * sizeof(int32_t));
+	uint8_t *encoded = malloc(TrackCodecDeltaBound(BENCHMARK_COUNT));
+	int32_t value = 300000000;
+	for(size_t i = 0; i < BENCHMARK_COUNT; i++)
+	{
+		value += 90 + (int32_t)(FuzzRandom() % 21) - 10; //a latitude column driving north at 1Hz
+		values[i] = value;
+	}
+	__block size_t length = 0;
+	__block CFTimeInterval encodeTime = 0, decodeTime = 0;
+	[self measureBlock:^{
+		CFTimeInterval start = CACurrentMediaTime();
+		length = TrackCodecEncodeDeltas(values, BENCHMARK_COUNT, 2, encoded);
+		CFTimeInterval middle = CACurrentMediaTime();
+		TrackCodecDecodeDeltas(encoded, length, 2, decoded, BENCHMARK_COUNT);
+		encodeTime += middle - start;
+		decodeTime += CACurrentMediaTime() - middle;
+	}];
+	XCTAssertEqual(memcmp(values, decoded, BENCHMARK_COUNT * sizeof(int32_t)), 0);
+	double megabytes = BENCHMARK_COUNT * sizeof(int32_t) / 1e6 * 10; //measureBlock runs 10 times
+	NSLog(@"[Benchmark] deltas: encode %.0f MB/s, decode %.0f MB/s, %.2f bytes per value", megabytes / encodeTime, megabytes / decodeTime, (double)length / BENCHMARK_COUNT);
+	free(values);
+	free(decoded);
+	free(encoded);
+}
+
+-(void)testBlockThroughput
+{
+	int32_t *values = malloc(BENCHMARK_COUNT * sizeof(int32_t));
+	for(size_t i = 0; i < BENCHMARK_COUNT; i++)
+		values[i] = 1000 + (int32_t)(FuzzRandom() % 3); //speed jitter around a cruise
+	uint8_t *raw = malloc(TrackCodecDeltaBound(BENCHMARK_COUNT));
+	size_t rawLength = TrackCodecEncodeDeltas(values, BENCHMARK_COUNT, 1, raw);
+	uint8_t *compressed = malloc(TrackCodecCompressBound(rawLength));
+	uint8_t *decompressed = malloc(rawLength);
+	__block size_t compressedLength = 0;
+	__block CFTimeInterval compressTime = 0, decompressTime = 0;
+	[self measureBlock:^{
+		CFTimeInterval start = CACurrentMediaTime();
+		compressedLength = TrackCodecCompress(raw, rawLength, compressed, TrackCodecCompressBound(rawLength));
+		CFTimeInterval middle = CACurrentMediaTime();
+		TrackCodecDecompress(compressed, compressedLength, decompressed, rawLength);
+		compressTime += middle - start;
+		decompressTime += CACurrentMediaTime() - middle;
+	}];
+	XCTAssertEqual(memcmp(raw, decompressed, rawLength), 0);
+	double megabytes = rawLength / 1e6 * 10;
+	NSLog(@"[Benchmark] blocks: compress %.0f MB/s, decompress %.0f MB/s, ratio %.2f", megabytes / compressTime, megabytes / decompressTime, (double)rawLength / compressedLength);
+	free(values);
+	free(raw);
+	free(compressed);
+	free(decompressed);
+}
+
+-(void)testTrackThroughput
+{
+	TripTrack *track = [self randomWalkTrackWithCount:100000];
+	__block NSData *data = nil;
+	[self measureBlock:^{
+		data = [track dataRepresentation];
+		[TripTrack trackWithData:data];
+	}];
+	NSLog(@"[Benchmark] 100k fix track: %lu bytes, %.2f bytes per fix", (unsigned long)data.length, (double)data.length / track.count);
+}
+
+#pragma mark - Helpers
+
+-(TripTrack *)randomWalkTrackWithCount:(NSUInteger)count
+{
+	NSDate *startTime = [NSDate dateWithTimeIntervalSinceReferenceDate:466000000];
+	TripTrack *track = [[TripTrack alloc] initWithCapacity:count startTime:startTime];
+	double latitude = 30.6, longitude = -96.3, timestamp = startTime.timeIntervalSinceReferenceDate;
+	float speed = 30, altitude = 300;
+	for(NSUInteger i = 0; i < count; i++)
+	{
+		latitude += ((int)(FuzzRandom() % 201) - 100) * 1e-6;
+		longitude += ((int)(FuzzRandom() % 201) - 100) * 1e-6;
+		timestamp += 1.0 + (FuzzRandom() % 100) / 1000.0;
+		speed = fmaxf(0, speed + ((int)(FuzzRandom() % 21) - 10) / 10.0f);
+		altitude += ((int)(FuzzRandom() % 5) - 2);
+		[track appendLatitude:latitude longitude:longitude timestamp:timestamp speed:speed altitude:altitude bluetoothValues:NULL];
+	}
+	return track;
+}
+
+@end
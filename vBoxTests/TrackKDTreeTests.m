@@ -0,0 +1,237 @@
+//
+//  TrackKDTreeTests.m
+//  vBoxTests
+//
+//  Created by Rosbel Sanroman on 10/20/15.
+//  Copyright (c) 2015 rosbelSanroman. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "TrackKDTree.h"
+
+#define FUZZ_ROUNDS 50
+#define FUZZ_MAX_COUNT 3000
+#define QUERIES_PER_ROUND 40
+#define RADIUS_CAPACITY 64 //smaller than many results, so truncation is covered too
+#define DEGENERATE_COUNT 100000
+#define EARTH_RADIUS 6371009.0 //as in TrackKDTree.c
+#define KD_PI 3.14159265358979323846
+
+//Deterministic so a failing round can be replayed
+static uint64_t fuzzState;
+
+static uint32_t FuzzRandom(void)
+{
+	fuzzState ^= fuzzState << 13;
+	fuzzState ^= fuzzState >> 7;
+	fuzzState ^= fuzzState << 17;
+	return (uint32_t)(fuzzState >> 32);
+}
+
+//Mixes a wandering drive with straight north-south stretches and parked stops, which repeat keys on the split axes
+static void FillTrack(double *latitudes, double *longitudes, size_t count)
+{
+	double latitude = 30.6, longitude = -96.3;
+	for(size_t i = 0; i < count; i++)
+	{
+		switch(FuzzRandom() % 16)
+		{
+			case 0: break; //parked
+			case 1: case 2: latitude += 1e-4; break; //north on one longitude
+			default:
+				latitude += ((int)(FuzzRandom() % 201) - 100) * 1e-6;
+				longitude += ((int)(FuzzRandom() % 201) - 100) * 1e-6;
+				break;
+		}
+		latitudes[i] = latitude;
+		longitudes[i] = longitude;
+	}
+}
+
+/*
+ Brute force over the same projection as the tree, so both sides see the same distances. Squared
+ distances come back in projected meters, the metric the tree's answers are exact in.
+ */
+typedef struct {
+	double originLatitude, originLongitude, metersPerDegree, metersPerLongitude;
+} BruteProjection;
+
+static BruteProjection BruteProjectionMake(const double *latitudes, const double *longitudes, size_t count)
+{
+	double minLatitude = latitudes[0], maxLatitude = latitudes[0];
+	for(size_t i = 1; i < count; i++)
+	{
+		minLatitude = fmin(minLatitude, latitudes[i]);
+		maxLatitude = fmax(maxLatitude, latitudes[i]);
+	}
+	BruteProjection projection;
+	projection.originLatitude = (minLatitude + maxLatitude) / 2;
+	projection.originLongitude = longitudes[0];
+	projection.metersPerDegree = EARTH_RADIUS * KD_PI / 180.0;
+	projection.metersPerLongitude = projection.metersPerDegree * cos(projection.originLatitude * KD_PI / 180.0);
+	return projection;
+}
+
+static double BruteDistanceSquared(BruteProjection projection, double latitudeA, double longitudeA, double latitudeB, double longitudeB)
+{
+	double dx = (longitudeA - projection.originLongitude) * projection.metersPerLongitude - (longitudeB - projection.originLongitude) * projection.metersPerLongitude;
+	double dy = (latitudeA - projection.originLatitude) * projection.metersPerDegree - (latitudeB - projection.originLatitude) * projection.metersPerDegree;
+	return dx * dx + dy * dy;
+}
+
+@interface TrackKDTreeTests : XCTestCase
+
+@end
+
+@implementation TrackKDTreeTests
+
+-(void)setUp
+{
+	[super setUp];
+	fuzzState = 0x9E3779B97F4A7C15ull;
+}
+
+#pragma mark - Brute Force Equivalence
+
+-(void)testNearestMatchesBruteForce
+{
+	double *latitudes = malloc(FUZZ_MAX_COUNT * sizeof(double));
+	double *longitudes = malloc(FUZZ_MAX_COUNT * sizeof(double));
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		size_t count = 1 + FuzzRandom() % FUZZ_MAX_COUNT;
+		FillTrack(latitudes, longitudes, count);
+		BruteProjection projection = BruteProjectionMake(latitudes, longitudes, count);
+		TrackKDTree *tree = TrackKDTreeCreate(latitudes, longitudes, count);
+		XCTAssert(tree != NULL);
+
+		for(int q = 0; q < QUERIES_PER_ROUND; q++)
+		{
+			//Half the queries sit on a fix, the rest near the track
+			size_t anchor = FuzzRandom() % count;
+			double latitude = latitudes[anchor], longitude = longitudes[anchor];
+			if(q % 2)
+			{
+				latitude += ((int)(FuzzRandom() % 2001) - 1000) * 1e-6;
+				longitude += ((int)(FuzzRandom() % 2001) - 1000) * 1e-6;
+			}
+
+			double bestDistance = INFINITY;
+			for(size_t i = 0; i < count; i++)
+				bestDistance = fmin(bestDistance, BruteDistanceSquared(projection, latitude, longitude, latitudes[i], longitudes[i]));
+
+			double distance = -1;
+			size_t nearest = TrackKDTreeNearest(tree, latitude, longitude, &distance);
+			XCTAssertLessThan(nearest, count);
+			//Ties make the index ambiguous, but not the distance
+			XCTAssertEqualWithAccuracy(BruteDistanceSquared(projection, latitude, longitude, latitudes[nearest], longitudes[nearest]), bestDistance, 1e-6, @"round %d query %d", round, q);
+			XCTAssertEqualWithAccuracy(distance, sqrt(bestDistance), 1e-6, @"round %d query %d", round, q);
+		}
+		TrackKDTreeFree(tree);
+	}
+	free(latitudes);
+	free(longitudes);
+}
+
+-(void)testWithinRadiusMatchesBruteForce
+{
+	double *latitudes = malloc(FUZZ_MAX_COUNT * sizeof(double));
+	double *longitudes = malloc(FUZZ_MAX_COUNT * sizeof(double));
+	size_t *expected = malloc(FUZZ_MAX_COUNT * sizeof(size_t));
+	size_t indexes[RADIUS_CAPACITY];
+	for(int round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		size_t count = 1 + FuzzRandom() % FUZZ_MAX_COUNT;
+		FillTrack(latitudes, longitudes, count);
+		BruteProjection projection = BruteProjectionMake(latitudes, longitudes, count);
+		TrackKDTree *tree = TrackKDTreeCreate(latitudes, longitudes, count);
+
+		for(int q = 0; q < QUERIES_PER_ROUND; q++)
+		{
+			size_t anchor = FuzzRandom() % count;
+			double latitude = latitudes[anchor] + ((int)(FuzzRandom() % 201) - 100) * 1e-6;
+			double longitude = longitudes[anchor] + ((int)(FuzzRandom() % 201) - 100) * 1e-6;
+			double radius = 1 + FuzzRandom() % 200;
+
+			size_t expectedCount = 0;
+			for(size_t i = 0; i < count; i++)
+			{
+				if(BruteDistanceSquared(projection, latitude, longitude, latitudes[i], longitudes[i]) <= radius * radius)
+					expected[expectedCount++] = i; //ascending, as the tree sorts them
+			}
+
+			size_t found = TrackKDTreeWithinRadius(tree, latitude, longitude, radius, indexes, RADIUS_CAPACITY);
+			XCTAssertEqual(found, expectedCount, @"round %d query %d", round, q);
+			//Only the first capacity found are written, in no particular order before the sort, so check membership
+			size_t written = MIN(found, (size_t)RADIUS_CAPACITY);
+			for(size_t i = 0; i < written; i++)
+			{
+				if(i > 0)
+					XCTAssertLessThan(indexes[i-1], indexes[i], @"round %d query %d", round, q);
+				XCTAssertLessThanOrEqual(BruteDistanceSquared(projection, latitude, longitude, latitudes[indexes[i]], longitudes[indexes[i]]), radius * radius, @"round %d query %d", round, q);
+			}
+			if(found <= RADIUS_CAPACITY && found == expectedCount)
+				XCTAssertEqual(memcmp(indexes, expected, found * sizeof(size_t)), 0, @"round %d query %d", round, q);
+		}
+		TrackKDTreeFree(tree);
+	}
+	free(latitudes);
+	free(longitudes);
+	free(expected);
+}
+
+#pragma mark - Repeated Keys
+
+//A two-way partition took seconds on each of these; with equal keys settled in one pass they take milliseconds
+-(void)testBuildsOnOneLongitude
+{
+	double *latitudes = malloc(DEGENERATE_COUNT * sizeof(double));
+	double *longitudes = malloc(DEGENERATE_COUNT * sizeof(double));
+	for(size_t i = 0; i < DEGENERATE_COUNT; i++)
+	{
+		latitudes[i] = 30.6 + i * 1e-5;
+		longitudes[i] = -96.3;
+	}
+	[self assertBuildsQuicklyWithLatitudes:latitudes longitudes:longitudes label:@"one longitude"];
+	free(latitudes);
+	free(longitudes);
+}
+
+-(void)testBuildsOnIdenticalFixes
+{
+	double *latitudes = malloc(DEGENERATE_COUNT * sizeof(double));
+	double *longitudes = malloc(DEGENERATE_COUNT * sizeof(double));
+	for(size_t i = 0; i < DEGENERATE_COUNT; i++)
+	{
+		latitudes[i] = 30.6;
+		longitudes[i] = -96.3;
+	}
+	[self assertBuildsQuicklyWithLatitudes:latitudes longitudes:longitudes label:@"identical fixes"];
+
+	TrackKDTree *tree = TrackKDTreeCreate(latitudes, longitudes, DEGENERATE_COUNT);
+	size_t indexes[RADIUS_CAPACITY];
+	XCTAssertEqual(TrackKDTreeWithinRadius(tree, 30.6, -96.3, 1, indexes, RADIUS_CAPACITY), (size_t)DEGENERATE_COUNT);
+	double distance = -1;
+	XCTAssertLessThan(TrackKDTreeNearest(tree, 30.6, -96.3, &distance), (size_t)DEGENERATE_COUNT);
+	XCTAssertEqual(distance, 0.0);
+	TrackKDTreeFree(tree);
+	free(latitudes);
+	free(longitudes);
+}
+
+#pragma mark - Helpers
+
+-(void)assertBuildsQuicklyWithLatitudes:(const double *)latitudes longitudes:(const double *)longitudes label:(NSString *)label
+{
+	CFTimeInterval start = CACurrentMediaTime();
+	TrackKDTree *tree = TrackKDTreeCreate(latitudes, longitudes, DEGENERATE_COUNT);
+	CFTimeInterval duration = CACurrentMediaTime() - start;
+	XCTAssert(tree != NULL);
+	//Far above an O(n log n) build even on an old device, far below a quadratic one
+	XCTAssertLessThan(duration, 1.0, @"%@", label);
+	NSLog(@"[Benchmark] kd-tree build, %d fixes, %@: %.1f ms", DEGENERATE_COUNT, label, duration * 1000);
+	TrackKDTreeFree(tree);
+}
+
+@end